@@ -0,0 +1,133 @@
+#include "arena.h"
+#include "err.h"
+#include "helpers.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t cap;
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+} ArenaBlock;
+
+// Memory is bumped from the head block. Requests which do not fit spill into
+// overflow blocks, and the next reset folds them into one larger head block so
+// that each subsequent round fits without further allocation.
+struct Arena {
+    ArenaBlock *head;
+    ArenaBlock *overflow;
+    size_t overflow_cap;
+};
+
+ArenaBlock *arena_block_make(size_t cap);
+void *arena_block_bump(ArenaBlock *b, size_t size, size_t align);
+
+void arena_init(Err **err, Arena **arena, size_t cap) {
+    Arena *a = ZALLOC(sizeof(*a));
+    if (!a) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate memory for arena");
+        return;
+    }
+
+    a->head = arena_block_make(cap);
+    if (!a->head) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate arena block of %zu bytes",
+                             cap);
+        arena_destroy(&a);
+        return;
+    }
+
+    *arena = a;
+}
+
+void *arena_alloc(Arena *a, size_t size, size_t align) {
+    void *p = arena_block_bump(a->head, size, align);
+    if (p) {
+        return p;
+    }
+
+    if (a->overflow) {
+        p = arena_block_bump(a->overflow, size, align);
+        if (p) {
+            return p;
+        }
+    }
+
+    // Spill into a new overflow block, sized to at least double the request
+    size_t cap = MAX_N((size + align) * 2, a->head->cap / 2);
+    ArenaBlock *b = arena_block_make(cap);
+    if (!b) {
+        return NULL;
+    }
+    b->next = a->overflow;
+    a->overflow = b;
+    a->overflow_cap += cap;
+    return arena_block_bump(b, size, align);
+}
+
+void arena_reset(Arena *a) {
+    a->head->used = 0;
+    if (!a->overflow) {
+        return;
+    }
+
+    // Previous round outgrew the head block; replace it with one large enough
+    // to hold everything that round needed
+    size_t cap = a->head->cap + a->overflow_cap;
+    while (a->overflow) {
+        ArenaBlock *next = a->overflow->next;
+        free(a->overflow);
+        a->overflow = next;
+    }
+    a->overflow_cap = 0;
+
+    ArenaBlock *b = arena_block_make(cap);
+    if (b) {
+        free(a->head);
+        a->head = b;
+    }
+}
+
+size_t arena_getcap(Arena *a) { return a->head->cap + a->overflow_cap; }
+
+void arena_destroy(Arena **arena) {
+    if (!arena || !*arena) {
+        return;
+    }
+
+    Arena *a = *arena;
+    while (a->overflow) {
+        ArenaBlock *next = a->overflow->next;
+        free(a->overflow);
+        a->overflow = next;
+    }
+    free(a->head);
+
+    free(a);
+    a = NULL;
+    *arena = NULL;
+}
+
+ArenaBlock *arena_block_make(size_t cap) {
+    ArenaBlock *b = malloc(sizeof(*b) + cap);
+    if (!b) {
+        return NULL;
+    }
+    b->next = NULL;
+    b->cap = cap;
+    b->used = 0;
+    return b;
+}
+
+void *arena_block_bump(ArenaBlock *b, size_t size, size_t align) {
+    uintptr_t base = (uintptr_t)b->data;
+    uintptr_t p = base + b->used;
+    size_t pad = (align - (size_t)(p % align)) % align;
+    if (pad + size > b->cap - b->used) {
+        return NULL;
+    }
+    b->used += pad + size;
+    return b->data + (p - base) + pad;
+}
@@ -0,0 +1,20 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "err.h"
+#include <stdalign.h>
+#include <stddef.h>
+
+typedef struct Arena Arena;
+
+void arena_init(Err **err, Arena **arena, size_t cap);
+void *arena_alloc(Arena *arena, size_t size, size_t align);
+void arena_reset(Arena *arena);
+size_t arena_getcap(Arena *arena);
+void arena_destroy(Arena **arena);
+
+#define ARENA_ALLOC(arena, type, count)                                        \
+    ((type *)arena_alloc((arena), sizeof(type) * (size_t)(count),             \
+                         alignof(type)))
+
+#endif
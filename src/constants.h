@@ -4,16 +4,30 @@
 typedef enum JankeyState {
     JANKEY_STATE_RUNNING_TEST,
     JANKEY_STATE_DISPLAYING_POST_TEST_MODAL,
+    JANKEY_STATE_DISPLAYING_HEATMAP,
+    JANKEY_STATE_DISPLAYING_REVIEW,
     JANKEY_STATE_QUITTING
 } JankeyState;
 
+typedef enum TestMode {
+    TEST_MODE_RANDOM,
+    TEST_MODE_ADAPTIVE,
+    TEST_MODE_DRILL,
+    TEST_MODE_SENTENCES,
+    TEST_MODE_GHOST,
+    TEST_MODE_COUNT
+} TestMode;
+
 #define WORDS_PER_TEST (size_t)8
 #define MAX_CHARS_PER_LINE 66
 #define MAX_TEST_WIN_ROWS 3
 #define MIN_WIN_WIDTH 24
 
+#define ROUND_ARENA_CAP ((size_t)512 * 1024)
+
 #define COLOR_PAIR_WHITE 3
 #define COLOR_PAIR_GREEN 1
 #define COLOR_PAIR_RED 2
+#define COLOR_PAIR_YELLOW 4
 
 #endif
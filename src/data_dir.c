@@ -0,0 +1,61 @@
+#define _POSIX_C_SOURCE 200809L
+#include "data_dir.h"
+#include "err.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+void data_dir_mkdirs(Err **err, char *path);
+
+// Resolve file_name within $XDG_DATA_HOME/jankey_type, falling back to
+// ~/.local/share/jankey_type, creating the directory if needed
+void data_dir_path(Err **err, char *buff, size_t buff_size,
+                   const char *file_name) {
+    const char *xdg = getenv("XDG_DATA_HOME");
+    const char *home = getenv("HOME");
+
+    int n;
+    if (xdg && xdg[0] == '/') {
+        n = snprintf(buff, buff_size, "%s/jankey_type/", xdg);
+    } else if (home && home[0]) {
+        n = snprintf(buff, buff_size, "%s/.local/share/jankey_type/", home);
+    } else {
+        *err = ERR_MAKE_CODE(ERR_IO, "Neither XDG_DATA_HOME nor HOME is set");
+        return;
+    }
+    if (n < 0 || (size_t)n >= buff_size) {
+        *err = ERR_MAKE_CODE(ERR_RANGE, "Data directory path too long");
+        return;
+    }
+
+    data_dir_mkdirs(err, buff);
+    if (*err) {
+        return;
+    }
+
+    size_t dir_len = (size_t)n;
+    n = snprintf(buff + dir_len, buff_size - dir_len, "%s", file_name);
+    if (n < 0 || (size_t)n >= buff_size - dir_len) {
+        *err = ERR_MAKE_CODE(ERR_RANGE, "Data file path too long");
+        return;
+    }
+}
+
+void data_dir_mkdirs(Err **err, char *path) {
+    for (char *p = path + 1; *p; p++) {
+        if (*p != '/') {
+            continue;
+        }
+        *p = '\0';
+        int rc = mkdir(path, 0700);
+        int e = errno;
+        *p = '/';
+        if (rc && e != EEXIST) {
+            *err = ERR_MAKE_CODE(ERR_IO, "Unable to create %s: %s", path,
+                                 strerror(e));
+            return;
+        }
+    }
+}
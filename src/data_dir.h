@@ -0,0 +1,12 @@
+#ifndef DATA_DIR_H
+#define DATA_DIR_H
+
+#include "err.h"
+#include <stddef.h>
+
+#define DATA_PATH_CAP 4096
+
+void data_dir_path(Err **err, char *buff, size_t buff_size,
+                   const char *file_name);
+
+#endif
@@ -0,0 +1,243 @@
+// fstat's st_mtim
+#define _POSIX_C_SOURCE 200809L
+#include "dict_image.h"
+#include "err.h"
+#include "helpers.h"
+#include "ngram_index.h"
+#include "perfect_hash.h"
+#include "word_weights.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DI_MAGIC "JKDICT"
+#define DI_VERSION 2u
+#define DI_PATH_CAP 64
+
+// Every process running the same dictionary file maps the same image, named
+// after the file's identity. The header records the file's size and mtime
+// and the image is rebuilt in place when they no longer match, so a hit is
+// found from a stat alone without reading the file.
+//
+// The first process to miss parses the dictionary and builds its indexes as
+// before, then writes the image to a private name and renames it into place,
+// so an image is either absent or complete. Others may be reading an older
+// image meanwhile; their mapping stays valid after the rename. Only section
+// sizes are checked on open. The contents are trusted as images are refused
+// unless this user owns them and nobody else could have written them.
+typedef struct DIHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dict_hash;
+    uint64_t source_dev;
+    uint64_t source_ino;
+    int64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t word_count;
+    uint64_t text_len;
+    uint64_t lookup_len;
+    uint64_t weights_len;
+    uint64_t ngrams_len;
+    uint64_t map_len;
+} DIHeader;
+
+void di_path(char *buff, size_t buff_size, const struct stat *source);
+void di_header(DIHeader *hdr, const struct stat *source);
+size_t di_layout(DictImage *image, size_t text_len);
+size_t di_align8(size_t n);
+
+// Map the image for the dictionary file source, false if there is no usable
+// one and the caller should parse it
+bool dict_image_open(const struct stat *source, DictImage *image) {
+    *image = (DictImage){0};
+    char path[DI_PATH_CAP];
+    di_path(path, sizeof(path), source);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+        st.st_mode & 022 || (size_t)st.st_size < sizeof(DIHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    DIHeader want;
+    di_header(&want, source);
+    const DIHeader *hdr = map;
+    bool valid = !memcmp(hdr->magic, want.magic, sizeof(hdr->magic)) &&
+                 hdr->version == want.version &&
+                 hdr->source_dev == want.source_dev &&
+                 hdr->source_ino == want.source_ino &&
+                 hdr->source_size == want.source_size &&
+                 hdr->source_mtime_ns == want.source_mtime_ns &&
+                 hdr->map_len == len && hdr->word_count &&
+                 hdr->word_count < UINT32_MAX && hdr->text_len < UINT32_MAX &&
+                 hdr->lookup_len < len && hdr->weights_len < len &&
+                 hdr->ngrams_len < len;
+    if (valid) {
+        image->map = map;
+        image->dict_hash = hdr->dict_hash;
+        image->word_count = (size_t)hdr->word_count;
+        image->lookup_len = (size_t)hdr->lookup_len;
+        image->weights_len = (size_t)hdr->weights_len;
+        image->ngrams_len = (size_t)hdr->ngrams_len;
+        valid = di_layout(image, (size_t)hdr->text_len) == len;
+    }
+    if (!valid) {
+        munmap(map, len);
+        *image = (DictImage){0};
+        return false;
+    }
+    image->map_len = len;
+    return true;
+}
+
+// Write the image for a dictionary this process parsed from source, with the
+// indexes it built over the words
+void dict_image_publish(Err **err, const struct stat *source,
+                        char *const *words, const uint32_t *word_lens,
+                        const uint32_t *word_chars, size_t word_count,
+                        uint32_t dict_hash, const PerfectHash *lookup,
+                        const WordWeights *weights,
+                        const NgramIndex *ngrams) {
+    if (*err) {
+        return;
+    }
+    size_t text_len = 0;
+    for (size_t i = 0; i < word_count; i++) {
+        text_len += word_lens[i] + 1;
+    }
+    if (!word_count || word_count >= UINT32_MAX || text_len >= UINT32_MAX) {
+        return;
+    }
+
+    DictImage image = {
+        .word_count = word_count,
+        .lookup_len = perfect_hash_imagelen(lookup),
+        .weights_len = word_weights_imagelen(weights),
+        .ngrams_len = ngram_index_imagelen(ngrams),
+    };
+    size_t len = di_layout(&image, text_len);
+
+    char path[DI_PATH_CAP];
+    char tmp_path[DI_PATH_CAP + 16];
+    di_path(path, sizeof(path), source);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long)getpid());
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+    if (fd < 0) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to create %s: %s", tmp_path,
+                             strerror(errno));
+        return;
+    }
+    void *map = MAP_FAILED;
+    if (!ftruncate(fd, (off_t)len)) {
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        unlink(tmp_path);
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to size %s", tmp_path);
+        return;
+    }
+
+    DIHeader hdr;
+    di_header(&hdr, source);
+    hdr.dict_hash = dict_hash;
+    hdr.word_count = word_count;
+    hdr.text_len = text_len;
+    hdr.lookup_len = image.lookup_len;
+    hdr.weights_len = image.weights_len;
+    hdr.ngrams_len = image.ngrams_len;
+    hdr.map_len = len;
+    memcpy(map, &hdr, sizeof(hdr));
+
+    image.map = map;
+    di_layout(&image, text_len);
+    uint32_t off = 0;
+    for (size_t i = 0; i < word_count; i++) {
+        image.word_offs[i] = off;
+        image.word_lens[i] = word_lens[i];
+        image.word_chars[i] = word_chars[i];
+        memcpy(image.text + off, words[i], word_lens[i] + 1);
+        off += word_lens[i] + 1;
+    }
+    perfect_hash_writeimage(lookup, image.lookup);
+    word_weights_writeimage(weights, image.weights);
+    ngram_index_writeimage(ngrams, image.ngrams);
+    munmap(map, len);
+
+    if (rename(tmp_path, path)) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to publish %s: %s", path,
+                             strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
+void dict_image_close(DictImage *image) {
+    if (image->map) {
+        munmap(image->map, image->map_len);
+    }
+    *image = (DictImage){0};
+}
+
+// Named per user as well, so users sharing a dictionary never contend for
+// one image, which only its owner would accept anyway
+void di_path(char *buff, size_t buff_size, const struct stat *source) {
+    uint64_t id[2] = {(uint64_t)source->st_dev, (uint64_t)source->st_ino};
+    snprintf(buff, buff_size, "%s/jankey-dict-%lu-%08x", DICT_IMAGE_DIR,
+             (unsigned long)geteuid(), hash_fnv1a(id, sizeof(id)));
+}
+
+void di_header(DIHeader *hdr, const struct stat *source) {
+    *hdr = (DIHeader){
+        .version = DI_VERSION,
+        .source_dev = (uint64_t)source->st_dev,
+        .source_ino = (uint64_t)source->st_ino,
+        .source_size = (int64_t)source->st_size,
+        .source_mtime_ns = (int64_t)source->st_mtim.tv_sec * 1000000000 +
+                           (int64_t)source->st_mtim.tv_nsec,
+    };
+    memcpy(hdr->magic, DI_MAGIC, sizeof(DI_MAGIC));
+}
+
+// Point the sections of image at its map, or just size them with no map.
+// Returns the image length.
+size_t di_layout(DictImage *image, size_t text_len) {
+    size_t n = image->word_count;
+    size_t offs = di_align8(sizeof(DIHeader));
+    size_t lens = offs + di_align8(n * sizeof(uint32_t));
+    size_t chars = lens + di_align8(n * sizeof(uint32_t));
+    size_t text = chars + di_align8(n * sizeof(uint32_t));
+    size_t lookup = text + di_align8(text_len);
+    size_t weights = lookup + di_align8(image->lookup_len);
+    size_t ngrams = weights + di_align8(image->weights_len);
+    if (image->map) {
+        char *base = image->map;
+        image->word_offs = (void *)(base + offs);
+        image->word_lens = (void *)(base + lens);
+        image->word_chars = (void *)(base + chars);
+        image->text = base + text;
+        image->lookup = base + lookup;
+        image->weights = base + weights;
+        image->ngrams = base + ngrams;
+    }
+    return ngrams + image->ngrams_len;
+}
+
+size_t di_align8(size_t n) { return (n + 7) & ~(size_t)7; }
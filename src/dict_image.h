@@ -0,0 +1,44 @@
+#ifndef DICT_IMAGE_H
+#define DICT_IMAGE_H
+
+#include "err.h"
+#include "ngram_index.h"
+#include "perfect_hash.h"
+#include "word_weights.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define DICT_IMAGE_DIR "/dev/shm"
+
+// A parsed dictionary with its lookup hash, weakness profiles and n-gram
+// index in one read-only shared mapping. Words are NUL terminated and back
+// to back in text, word i at word_offs[i].
+typedef struct DictImage {
+    void *map;
+    size_t map_len;
+    uint32_t dict_hash;
+    size_t word_count;
+    uint32_t *word_offs;
+    uint32_t *word_lens;
+    uint32_t *word_chars;
+    char *text;
+    void *lookup;
+    size_t lookup_len;
+    void *weights;
+    size_t weights_len;
+    void *ngrams;
+    size_t ngrams_len;
+} DictImage;
+
+bool dict_image_open(const struct stat *source, DictImage *image);
+void dict_image_publish(Err **err, const struct stat *source,
+                        char *const *words, const uint32_t *word_lens,
+                        const uint32_t *word_chars, size_t word_count,
+                        uint32_t dict_hash, const PerfectHash *lookup,
+                        const WordWeights *weights,
+                        const NgramIndex *ngrams);
+void dict_image_close(DictImage *image);
+
+#endif
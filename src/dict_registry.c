@@ -0,0 +1,204 @@
+#define _POSIX_C_SOURCE 200809L
+#include "dict_registry.h"
+#include "data_dir.h"
+#include "err.h"
+#include "helpers.h"
+#include "string_pool.h"
+#include "word_store.h"
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define DR_DICT_EXT ".txt"
+#define DR_CORPUS_PREFIX "corpus_"
+
+// Dictionaries are the <name>.txt files in the dict dir, other than corpora.
+// Each is parsed the first time it is selected and kept for the life of the
+// registry, so switching back is just a pointer swap. Words are interned in
+// one pool shared by all of them. A dict may have a corpus_<name>.txt for
+// sentence mode, with its model cached as markov_<name>.bin.
+typedef struct DREntry {
+    char name[DICT_NAME_CAP];
+    WordStore *ws;
+} DREntry;
+
+struct DictRegistry {
+    char *dir;
+    StringPool *strings;
+    DREntry *dicts;
+    size_t dict_count;
+};
+
+bool dr_dict_name(const char *file_name, char name[DICT_NAME_CAP]);
+int dr_cmp_entry(const void *a, const void *b);
+void dr_loadcorpus(DictRegistry *reg, DREntry *e);
+
+void dict_registry_init(Err **err, DictRegistry **registry,
+                        const char *dict_dir) {
+    DictRegistry *reg = ZALLOC(sizeof(*reg));
+    if (!reg) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for dict registry");
+        return;
+    }
+    reg->dir = strdup(dict_dir);
+    if (!reg->dir) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to copy dict dir");
+        dict_registry_destroy(&reg);
+        return;
+    }
+    string_pool_init(err, &reg->strings);
+    if (*err) {
+        dict_registry_destroy(&reg);
+        return;
+    }
+
+    DIR *d = opendir(dict_dir);
+    if (!d) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to open dict dir %s", dict_dir);
+        dict_registry_destroy(&reg);
+        return;
+    }
+
+    size_t cap = 0;
+    struct dirent *de = NULL;
+    while ((de = readdir(d))) {
+        char name[DICT_NAME_CAP];
+        if (!dr_dict_name(de->d_name, name)) {
+            continue;
+        }
+        if (reg->dict_count == cap) {
+            cap = MAX_N(cap * 2, (size_t)8);
+            DREntry *t = realloc(reg->dicts, cap * sizeof(*t));
+            if (!t) {
+                closedir(d);
+                *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to grow dict list");
+                dict_registry_destroy(&reg);
+                return;
+            }
+            reg->dicts = t;
+        }
+        DREntry *e = &reg->dicts[reg->dict_count++];
+        memcpy(e->name, name, sizeof(e->name));
+        e->ws = NULL;
+    }
+    closedir(d);
+
+    if (!reg->dict_count) {
+        *err = ERR_MAKE("No dictionaries found in %s", dict_dir);
+        dict_registry_destroy(&reg);
+        return;
+    }
+    qsort(reg->dicts, reg->dict_count, sizeof(*reg->dicts), dr_cmp_entry);
+
+    *registry = reg;
+}
+
+size_t dict_registry_count(const DictRegistry *reg) { return reg->dict_count; }
+
+const char *dict_registry_name(const DictRegistry *reg, size_t i) {
+    return reg->dicts[i].name;
+}
+
+// Index of the named dictionary, or DICT_NONE
+size_t dict_registry_find(const DictRegistry *reg, const char *name) {
+    for (size_t i = 0; i < reg->dict_count; i++) {
+        if (!strcmp(reg->dicts[i].name, name)) {
+            return i;
+        }
+    }
+    return DICT_NONE;
+}
+
+// Word store for dictionary i, loading it on first use
+WordStore *dict_registry_get(Err **err, DictRegistry *reg, size_t i) {
+    if (*err) {
+        return NULL;
+    }
+    DREntry *e = &reg->dicts[i];
+    if (e->ws) {
+        return e->ws;
+    }
+
+    char path[DATA_PATH_CAP];
+    int n = snprintf(path, sizeof(path), "%s/%s" DR_DICT_EXT, reg->dir,
+                     e->name);
+    if (n < 0 || (size_t)n >= sizeof(path)) {
+        *err = ERR_MAKE_CODE(ERR_RANGE, "Dict path too long");
+        return NULL;
+    }
+    word_store_init(err, &e->ws, path, reg->strings);
+    if (*err) {
+        return NULL;
+    }
+    dr_loadcorpus(reg, e);
+    return e->ws;
+}
+
+void dict_registry_destroy(DictRegistry **registry) {
+    if (!registry || !*registry) {
+        return;
+    }
+
+    DictRegistry *reg = *registry;
+    for (size_t i = 0; i < reg->dict_count; i++) {
+        if (reg->dicts[i].ws) {
+            word_store_destroy(&reg->dicts[i].ws);
+        }
+    }
+    free(reg->dicts);
+    // Stores point into the pool, so it goes last
+    if (reg->strings) {
+        string_pool_destroy(&reg->strings);
+    }
+    free(reg->dir);
+
+    free(reg);
+    reg = NULL;
+    *registry = NULL;
+}
+
+// Dictionary name for a file in the dict dir, false if it is not one
+bool dr_dict_name(const char *file_name, char name[DICT_NAME_CAP]) {
+    size_t len = strlen(file_name);
+    size_t ext_len = strlen(DR_DICT_EXT);
+    if (len <= ext_len || strcmp(file_name + len - ext_len, DR_DICT_EXT) ||
+        !strncmp(file_name, DR_CORPUS_PREFIX, strlen(DR_CORPUS_PREFIX)) ||
+        file_name[0] == '.' || len - ext_len >= DICT_NAME_CAP) {
+        return false;
+    }
+    memcpy(name, file_name, len - ext_len);
+    name[len - ext_len] = '\0';
+    return true;
+}
+
+int dr_cmp_entry(const void *a, const void *b) {
+    const DREntry *x = a;
+    const DREntry *y = b;
+    return strcmp(x->name, y->name);
+}
+
+// Without a corpus or data dir, sentence mode falls back to random words
+void dr_loadcorpus(DictRegistry *reg, DREntry *e) {
+    char corpus[DATA_PATH_CAP];
+    int n = snprintf(corpus, sizeof(corpus),
+                     "%s/" DR_CORPUS_PREFIX "%s" DR_DICT_EXT, reg->dir,
+                     e->name);
+    struct stat st;
+    if (n < 0 || (size_t)n >= sizeof(corpus) || stat(corpus, &st)) {
+        return;
+    }
+
+    Err *err = NULL;
+    char model_name[DICT_NAME_CAP + 16];
+    snprintf(model_name, sizeof(model_name), "markov_%s.bin", e->name);
+    char model[DATA_PATH_CAP];
+    data_dir_path(&err, model, sizeof(model), model_name);
+    word_store_loadcorpus(&err, e->ws, corpus, model);
+    if (err) {
+        RESET_ERR(err);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef DICT_REGISTRY_H
+#define DICT_REGISTRY_H
+
+#include "err.h"
+#include "word_store.h"
+#include <stddef.h>
+
+#define DICT_NAME_CAP 64
+#define DICT_NONE SIZE_MAX
+
+typedef struct DictRegistry DictRegistry;
+
+void dict_registry_init(Err **err, DictRegistry **registry,
+                        const char *dict_dir);
+size_t dict_registry_count(const DictRegistry *registry);
+const char *dict_registry_name(const DictRegistry *registry, size_t i);
+size_t dict_registry_find(const DictRegistry *registry, const char *name);
+WordStore *dict_registry_get(Err **err, DictRegistry *registry, size_t i);
+void dict_registry_destroy(DictRegistry **registry);
+
+#endif
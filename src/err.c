@@ -1,71 +1,62 @@
 #include "err.h"
-#include "helpers.h"
+#include <assert.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
-Err *err_make_va(const char *file, int line, const char *format, va_list args);
-
-Err *err_make(const char *file, int line, const char *msg, ...) {
+static Err err_pool[ERR_POOL_CAP];
+// One bit per slot, set while the slot is in use
+static _Atomic uint64_t err_pool_used = 0;
+static_assert(ERR_POOL_CAP == 64, "pool bitmap holds 64 slots");
+
+// Handed out when every slot is taken, never released
+static Err err_pool_exhausted = {
+    .code = ERR_NOMEM,
+    .line = 0,
+    .file = NULL,
+    .msg = "Error pool exhausted",
+};
+
+__attribute__((format(printf, 4, 0))) Err *
+err_make_va(ErrCode code, const char *file, int line, const char *format,
+            va_list args);
+Err *err_pool_claim(void);
+void err_pool_release(Err *err);
+
+Err *err_make(ErrCode code, const char *file, int line, const char *msg, ...) {
     va_list args;
     va_start(args, msg);
-    Err *err = err_make_va(file, line, msg, args);
+    Err *err = err_make_va(code, file, line, msg, args);
     va_end(args);
     return err;
 }
 
-Err *err_make_va(const char *file, int line, const char *format, va_list args) {
-    if (!format) {
-        return NULL;
-    }
-
-    Err *err = malloc(sizeof(Err));
+Err *err_make_va(ErrCode code, const char *file, int line, const char *format,
+                 va_list args) {
+    Err *err = err_pool_claim();
     if (!err) {
-        return NULL;
-    }
-
-    // Copy file name
-    if (file) {
-        size_t file_len = strlen(file) + 1;
-        err->file = malloc(file_len);
-        if (!err->file) {
-            free(err);
-            return NULL;
-        }
-        string_copy(err->file, file_len, file, file_len);
-    } else {
-        err->file = NULL;
+        return &err_pool_exhausted;
     }
 
+    err->code = code;
+    err->file = file;
     err->line = line;
 
-    // Allocate memory for message
-    va_list args_copy;
-    va_copy(args_copy, args);
+    if (!format) {
+        err->msg[0] = '\0';
+        return err;
+    }
 
+    // Messages longer than the inline buffer are truncated
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wformat-nonliteral"
     // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-    int msg_len = vsnprintf(NULL, (size_t)0, format, args_copy);
-
-    va_end(args_copy);
-
-    if (msg_len < 0) {
-        free(err->file);
-        free(err);
-        return NULL;
+    if (vsnprintf(err->msg, sizeof(err->msg), format, args) < 0) {
+        err->msg[0] = '\0';
     }
-
-    err->msg = malloc((size_t)(msg_len + 1));
-    if (!err->msg) {
-        free(err->file);
-        free(err);
-        return NULL;
-    }
-    // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-    vsnprintf(err->msg, (size_t)(msg_len + 1), format, args);
-
 #pragma clang diagnostic pop
+
     return err;
 }
 
@@ -74,20 +65,7 @@ void err_destroy(Err **err) {
         return;
     }
 
-    Err *e = *err;
-
-    if (e->file) {
-        free(e->file);
-        e->file = NULL;
-    }
-
-    if (e->msg) {
-        free(e->msg);
-        e->msg = NULL;
-    }
-
-    free(e);
-    e = NULL;
+    err_pool_release(*err);
     *err = NULL;
 }
 
@@ -100,13 +78,37 @@ void err_print(const Err *err, FILE *fs) {
     fprintf(fs, "Error");
     if (err->file && err->line) {
         // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-        fprintf(fs, "in %s:%lu", err->file, (unsigned long)err->line);
+        fprintf(fs, " in %s:%lu", err->file, (unsigned long)err->line);
     }
-    if (err->msg) {
+    if (err->msg[0]) {
         // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
         fprintf(fs, ": %s", err->msg);
     }
 
     // NOLINTNEXTLINE(clang-analyzer-security.insecureAPI.DeprecatedOrUnsafeBufferHandling)
-    fprintf(stderr, "\n");
+    fprintf(fs, "\n");
+}
+
+Err *err_pool_claim(void) {
+    uint64_t used = atomic_load_explicit(&err_pool_used, memory_order_relaxed);
+    while (~used) {
+        int slot = __builtin_ctzll(~used);
+        uint64_t claimed = used | ((uint64_t)1 << slot);
+        if (atomic_compare_exchange_weak_explicit(&err_pool_used, &used,
+                                                  claimed, memory_order_acquire,
+                                                  memory_order_relaxed)) {
+            return &err_pool[slot];
+        }
+    }
+    return NULL;
+}
+
+void err_pool_release(Err *err) {
+    if (err < err_pool || err >= err_pool + ERR_POOL_CAP) {
+        return;
+    }
+
+    size_t slot = (size_t)(err - err_pool);
+    atomic_fetch_and_explicit(&err_pool_used, ~((uint64_t)1 << slot),
+                              memory_order_release);
 }
@@ -4,10 +4,24 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#define ERR_MSG_CAP 160
+#define ERR_POOL_CAP 64
+
+typedef enum ErrCode {
+    ERR_OK = 0,
+    ERR_FAIL,
+    ERR_NOMEM,
+    ERR_RANGE,
+    ERR_IO
+} ErrCode;
+
+// Errors live in a fixed pool with inline storage so that reporting one never
+// allocates; when the pool is exhausted a shared out-of-slots error is returned
 typedef struct Err {
-    char *msg;
+    ErrCode code;
     int line;
-    char *file;
+    const char *file;
+    char msg[ERR_MSG_CAP];
 } Err;
 
 #define RESET_ERR(error)                                                       \
@@ -17,9 +31,13 @@ typedef struct Err {
     }
 
 #define ERR_MAKE(msg, ...)                                                     \
-    err_make(__FILE__, __LINE__, (msg)__VA_OPT__(, ) __VA_ARGS__)
+    err_make(ERR_FAIL, __FILE__, __LINE__, (msg)__VA_OPT__(, ) __VA_ARGS__)
+
+#define ERR_MAKE_CODE(code, msg, ...)                                          \
+    err_make((code), __FILE__, __LINE__, (msg)__VA_OPT__(, ) __VA_ARGS__)
 
-Err *err_make(const char *file, int line, const char *msg, ...);
+__attribute__((format(printf, 4, 5))) Err *
+err_make(ErrCode code, const char *file, int line, const char *msg, ...);
 void err_print(const Err *err, FILE *fs);
 void err_destroy(Err **err);
 
@@ -1,6 +1,7 @@
 #include "gap_buffer.h"
 #include "err.h"
 #include "helpers.h"
+#include "utf8.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
@@ -17,11 +18,12 @@ typedef struct GapBuff {
 
 size_t gb_getbuffi(GapBuff *gb, size_t i);
 void gb_mvgapaftercursor(GapBuff *gb);
-void gb_setup(Err **err, GapBuff *gb, const char *init_buff,
-              size_t init_buff_len, unsigned default_format);
+void gb_setup(Err **err, GapBuff **gap_buff, size_t init_buff_len,
+              unsigned default_format);
+void gb_format(FormattedChar *fc, uint32_t c, unsigned colour_pair);
 
-void gap_buff_init(Err **err, GapBuff **gap_buff, const char *seed_buff,
-                   size_t seed_buff_len, unsigned default_format) {
+void gap_buff_init(Err **err, GapBuff **gap_buff, size_t seed_buff_len,
+                   unsigned default_format) {
 
     // Buffer is reussed for each test, generous buffer size allocated to
     // minimise reallocations
@@ -31,34 +33,58 @@ void gap_buff_init(Err **err, GapBuff **gap_buff, const char *seed_buff,
 
     GapBuff *gb = ZALLOC(sizeof(*gb) + buff_size);
     if (!gb) {
-        *err = ERR_MAKE("Unable to allocate memory for gap_buff");
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for gap_buff");
         return;
     }
     gb->buff_len = initial_buff_len;
 
-    gb_setup(err, gb, seed_buff, seed_buff_len, default_format);
+    gb_setup(err, &gb, seed_buff_len, default_format);
     *gap_buff = gb;
 }
 
-void gap_buff_reset(Err **err, GapBuff *gb, const char *seed_buff,
-                    size_t seed_buff_len, unsigned default_format) {
-    gb_setup(err, gb, seed_buff, seed_buff_len, default_format);
+void gap_buff_reset(Err **err, GapBuff **gap_buff, size_t seed_buff_len,
+                    unsigned default_format) {
+    gb_setup(err, gap_buff, seed_buff_len, default_format);
 }
 
-void gb_setup(Err **err, GapBuff *gb, const char *init_buff,
-              size_t init_buff_len, unsigned default_format) {
+// Write a run of UTF-8 text in place from index i, keeping each char's
+// format. Returns the number of chars written.
+size_t gap_buff_seed(GapBuff *gb, size_t i, const char *s, size_t n) {
+    size_t k = 0;
+    size_t b = 0;
+    while (b < n) {
+        uint32_t c = (unsigned char)s[b];
+        size_t used = c < 0x80 ? 1 : utf8_decode(s + b, n - b, &c);
+        if (!used) {
+            break;
+        }
+        FormattedChar *fc = &gb->buff[gb_getbuffi(gb, i + k)];
+        gb_format(fc, c, fc->colour_pair);
+        b += used;
+        k++;
+    }
+    return k;
+}
+
+// Text starts as spaces in the default format, to be filled by
+// gap_buff_seed
+void gb_setup(Err **err, GapBuff **gap_buff, size_t init_buff_len,
+              unsigned default_format) {
+    GapBuff *gb = *gap_buff;
     size_t required_len = init_buff_len + min_gap_len;
     if (gb->buff_len < required_len) {
         gb->buff_len = required_len * 2;
         GapBuff *t =
             realloc(gb, sizeof(*t) + (gb->buff_len * sizeof(t->buff[0])));
         if (!t) {
-            *err = ERR_MAKE("Unable to reallocate gap buffer");
-            gap_buff_destroy(&gb);
+            *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to reallocate gap buffer");
+            gap_buff_destroy(gap_buff);
             return;
         } else {
             gb = t;
             t = NULL;
+            *gap_buff = gb;
         }
     }
 
@@ -68,9 +94,7 @@ void gb_setup(Err **err, GapBuff *gb, const char *init_buff,
     gb->gap_r = gb->buff_len - 1;
 
     for (size_t i = 0; i < init_buff_len; i++) {
-        FormattedChar c = {.value = init_buff[i],
-                           .colour_pair = default_format};
-        gb->buff[i] = c;
+        gb_format(&gb->buff[i], ' ', default_format);
     }
 }
 
@@ -81,31 +105,57 @@ size_t gap_buff_getlen(GapBuff *gb) {
 
 // Move cursor position in text
 void gap_buff_mvcursor(Err **err, GapBuff *gb, size_t i) {
+    if (gap_buff_trymvcursor(gb, i)) {
+        size_t str_len = gap_buff_getlen(gb);
+        *err = ERR_MAKE_CODE(ERR_RANGE, "index:%zu out of range:0-%zu", i,
+                             str_len - 1);
+    }
+}
+
+// Move cursor position in text, reporting failure by code only
+ErrCode gap_buff_trymvcursor(GapBuff *gb, size_t i) {
     size_t str_len = gap_buff_getlen(gb);
     if (i > str_len - 1) {
-        *err = ERR_MAKE("index:%lu out of range:0-%lu", i, str_len - 1);
-        return;
+        return ERR_RANGE;
     }
     gb->cursor_pos = i;
+    return ERR_OK;
 }
 
 // Overtype char
-bool gap_buff_replacechar(GapBuff *gb, const char *c, unsigned color_pair_id) {
+bool gap_buff_replacechar(GapBuff *gb, uint32_t c, unsigned color_pair_id) {
     size_t logical_cursor_pos = gb_getbuffi(gb, gb->cursor_pos);
-    gb->buff[logical_cursor_pos] =
-        (FormattedChar){.value = *c, .colour_pair = color_pair_id};
+    gb_format(&gb->buff[logical_cursor_pos], c, color_pair_id);
     return true;
 }
 
+// Overtype n chars from index i in one pass, the run before the gap and
+// the run after it each written straight through. The cursor is left alone.
+ErrCode gap_buff_replacerange(GapBuff *gb, size_t i, const uint32_t *cs,
+                              size_t n, unsigned color_pair_id) {
+    if (i + n > gap_buff_getlen(gb)) {
+        return ERR_RANGE;
+    }
+    size_t before = i < gb->gap_l ? MIN_N(n, gb->gap_l - i) : 0;
+    FormattedChar *fc = &gb->buff[i];
+    for (size_t k = 0; k < before; k++) {
+        gb_format(&fc[k], cs[k], color_pair_id);
+    }
+    fc = &gb->buff[gb_getbuffi(gb, i + before)];
+    for (size_t k = before; k < n; k++) {
+        gb_format(fc++, cs[k], color_pair_id);
+    }
+    return ERR_OK;
+}
+
 // Insert char
-bool gap_buff_insertchar(GapBuff *gb, const char *c, unsigned color_pair_id) {
+bool gap_buff_insertchar(GapBuff *gb, uint32_t c, unsigned color_pair_id) {
     size_t gap_len = gb->gap_r - gb->gap_l + 1;
     if (!gap_len) {
         return false;
     }
     gb_mvgapaftercursor(gb);
-    gb->buff[gb->gap_l++] =
-        (FormattedChar){.value = *c, .colour_pair = color_pair_id};
+    gb_format(&gb->buff[gb->gap_l++], c, color_pair_id);
     return true;
 }
 
@@ -161,3 +211,15 @@ void gb_mvgapaftercursor(GapBuff *gb) {
         }
     }
 }
+
+// Chars that cannot be displayed are stored as a one cell placeholder
+void gb_format(FormattedChar *fc, uint32_t c, unsigned colour_pair) {
+    uint8_t width = utf8_width(c);
+    if (!width) {
+        c = '?';
+        width = 1;
+    }
+    fc->value = c;
+    fc->width = width;
+    fc->colour_pair = colour_pair;
+}
@@ -2,27 +2,34 @@
 #define GAP_BUFFER_H
 
 #include "err.h"
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct GapBuff GapBuff;
+// A code point with its display width in cells, worked out once when the
+// char is stored so layout and rendering never measure it again
 typedef struct FormattedChar {
-    char value;
+    uint32_t value;
+    uint8_t width;
     unsigned colour_pair;
 } FormattedChar;
 
-void gap_buff_init(Err **err, GapBuff **gap_buff, const char *seed_buff,
-                   size_t seed_buff_len, unsigned defaultFormat);
+void gap_buff_init(Err **err, GapBuff **gap_buff, size_t seed_buff_len,
+                   unsigned defaultFormat);
 
-void gap_buff_reset(Err **err, GapBuff *gb, const char *seed_buff,
-                    size_t seed_buff_len, unsigned defaultFormat);
+void gap_buff_reset(Err **err, GapBuff **gap_buff, size_t seed_buff_len,
+                    unsigned defaultFormat);
+size_t gap_buff_seed(GapBuff *gap_buff, size_t i, const char *s, size_t n);
 void gap_buff_mvcursor(Err **err, GapBuff *gap_buff, size_t i);
+ErrCode gap_buff_trymvcursor(GapBuff *gap_buff, size_t i);
 const FormattedChar *gap_buff_nextchar(GapBuff *gb);
 const FormattedChar *gap_buff_getchar(GapBuff *gb, size_t i);
 
-bool gap_buff_replacechar(GapBuff *buffer, const char *c,
-                          unsigned color_pair_id);
-bool gap_buff_insertchar(GapBuff *buffer, const char *c,
-                         unsigned color_pair_id);
+bool gap_buff_replacechar(GapBuff *buffer, uint32_t c, unsigned color_pair_id);
+bool gap_buff_insertchar(GapBuff *buffer, uint32_t c, unsigned color_pair_id);
+ErrCode gap_buff_replacerange(GapBuff *buffer, size_t i, const uint32_t *cs,
+                              size_t n, unsigned color_pair_id);
 
 size_t gap_buff_getlen(GapBuff *buffer);
 
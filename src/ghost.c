@@ -0,0 +1,238 @@
+#include "ghost.h"
+#include "data_dir.h"
+#include "err.h"
+#include "helpers.h"
+#include "key_log.h"
+#include "word_store.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cursor position after each keystroke of a round and the ms since its first
+// keystroke, in time order
+typedef struct GhostTrack {
+    uint32_t *times_ms;
+    uint32_t *cursors;
+    size_t len;
+    size_t cap;
+} GhostTrack;
+
+// The fastest complete round recorded on a dictionary. Frames only move
+// forward in time, so the position is followed with a forward cursor over
+// the track and each frame steps past just the keystrokes since the last.
+struct Ghost {
+    char path[DATA_PATH_CAP];
+    bool checked;
+    bool loaded;
+    uint32_t dict_hash;
+    double wpm;
+    uint32_t *words;
+    size_t word_count;
+    size_t words_cap;
+    GhostTrack best;
+    GhostTrack scratch;
+    size_t pos;
+    uint64_t last_ms;
+};
+
+bool gh_track_read(Err **err, KeyLogReader *r, GhostTrack *t);
+bool gh_track_push(GhostTrack *t, uint32_t time_ms, uint32_t cursor);
+bool gh_keep_words(Ghost *g, const uint32_t *ids, size_t count);
+void gh_track_free(GhostTrack *t);
+
+void ghost_init(Err **err, Ghost **ghost, const char *key_log_path) {
+    Ghost *g = ZALLOC(sizeof(*g));
+    if (!g) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate memory for ghost");
+        return;
+    }
+
+    if (key_log_path) {
+        string_copy(g->path, sizeof(g->path), key_log_path,
+                    strlen(key_log_path));
+    } else {
+        data_dir_path(err, g->path, sizeof(g->path), "keys.bin");
+        if (*err) {
+            ghost_destroy(&g);
+            return;
+        }
+    }
+
+    *ghost = g;
+}
+
+// Pick the fastest round typed to the end on ws's dictionary from the key
+// log, false if there is none. Damaged rounds are skipped.
+bool ghost_load(Err **err, Ghost *g, const WordStore *ws) {
+    g->checked = true;
+    g->loaded = false;
+    g->dict_hash = ws->dict_hash;
+    g->wpm = 0.;
+    ghost_rewind(g);
+
+    KeyLogReader *r = NULL;
+    key_log_reader_init(err, &r, g->path);
+    if (*err) {
+        return false;
+    }
+
+    KeyLogRound round;
+    while (key_log_reader_nextround(err, r, &round)) {
+        if (!round.word_ids || round.dict_hash != ws->dict_hash) {
+            continue;
+        }
+        size_t len = 0;
+        bool valid = round.word_count > 0;
+        for (size_t i = 0; valid && i < round.word_count; i++) {
+            valid = round.word_ids[i] < ws->word_count;
+            len += valid ? ws->word_chars[round.word_ids[i]] + 1 : 0;
+        }
+        if (!valid || len < 2) {
+            continue;
+        }
+        len--;
+
+        if (!gh_track_read(err, r, &g->scratch)) {
+            if (*err && (*err)->code == ERR_NOMEM) {
+                break;
+            }
+            RESET_ERR(*err);
+            continue;
+        }
+        GhostTrack *t = &g->scratch;
+        if (!t->len || t->cursors[t->len - 1] != len ||
+            !t->times_ms[t->len - 1]) {
+            continue;
+        }
+
+        double wpm = ((double)len / 5.) / (t->times_ms[t->len - 1] / 60000.);
+        if (wpm <= g->wpm) {
+            continue;
+        }
+        if (!gh_keep_words(g, round.word_ids, round.word_count)) {
+            *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate ghost words");
+            break;
+        }
+        // The old best becomes the scratch track, keeping its memory
+        GhostTrack kept = g->best;
+        g->best = g->scratch;
+        g->scratch = kept;
+        g->wpm = wpm;
+        g->loaded = true;
+    }
+    key_log_reader_destroy(&r);
+    return !*err && g->loaded;
+}
+
+// Whether the ghost was last looked up for this dictionary
+bool ghost_matches(const Ghost *g, uint32_t dict_hash) {
+    return g->checked && g->dict_hash == dict_hash;
+}
+
+double ghost_wpm(const Ghost *g) { return g->loaded ? g->wpm : 0.; }
+
+const uint32_t *ghost_words(const Ghost *g, size_t *word_count) {
+    *word_count = g->loaded ? g->word_count : 0;
+    return g->loaded ? g->words : NULL;
+}
+
+void ghost_rewind(Ghost *g) {
+    g->pos = 0;
+    g->last_ms = 0;
+}
+
+// Ghost cursor elapsed_ms after both started typing. A step back in time
+// binary searches rather than rewinding the forward cursor.
+size_t ghost_cursor(Ghost *g, uint64_t elapsed_ms) {
+    const GhostTrack *t = &g->best;
+    if (elapsed_ms < g->last_ms) {
+        size_t lo = 0;
+        size_t hi = t->len;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (t->times_ms[mid] <= elapsed_ms) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        g->pos = lo;
+    }
+    while (g->pos < t->len && t->times_ms[g->pos] <= elapsed_ms) {
+        g->pos++;
+    }
+    g->last_ms = elapsed_ms;
+    return g->pos ? t->cursors[g->pos - 1] : 0;
+}
+
+void ghost_destroy(Ghost **ghost) {
+    if (!ghost || !*ghost) {
+        return;
+    }
+    Ghost *g = *ghost;
+    gh_track_free(&g->best);
+    gh_track_free(&g->scratch);
+    free(g->words);
+    free(g);
+    *ghost = NULL;
+}
+
+// Replay the current round's events into t, false if they are damaged
+bool gh_track_read(Err **err, KeyLogReader *r, GhostTrack *t) {
+    t->len = 0;
+    uint64_t time_ms = 0;
+    KeyEvent e;
+    while (key_log_reader_nextevent(err, r, &e)) {
+        time_ms += e.dt_ms;
+        uint32_t cursor = e.key == KEY_LOG_BACKSPACE ? e.index : e.index + 1;
+        if (!gh_track_push(t, (uint32_t)MIN_N(time_ms, (uint64_t)UINT32_MAX),
+                           cursor)) {
+            *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate ghost track");
+            return false;
+        }
+    }
+    return !*err;
+}
+
+bool gh_track_push(GhostTrack *t, uint32_t time_ms, uint32_t cursor) {
+    if (t->len == t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 256;
+        uint32_t *times = realloc(t->times_ms, cap * sizeof(*times));
+        if (!times) {
+            return false;
+        }
+        t->times_ms = times;
+        uint32_t *cursors = realloc(t->cursors, cap * sizeof(*cursors));
+        if (!cursors) {
+            return false;
+        }
+        t->cursors = cursors;
+        t->cap = cap;
+    }
+    t->times_ms[t->len] = time_ms;
+    t->cursors[t->len] = cursor;
+    t->len++;
+    return true;
+}
+
+bool gh_keep_words(Ghost *g, const uint32_t *ids, size_t count) {
+    if (count > g->words_cap) {
+        uint32_t *words = realloc(g->words, count * sizeof(*words));
+        if (!words) {
+            return false;
+        }
+        g->words = words;
+        g->words_cap = count;
+    }
+    memcpy(g->words, ids, count * sizeof(*ids));
+    g->word_count = count;
+    return true;
+}
+
+void gh_track_free(GhostTrack *t) {
+    free(t->times_ms);
+    free(t->cursors);
+    *t = (GhostTrack){0};
+}
@@ -0,0 +1,21 @@
+#ifndef GHOST_H
+#define GHOST_H
+
+#include "err.h"
+#include "word_store.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct Ghost Ghost;
+
+void ghost_init(Err **err, Ghost **ghost, const char *key_log_path);
+bool ghost_load(Err **err, Ghost *ghost, const WordStore *ws);
+bool ghost_matches(const Ghost *ghost, uint32_t dict_hash);
+double ghost_wpm(const Ghost *ghost);
+const uint32_t *ghost_words(const Ghost *ghost, size_t *word_count);
+void ghost_rewind(Ghost *ghost);
+size_t ghost_cursor(Ghost *ghost, uint64_t elapsed_ms);
+void ghost_destroy(Ghost **ghost);
+
+#endif
@@ -0,0 +1,267 @@
+#include "heatmap_view.h"
+#include "constants.h"
+#include "helpers.h"
+#include "key_heatmap.h"
+#include <ncurses.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HV_HEIGHT 31
+#define HV_WIDTH 92
+#define HV_GRID_WIDTH 56
+#define HV_LIST_LEN 8
+#define HV_MIN_SAMPLES 5
+
+struct HeatmapView {
+    WINDOW *win;
+    int height;
+    int width;
+};
+
+typedef struct HVRank {
+    unsigned char a;
+    unsigned char b;
+    double score;
+    uint32_t samples;
+} HVRank;
+
+void hv_render(HeatmapView *view, const KeyHeatmap *heatmap);
+void hv_render_grid(HeatmapView *view, const KeyHeatmap *heatmap,
+                    double mean_latency);
+int hv_render_list(HeatmapView *view, int y, int x, const char *title,
+                   const HVRank *ranks, size_t len, const char *unit);
+void hv_rank_push(HVRank *ranks, size_t *len, HVRank r);
+char hv_printable(unsigned char c);
+
+void heatmap_view_init(Err **err, HeatmapView **view) {
+    HeatmapView *v = ZALLOC(sizeof(*v));
+    if (!v) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for heatmap view");
+        return;
+    }
+
+    v->height = MIN_N(HV_HEIGHT, LINES);
+    v->width = MIN_N(HV_WIDTH, COLS);
+    int x = (COLS - v->width) / 2;
+    int y = (LINES - v->height) / 2;
+    v->win = newwin(v->height, v->width, y, x);
+    if (!v->win) {
+        *err = ERR_MAKE("Unable to initialise ncurses window");
+        heatmap_view_destroy(&v);
+        return;
+    }
+
+    *view = v;
+}
+
+void heatmap_view_run(Err **err, JankeyState *state, HeatmapView *view,
+                      const KeyHeatmap *heatmap) {
+    if (*err) {
+        return;
+    }
+
+    clear();
+    refresh();
+    hv_render(view, heatmap);
+
+    while (true) {
+        int ui = getch();
+        if (ui < 0) {
+            continue;
+        }
+        char c = (char)ui;
+        switch (c) {
+        case 'b':
+        case 'B':
+            *state = JANKEY_STATE_DISPLAYING_POST_TEST_MODAL;
+            break;
+        case 'n':
+        case 'N':
+            *state = JANKEY_STATE_RUNNING_TEST;
+            break;
+        case 'q':
+        case 'Q':
+            *state = JANKEY_STATE_QUITTING;
+            break;
+        default:
+            continue;
+        }
+        break;
+    }
+
+    werase(view->win);
+    wrefresh(view->win);
+    clear();
+    refresh();
+}
+
+void heatmap_view_destroy(HeatmapView **view) {
+    if (!view || !*view) {
+        return;
+    }
+    HeatmapView *v = *view;
+    if (v->win) {
+        delwin(v->win);
+        v->win = NULL;
+    }
+
+    free(v);
+    v = NULL;
+    *view = NULL;
+}
+
+void hv_render(HeatmapView *v, const KeyHeatmap *hm) {
+    curs_set(0);
+    werase(v->win);
+    box(v->win, 0, 0);
+
+    // Rank printable bigrams by latency and error rate, and keys by confusion
+    HVRank slow[HV_LIST_LEN];
+    HVRank missed[HV_LIST_LEN];
+    HVRank confused[HV_LIST_LEN];
+    size_t slow_len = 0;
+    size_t missed_len = 0;
+    size_t confused_len = 0;
+    uint64_t latency_sum = 0;
+    uint64_t timed = 0;
+
+    for (unsigned char a = ' '; a < HEATMAP_KEYS - 1; a++) {
+        for (unsigned char b = ' '; b < HEATMAP_KEYS - 1; b++) {
+            uint32_t n = hm->bigram_count[a][b];
+            uint32_t t = hm->bigram_timed[a][b];
+            latency_sum += hm->bigram_latency_ms[a][b];
+            timed += t;
+
+            if (t >= HV_MIN_SAMPLES) {
+                double ms = (double)hm->bigram_latency_ms[a][b] / (double)t;
+                hv_rank_push(slow, &slow_len, (HVRank){a, b, ms, t});
+            }
+            if (n >= HV_MIN_SAMPLES && hm->bigram_errors[a][b]) {
+                double rate = 100. * hm->bigram_errors[a][b] / (double)n;
+                hv_rank_push(missed, &missed_len, (HVRank){a, b, rate, n});
+            }
+            if (a != b && hm->confusion[a][b]) {
+                double k = (double)hm->confusion[a][b];
+                hv_rank_push(confused, &confused_len,
+                             (HVRank){a, b, k, hm->confusion[a][b]});
+            }
+        }
+    }
+    double mean_latency = timed ? (double)latency_sum / (double)timed : 0.;
+
+    int list_x = 2;
+    if (v->height >= HV_HEIGHT && v->width >= HV_GRID_WIDTH) {
+        hv_render_grid(v, hm, mean_latency);
+        list_x = HV_GRID_WIDTH + 2;
+    }
+
+    if (v->width - list_x >= 24) {
+        int y = 2;
+        y = hv_render_list(v, y, list_x, "SLOWEST BIGRAMS", slow, slow_len,
+                           " ms");
+        y = hv_render_list(v, y + 1, list_x, "MOST MISSED BIGRAMS", missed,
+                           missed_len, "%");
+        hv_render_list(v, y + 1, list_x, "CONFUSED KEYS (WANTED, GOT)",
+                       confused, confused_len, "x");
+    }
+
+    const char *instructions = " [B]ack    [N]ew    [Q]uit ";
+    wmove(v->win, v->height - 1,
+          MAX_N(0, (v->width - (int)strlen(instructions)) / 2));
+    waddstr(v->win, instructions);
+
+    wrefresh(v->win);
+}
+
+// Letter grid, rows are the first key and columns the next. Glyph shows
+// latency relative to the mean, colour shows error rate.
+void hv_render_grid(HeatmapView *v, const KeyHeatmap *hm,
+                    double mean_latency) {
+    wmove(v->win, 1, 2);
+    waddstr(v->win, "  ");
+    for (char b = 'a'; b <= 'z'; b++) {
+        waddch(v->win, (chtype)b);
+        waddch(v->win, ' ');
+    }
+
+    for (char a = 'a'; a <= 'z'; a++) {
+        wmove(v->win, 2 + (a - 'a'), 2);
+        waddch(v->win, (chtype)a);
+        waddch(v->win, ' ');
+        for (char b = 'a'; b <= 'z'; b++) {
+            uint32_t n = hm->bigram_count[(size_t)a][(size_t)b];
+            uint32_t t = hm->bigram_timed[(size_t)a][(size_t)b];
+            uint32_t e = hm->bigram_errors[(size_t)a][(size_t)b];
+
+            char glyph = n ? '?' : ' ';
+            if (t && mean_latency > 0.) {
+                double ratio =
+                    (double)hm->bigram_latency_ms[(size_t)a][(size_t)b] /
+                    (double)t / mean_latency;
+                if (ratio < 0.8) {
+                    glyph = '.';
+                } else if (ratio < 1.1) {
+                    glyph = ':';
+                } else if (ratio < 1.5) {
+                    glyph = '*';
+                } else {
+                    glyph = '#';
+                }
+            }
+
+            double rate = n ? (double)e / (double)n : 0.;
+            int pair = COLOR_PAIR_RED;
+            if (rate < 0.03) {
+                pair = COLOR_PAIR_GREEN;
+            } else if (rate < 0.10) {
+                pair = COLOR_PAIR_YELLOW;
+            }
+            wattron(v->win, COLOR_PAIR(pair));
+            waddch(v->win, (chtype)glyph);
+            wattroff(v->win, COLOR_PAIR(pair));
+            waddch(v->win, ' ');
+        }
+    }
+
+    wmove(v->win, 29, 2);
+    waddstr(v->win, ". fast  : avg  * slow  # slowest   colour: errors");
+}
+
+int hv_render_list(HeatmapView *v, int y, int x, const char *title,
+                   const HVRank *ranks, size_t len, const char *unit) {
+    wmove(v->win, y++, x);
+    waddstr(v->win, title);
+    if (!len) {
+        wmove(v->win, y++, x);
+        waddstr(v->win, "  not enough data");
+    }
+    for (size_t i = 0; i < len && y < v->height - 1; i++) {
+        wmove(v->win, y++, x);
+        wprintw(v->win, "  %c%c %6.0lf%-3s (%u)", hv_printable(ranks[i].a),
+                hv_printable(ranks[i].b), ranks[i].score, unit,
+                (unsigned)ranks[i].samples);
+    }
+    return y;
+}
+
+// Keep the highest scores, sorted descending
+void hv_rank_push(HVRank *ranks, size_t *len, HVRank r) {
+    size_t n = *len;
+    if (n == HV_LIST_LEN && r.score <= ranks[n - 1].score) {
+        return;
+    }
+    if (n < HV_LIST_LEN) {
+        n++;
+    }
+
+    size_t i = n - 1;
+    while (i > 0 && ranks[i - 1].score < r.score) {
+        ranks[i] = ranks[i - 1];
+        i--;
+    }
+    ranks[i] = r;
+    *len = n;
+}
+
+char hv_printable(unsigned char c) { return c == ' ' ? '_' : (char)c; }
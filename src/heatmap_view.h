@@ -0,0 +1,15 @@
+#ifndef HEATMAP_VIEW_H
+#define HEATMAP_VIEW_H
+
+#include "constants.h"
+#include "err.h"
+#include "key_heatmap.h"
+
+typedef struct HeatmapView HeatmapView;
+
+void heatmap_view_init(Err **err, HeatmapView **view);
+void heatmap_view_run(Err **err, JankeyState *state, HeatmapView *view,
+                      const KeyHeatmap *heatmap);
+void heatmap_view_destroy(HeatmapView **view);
+
+#endif
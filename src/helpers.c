@@ -13,3 +13,17 @@ size_t string_copy(char *tgt, size_t tgt_size, const char *src,
     }
     return i;
 }
+
+uint32_t hash_fnv1a(const void *data, size_t len) {
+    return hash_fnv1a_extend(FNV1A_BASIS, data, len);
+}
+
+// Continue a hash over more data, as if the inputs were concatenated
+uint32_t hash_fnv1a_extend(uint32_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
@@ -1,13 +1,17 @@
 #ifndef HELPERS_H
 #define HELPERS_H
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #define MAX_N(a, b) ((a) > (b) ? (a) : (b))
 #define MIN_N(a, b) ((a) > (b) ? (b) : (a))
 #define ZALLOC(size) (calloc((size_t)1, (size)))
+#define FNV1A_BASIS 2166136261u
 
 size_t string_copy(char *tgt, size_t tgt_size, const char *src,
                    size_t src_size);
+uint32_t hash_fnv1a(const void *data, size_t len);
+uint32_t hash_fnv1a_extend(uint32_t h, const void *data, size_t len);
 
 #endif
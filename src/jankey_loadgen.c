@@ -0,0 +1,633 @@
+// getopt, clock_nanosleep
+#define _POSIX_C_SOURCE 200809L
+#include "arena.h"
+#include "constants.h"
+#include "err.h"
+#include "helpers.h"
+#include "key_log.h"
+#include "rng.h"
+#include "string_pool.h"
+#include "typing_engine.h"
+#include "word_store.h"
+#include <math.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+// Drives many headless typing engines from synthetic typists to measure the
+// engine under load. Each worker thread owns its sessions outright, so the
+// only sharing between threads is the read-only dictionary and anything the
+// engine itself shares, which is what the per-thread scaling exposes.
+
+#define LG_DEFAULT_DICT "dict/en_gb.txt"
+#define LG_MAX_THREADS 256
+#define LG_NONE SIZE_MAX
+
+// Latencies go in log-linear buckets, 32 per power of two, so percentiles
+// are within about 3% without keeping every sample
+#define LG_SUB_BITS 5
+#define LG_SUB (1u << LG_SUB_BITS)
+#define LG_BUCKETS ((64 - LG_SUB_BITS + 1) * LG_SUB)
+
+typedef struct LGConfig {
+    const char *dict_path;
+    size_t threads;
+    size_t sessions;
+    double wpm;
+    double error_rate;
+    double backspace_rate;
+    double seconds;
+    bool flat_out;
+    bool sweep;
+    bool key_log;
+} LGConfig;
+
+typedef struct LGHist {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[LG_BUCKETS];
+} LGHist;
+
+// A typist: inter-key gaps are log-normal around the target speed, slower
+// at word boundaries and after noticing a mistake. Errors are corrected
+// with backspace, after up to two more keys, at the backspace rate.
+typedef struct LGSession {
+    TypingEngine *engine;
+    Arena *arena;
+    KeyLog *key_log;
+    TestText text;
+    size_t cursor;
+    Rng rng;
+    uint64_t due_ns;
+    size_t error_at;
+    unsigned notice_in;
+    bool fixing;
+} LGSession;
+
+typedef struct LGRun LGRun;
+
+// Padded to a cache line so counters of different workers never share one
+typedef struct LGWorker {
+    alignas(64) LGRun *run;
+    size_t index;
+    LGSession *sessions;
+    size_t session_count;
+    size_t *heap;
+    Rng rng;
+    uint64_t keys;
+    uint64_t rounds;
+    LGHist service;
+    LGHist lag;
+    Err *err;
+} LGWorker;
+
+struct LGRun {
+    const LGConfig *cfg;
+    WordStore *ws;
+    LGWorker *workers;
+    size_t worker_count;
+    atomic_bool go;
+    atomic_bool stop;
+    atomic_size_t ready;
+};
+
+typedef struct LGResult {
+    size_t threads;
+    double seconds;
+    uint64_t keys;
+    uint64_t rounds;
+    LGHist service;
+    LGHist lag;
+    double thread_rates[LG_MAX_THREADS];
+    uint64_t thread_p99[LG_MAX_THREADS];
+} LGResult;
+
+int lg_parse(LGConfig *cfg, int argc, char *argv[]);
+int lg_usage(const char *prog);
+void lg_run(Err **err, const LGConfig *cfg, WordStore *ws,
+            size_t threads, LGResult *result);
+int lg_worker_main(void *arg);
+void lg_worker_setup(Err **err, LGWorker *w);
+void lg_worker_teardown(LGWorker *w);
+void lg_worker_paced(LGWorker *w);
+void lg_worker_flat(LGWorker *w);
+void lg_step(Err **err, LGWorker *w, LGSession *s);
+void lg_round(Err **err, LGWorker *w, LGSession *s);
+uint64_t lg_gap_ns(const LGConfig *cfg, LGSession *s, uint32_t next);
+void lg_heap_push(LGWorker *w, size_t *len, size_t session);
+void lg_heap_fix(LGWorker *w, size_t len);
+void lg_hist_add(LGHist *h, uint64_t v);
+void lg_hist_merge(LGHist *tgt, const LGHist *src);
+uint64_t lg_hist_pct(const LGHist *h, double pct);
+void lg_print_hist(const char *name, const LGHist *h);
+uint64_t lg_now_ns(void);
+double lg_normal(Rng *rng);
+
+int main(int argc, char *argv[]) {
+    LGConfig cfg = {
+        .dict_path = LG_DEFAULT_DICT,
+        .sessions = 64,
+        .wpm = 80.,
+        .error_rate = 0.05,
+        .backspace_rate = 0.8,
+        .seconds = 5.,
+        .key_log = true,
+    };
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    cfg.threads = cores > 0 ? (size_t)cores : 1;
+    if (lg_parse(&cfg, argc, argv)) {
+        return lg_usage(argv[0]);
+    }
+
+    Err *err = NULL;
+    StringPool *strings = NULL;
+    WordStore *ws = NULL;
+    string_pool_init(&err, &strings);
+    if (!err) {
+        word_store_init(&err, &ws, cfg.dict_path, strings);
+    }
+
+    printf("%zu sessions per thread, %.0f wpm, %.1f%% errors, %.0f%% "
+           "corrected, %s\n",
+           cfg.sessions, cfg.wpm, cfg.error_rate * 100.,
+           cfg.backspace_rate * 100., cfg.flat_out ? "flat out" : "paced");
+    printf("%8s %10s %12s %12s %8s %10s %10s %10s\n", "threads", "rounds",
+           "keys/s", "keys/s/thr", "speedup", "p50 ns", "p99 ns",
+           "p99.9 ns");
+
+    // Each run overwrites the result, leaving the full thread count's
+    LGResult *r = ZALLOC(sizeof(*r));
+    if (!r && !err) {
+        err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate run result");
+    }
+    double base_rate = 0.;
+    for (size_t n = cfg.sweep ? 1 : cfg.threads; !err;
+         n = n * 2 > cfg.threads ? cfg.threads : n * 2) {
+        lg_run(&err, &cfg, ws, n, r);
+        if (err) {
+            break;
+        }
+        double rate = (double)r->keys / r->seconds;
+        base_rate = base_rate > 0. ? base_rate : rate / (double)n;
+        printf("%8zu %10llu %12.0f %12.0f %8.2f %10llu %10llu %10llu\n", n,
+               (unsigned long long)r->rounds, rate, rate / (double)n,
+               rate / base_rate,
+               (unsigned long long)lg_hist_pct(&r->service, 50.),
+               (unsigned long long)lg_hist_pct(&r->service, 99.),
+               (unsigned long long)lg_hist_pct(&r->service, 99.9));
+        if (n == cfg.threads) {
+            break;
+        }
+    }
+    if (!err) {
+        for (size_t i = 0; i < r->threads; i++) {
+            printf("  thread %3zu %12.0f keys/s  p99 %llu ns\n", i,
+                   r->thread_rates[i], (unsigned long long)r->thread_p99[i]);
+        }
+        lg_print_hist("key latency", &r->service);
+        if (!cfg.flat_out) {
+            lg_print_hist("schedule lag", &r->lag);
+        }
+    }
+
+    free(r);
+    word_store_destroy(&ws);
+    string_pool_destroy(&strings);
+    if (err) {
+        err_print(err, stderr);
+        err_destroy(&err);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int lg_parse(LGConfig *cfg, int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "d:t:s:w:e:b:T:fSn")) != -1) {
+        switch (opt) {
+        case 'd':
+            cfg->dict_path = optarg;
+            break;
+        case 't':
+            cfg->threads = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            cfg->sessions = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            cfg->wpm = strtod(optarg, NULL);
+            break;
+        case 'e':
+            cfg->error_rate = strtod(optarg, NULL);
+            break;
+        case 'b':
+            cfg->backspace_rate = strtod(optarg, NULL);
+            break;
+        case 'T':
+            cfg->seconds = strtod(optarg, NULL);
+            break;
+        case 'f':
+            cfg->flat_out = true;
+            break;
+        case 'S':
+            cfg->sweep = true;
+            break;
+        case 'n':
+            cfg->key_log = false;
+            break;
+        default:
+            return 1;
+        }
+    }
+    if (optind != argc || !cfg->threads || cfg->threads > LG_MAX_THREADS ||
+        !cfg->sessions || cfg->wpm <= 0. || cfg->seconds <= 0. ||
+        cfg->error_rate < 0. || cfg->error_rate > 1. ||
+        cfg->backspace_rate < 0. || cfg->backspace_rate > 1.) {
+        return 1;
+    }
+    return 0;
+}
+
+int lg_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "  -d PATH   Dictionary (%s)\n", LG_DEFAULT_DICT);
+    fprintf(stderr, "  -t N      Worker threads (online cores)\n");
+    fprintf(stderr, "  -s N      Sessions per thread (64)\n");
+    fprintf(stderr, "  -w WPM    Typist speed (80)\n");
+    fprintf(stderr, "  -e RATE   Share of keys typed wrong (0.05)\n");
+    fprintf(stderr, "  -b RATE   Share of errors backspaced (0.8)\n");
+    fprintf(stderr, "  -T SECS   Seconds per run (5)\n");
+    fprintf(stderr, "  -f        Flat out, ignore typist timing\n");
+    fprintf(stderr, "  -S        Sweep 1, 2, 4 .. N threads\n");
+    fprintf(stderr, "  -n        Skip key log encoding\n");
+    return EXIT_FAILURE;
+}
+
+// One timed run with the given thread count. Sessions are set up before the
+// clock starts and torn down after it stops.
+void lg_run(Err **err, const LGConfig *cfg, WordStore *ws,
+            size_t threads, LGResult *result) {
+    LGRun run = {.cfg = cfg, .ws = ws, .worker_count = threads};
+    atomic_init(&run.go, false);
+    atomic_init(&run.stop, false);
+    atomic_init(&run.ready, 0);
+
+    run.workers = aligned_alloc(64, threads * sizeof(*run.workers));
+    thrd_t *handles = calloc(threads, sizeof(*handles));
+    if (!run.workers || !handles) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate workers");
+        free(run.workers);
+        free(handles);
+        return;
+    }
+    memset(run.workers, 0, threads * sizeof(*run.workers));
+
+    uint64_t seed = lg_now_ns();
+    size_t started = 0;
+    for (; started < threads; started++) {
+        LGWorker *w = &run.workers[started];
+        w->run = &run;
+        w->index = started;
+        rng_seed(&w->rng, seed + started);
+        if (thrd_create(&handles[started], lg_worker_main, w) !=
+            thrd_success) {
+            *err = ERR_MAKE("Unable to start worker thread %zu", started);
+            break;
+        }
+    }
+    while (atomic_load(&run.ready) < started) {
+        thrd_yield();
+    }
+
+    uint64_t start = lg_now_ns();
+    atomic_store(&run.go, true);
+    if (!*err) {
+        struct timespec t = {
+            .tv_sec = (time_t)cfg->seconds,
+            .tv_nsec = (long)((cfg->seconds - floor(cfg->seconds)) * 1e9),
+        };
+        nanosleep(&t, NULL);
+    }
+    atomic_store(&run.stop, true);
+    uint64_t end = lg_now_ns();
+
+    *result = (LGResult){.threads = threads};
+    result->seconds = (double)(end - start) / 1e9;
+    for (size_t i = 0; i < started; i++) {
+        thrd_join(handles[i], NULL);
+        LGWorker *w = &run.workers[i];
+        if (w->err && !*err) {
+            *err = w->err;
+            w->err = NULL;
+        }
+        RESET_ERR(w->err);
+        result->keys += w->keys;
+        result->rounds += w->rounds;
+        lg_hist_merge(&result->service, &w->service);
+        lg_hist_merge(&result->lag, &w->lag);
+        result->thread_rates[i] = (double)w->keys / result->seconds;
+        result->thread_p99[i] = lg_hist_pct(&w->service, 99.);
+    }
+
+    free(run.workers);
+    free(handles);
+}
+
+int lg_worker_main(void *arg) {
+    LGWorker *w = arg;
+    LGRun *run = w->run;
+    lg_worker_setup(&w->err, w);
+    atomic_fetch_add(&run->ready, 1);
+    while (!atomic_load(&run->go)) {
+        thrd_yield();
+    }
+
+    if (!w->err) {
+        if (run->cfg->flat_out) {
+            lg_worker_flat(w);
+        } else {
+            lg_worker_paced(w);
+        }
+    }
+    lg_worker_teardown(w);
+    return 0;
+}
+
+void lg_worker_setup(Err **err, LGWorker *w) {
+    const LGConfig *cfg = w->run->cfg;
+    w->session_count = cfg->sessions;
+    w->sessions = calloc(cfg->sessions, sizeof(*w->sessions));
+    w->heap = calloc(cfg->sessions, sizeof(*w->heap));
+    if (!w->sessions || !w->heap) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate sessions");
+        return;
+    }
+
+    for (size_t i = 0; i < cfg->sessions && !*err; i++) {
+        LGSession *s = &w->sessions[i];
+        rng_seed(&s->rng, rng_next(&w->rng));
+        typing_engine_init(err, &s->engine);
+        arena_init(err, &s->arena, ROUND_ARENA_CAP);
+        if (cfg->key_log) {
+            key_log_init(err, &s->key_log, "/dev/null");
+        }
+        lg_round(err, w, s);
+    }
+}
+
+void lg_worker_teardown(LGWorker *w) {
+    for (size_t i = 0; w->sessions && i < w->session_count; i++) {
+        LGSession *s = &w->sessions[i];
+        typing_engine_destroy(&s->engine);
+        arena_destroy(&s->arena);
+        key_log_destroy(&s->key_log);
+    }
+    free(w->sessions);
+    free(w->heap);
+    w->sessions = NULL;
+    w->heap = NULL;
+}
+
+// Keys go in when each typist's next one is due, sleeping until the
+// earliest. Lag is how late a key was handled, which grows once the thread
+// cannot keep up with its typists.
+void lg_worker_paced(LGWorker *w) {
+    // Typists start spread over their first gap rather than in step
+    const LGConfig *cfg = w->run->cfg;
+    uint64_t start = lg_now_ns();
+    size_t len = 0;
+    for (size_t i = 0; i < w->session_count; i++) {
+        LGSession *s = &w->sessions[i];
+        s->due_ns = start + (uint64_t)(rng_unit(&s->rng) * 12e9 / cfg->wpm);
+        lg_heap_push(w, &len, i);
+    }
+
+    while (!atomic_load_explicit(&w->run->stop, memory_order_relaxed)) {
+        LGSession *s = &w->sessions[w->heap[0]];
+        uint64_t now = lg_now_ns();
+        if (s->due_ns > now) {
+            struct timespec t = {
+                .tv_sec = (time_t)(s->due_ns / 1000000000u),
+                .tv_nsec = (long)(s->due_ns % 1000000000u),
+            };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+            continue;
+        }
+        lg_hist_add(&w->lag, now - s->due_ns);
+        lg_step(&w->err, w, s);
+        if (w->err) {
+            return;
+        }
+        lg_heap_fix(w, len);
+    }
+}
+
+// Keys go in back to back, round robin over the sessions
+void lg_worker_flat(LGWorker *w) {
+    while (!atomic_load_explicit(&w->run->stop, memory_order_relaxed)) {
+        for (size_t i = 0; i < w->session_count; i++) {
+            lg_step(&w->err, w, &w->sessions[i]);
+            if (w->err) {
+                return;
+            }
+        }
+    }
+}
+
+// Send a session's next key and schedule the one after
+void lg_step(Err **err, LGWorker *w, LGSession *s) {
+    const LGConfig *cfg = w->run->cfg;
+    if (s->error_at != LG_NONE && !s->fixing && !s->notice_in) {
+        s->fixing = true;
+    }
+
+    // Wrong keys are other lowercase letters, as an 'X' would insert
+    int key = KEY_LOG_BACKSPACE;
+    uint32_t expected = typing_engine_charat(s->engine, s->cursor);
+    if (!s->fixing) {
+        key = (int)expected;
+        if (rng_unit(&s->rng) < cfg->error_rate) {
+            uint32_t wrong = 'a' + (uint32_t)(rng_next(&s->rng) % 25);
+            key = (int)(wrong >= expected ? wrong + 1 : wrong);
+            if (s->error_at == LG_NONE &&
+                rng_unit(&s->rng) < cfg->backspace_rate) {
+                s->error_at = s->cursor;
+                s->notice_in = (unsigned)(rng_next(&s->rng) % 3);
+            }
+        } else if (s->error_at != LG_NONE) {
+            s->notice_in--;
+        }
+    }
+
+    EngineKey k;
+    uint64_t t0 = lg_now_ns();
+    typing_engine_key(s->engine, key, &k);
+    lg_hist_add(&w->service, lg_now_ns() - t0);
+    w->keys++;
+    s->cursor = k.cursor;
+
+    bool pause = false;
+    if (s->fixing && s->cursor <= s->error_at) {
+        s->fixing = false;
+        s->error_at = LG_NONE;
+    } else if (!s->fixing && s->error_at != LG_NONE && !s->notice_in) {
+        // The typist stops short on noticing the mistake
+        pause = true;
+    }
+
+    // The cursor stays put on the last char, ending the round
+    if (!k.backspace && k.cursor == k.index) {
+        if (s->key_log) {
+            key_log_commit(err, s->key_log, (int64_t)time(NULL), 0);
+        }
+        w->rounds++;
+        lg_round(err, w, s);
+    }
+
+    if (!cfg->flat_out) {
+        uint32_t next = typing_engine_charat(s->engine, s->cursor);
+        uint64_t gap = lg_gap_ns(cfg, s, next);
+        s->due_ns += pause ? gap * 3 : gap;
+    }
+}
+
+// Start a session's next round on a fresh text
+void lg_round(Err **err, LGWorker *w, LGSession *s) {
+    if (*err) {
+        return;
+    }
+    arena_reset(s->arena);
+    word_store_rands(err, w->run->ws, &s->rng, s->arena, WORD_PICK_UNIFORM,
+                     WORDS_PER_TEST, &s->text);
+    typing_engine_begin(err, s->engine, s->arena, w->run->ws, &s->text, NULL,
+                        s->key_log);
+    s->cursor = 0;
+    s->error_at = LG_NONE;
+    s->notice_in = 0;
+    s->fixing = false;
+}
+
+// Time until the typist's next key: log-normal around the target speed,
+// with a hesitation before each word
+uint64_t lg_gap_ns(const LGConfig *cfg, LGSession *s, uint32_t next) {
+    double median = 12e9 / cfg->wpm;
+    double gap = median * exp(0.4 * lg_normal(&s->rng));
+    return (uint64_t)(next == ' ' ? gap * 1.5 : gap);
+}
+
+// Sessions form a min-heap on when their next key is due
+void lg_heap_push(LGWorker *w, size_t *len, size_t session) {
+    size_t i = (*len)++;
+    w->heap[i] = session;
+    while (i) {
+        size_t parent = (i - 1) / 2;
+        if (w->sessions[w->heap[parent]].due_ns <=
+            w->sessions[w->heap[i]].due_ns) {
+            break;
+        }
+        size_t tmp = w->heap[parent];
+        w->heap[parent] = w->heap[i];
+        w->heap[i] = tmp;
+        i = parent;
+    }
+}
+
+// Sift the root down after its due time moved later
+void lg_heap_fix(LGWorker *w, size_t len) {
+    size_t i = 0;
+    for (;;) {
+        size_t least = i;
+        size_t l = i * 2 + 1;
+        size_t r = l + 1;
+        if (l < len && w->sessions[w->heap[l]].due_ns <
+                           w->sessions[w->heap[least]].due_ns) {
+            least = l;
+        }
+        if (r < len && w->sessions[w->heap[r]].due_ns <
+                           w->sessions[w->heap[least]].due_ns) {
+            least = r;
+        }
+        if (least == i) {
+            return;
+        }
+        size_t tmp = w->heap[least];
+        w->heap[least] = w->heap[i];
+        w->heap[i] = tmp;
+        i = least;
+    }
+}
+
+// Values below 32 get a bucket each. Above, each power of two is split in
+// 32 by the bits under the top one.
+void lg_hist_add(LGHist *h, uint64_t v) {
+    size_t b = (size_t)v;
+    if (v >= LG_SUB) {
+        unsigned shift = 63u - (unsigned)__builtin_clzll(v) - LG_SUB_BITS;
+        b = (shift + 1) * LG_SUB + (size_t)((v >> shift) & (LG_SUB - 1));
+    }
+    h->buckets[b]++;
+    h->count++;
+    h->max = MAX_N(h->max, v);
+}
+
+void lg_hist_merge(LGHist *tgt, const LGHist *src) {
+    for (size_t i = 0; i < LG_BUCKETS; i++) {
+        tgt->buckets[i] += src->buckets[i];
+    }
+    tgt->count += src->count;
+    tgt->max = MAX_N(tgt->max, src->max);
+}
+
+// Lower bound of the bucket holding the pct'th percentile
+uint64_t lg_hist_pct(const LGHist *h, double pct) {
+    if (!h->count) {
+        return 0;
+    }
+    double want = ceil((double)h->count * pct / 100.);
+    uint64_t rank = (uint64_t)want;
+    uint64_t seen = 0;
+    for (size_t b = 0; b < LG_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen < MAX_N(rank, (uint64_t)1)) {
+            continue;
+        }
+        if (b < LG_SUB) {
+            return b;
+        }
+        size_t shift = b / LG_SUB - 1;
+        return MIN_N((uint64_t)(LG_SUB + b % LG_SUB) << shift, h->max);
+    }
+    return h->max;
+}
+
+void lg_print_hist(const char *name, const LGHist *h) {
+    printf("%s (ns over %llu keys): p50 %llu  p90 %llu  p99 %llu  "
+           "p99.9 %llu  max %llu\n",
+           name, (unsigned long long)h->count,
+           (unsigned long long)lg_hist_pct(h, 50.),
+           (unsigned long long)lg_hist_pct(h, 90.),
+           (unsigned long long)lg_hist_pct(h, 99.),
+           (unsigned long long)lg_hist_pct(h, 99.9),
+           (unsigned long long)h->max);
+}
+
+uint64_t lg_now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+// Box-Muller, one of the pair
+double lg_normal(Rng *rng) {
+    double u = 1. - rng_unit(rng);
+    double v = rng_unit(rng);
+    return sqrt(-2. * log(u)) * cos(2. * 3.14159265358979323846 * v);
+}
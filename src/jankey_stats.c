@@ -0,0 +1,106 @@
+// clock_gettime, kill
+#define _POSIX_C_SOURCE 200809L
+#include "live_stats.h"
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Prints the live rounds of this user's running games, one line each, for
+// status bars and dashboards. Reading never blocks or signals the games.
+//
+//   jankey_stats        every game, prefixed with its pid
+//   jankey_stats PID    just that game
+
+bool js_print(pid_t pid, bool show_pid);
+int js_usage(const char *prog);
+
+int main(int argc, char *argv[]) {
+    if (argc > 2) {
+        return js_usage(argv[0]);
+    }
+    if (argc == 2) {
+        char *end = NULL;
+        long pid = strtol(argv[1], &end, 10);
+        if (!*argv[1] || *end || pid <= 0) {
+            return js_usage(argv[0]);
+        }
+        return js_print((pid_t)pid, false) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    DIR *d = opendir(LIVE_STATS_DIR);
+    if (!d) {
+        return EXIT_FAILURE;
+    }
+    char prefix[LIVE_STATS_PATH_CAP];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "%s%lu-",
+                              LIVE_STATS_PREFIX, (unsigned long)geteuid());
+    bool any = false;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        if (strncmp(e->d_name, prefix, (size_t)prefix_len)) {
+            continue;
+        }
+        long pid = strtol(e->d_name + prefix_len, NULL, 10);
+        if (pid > 0) {
+            any = js_print((pid_t)pid, true) || any;
+        }
+    }
+    closedir(d);
+    return any ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// A page left by a game that died is skipped
+bool js_print(pid_t pid, bool show_pid) {
+    char path[LIVE_STATS_PATH_CAP];
+    live_stats_path(path, sizeof(path), geteuid(), pid);
+    if (kill(pid, 0) && errno == ESRCH) {
+        return false;
+    }
+    LiveSnapshot s;
+    if (!live_stats_read(path, &s)) {
+        return false;
+    }
+    if (show_pid) {
+        printf("%ld ", (long)pid);
+    }
+
+    switch ((LiveState)s.state) {
+    case LIVE_STATE_READY:
+        printf("ready 0/%llu\n", (unsigned long long)s.text_len);
+        break;
+    case LIVE_STATE_TYPING: {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t now_ns =
+            (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+        double minutes = (double)(now_ns - s.started_ns) / 60e9;
+        double wpm = minutes > 0. ? (double)s.cursor / 5. / minutes : 0.;
+        double accuracy =
+            s.typed ? (double)s.correct * 100. / (double)s.typed : 100.;
+        printf("%.0f wpm %.0f%% %llu/%llu\n", wpm, accuracy,
+               (unsigned long long)s.cursor, (unsigned long long)s.text_len);
+        break;
+    }
+    case LIVE_STATE_DONE:
+        printf("done %.0f wpm %.0f%%\n", (double)s.wpm_centi / 100.,
+               (double)s.accuracy_centi / 100.);
+        break;
+    default:
+        printf("unknown\n");
+        break;
+    }
+    return true;
+}
+
+int js_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [PID]\n", prog);
+    return EXIT_FAILURE;
+}
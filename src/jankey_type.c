@@ -1,27 +1,75 @@
 #include "jankey_type.h"
 #include "constants.h"
+#include "dict_registry.h"
+#include "ghost.h"
+#include "heatmap_view.h"
 #include "helpers.h"
+#include "key_heatmap.h"
+#include "key_log.h"
+#include "live_stats.h"
 #include "post_round_modal.h"
+#include "race_client.h"
+#include "race_protocol.h"
+#include "results_history.h"
+#include "review_view.h"
+#include "session_recorder.h"
 #include "typing_test.h"
 #include "typing_test_stats.h"
 #include "word_store.h"
+#include <ncurses.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JT_DICT_DIR "dict"
+#define JT_DEFAULT_DICT "en_gb"
 
 struct JankeyType {
+    DictRegistry *dicts;
+    size_t dict;
     WordStore *word_store;
     TypingTest *typing_test;
     TypingTestStats *stats;
     PostRoundModal *post_round_modal;
+    HeatmapView *heatmap_view;
+    ReviewView *review_view;
+    ResultsHistory *history;
+    KeyLog *key_log;
+    KeyHeatmap *heatmap;
+    TestMode mode;
+    RaceClient *race;
+    Ghost *ghost;
+    bool ghost_stale;
+    LiveStats *live;
+    SessionRecorder *rec;
+    char notice[ERR_MSG_CAP];
 };
 
+void jt_record_round(Err **err, JankeyType *jt);
+void jt_report(JankeyType *jt, Err **err);
+void jt_show_notice(JankeyType *jt);
+void jt_select_dict(Err **err, JankeyType *jt, size_t dict);
+void jt_join_race(Err **err, JankeyType *jt, JankeyState *state,
+                  size_t *word_count);
+Ghost *jt_ghost(JankeyType *jt);
+
 void jankey_type_init(Err **err, JankeyType **jankey_type) {
 
     JankeyType *jt = ZALLOC(sizeof(*jt));
     if (!jt) {
-        *err = ERR_MAKE("Unable to allocate memory for Jankey Type");
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for Jankey Type");
         return;
     }
 
-    word_store_init(err, &jt->word_store, "dict/en_gb.txt");
+    dict_registry_init(err, &jt->dicts, JT_DICT_DIR);
+    if (*err) {
+        jankey_type_destroy(&jt);
+        return;
+    }
+    size_t dict = dict_registry_find(jt->dicts, JT_DEFAULT_DICT);
+    jt_select_dict(err, jt, dict == DICT_NONE ? 0 : dict);
     if (*err) {
         jankey_type_destroy(&jt);
         return;
@@ -45,25 +93,113 @@ void jankey_type_init(Err **err, JankeyType **jankey_type) {
         return;
     }
 
+    heatmap_view_init(err, &jt->heatmap_view);
+    if (*err) {
+        jankey_type_destroy(&jt);
+        return;
+    }
+
+    review_view_init(err, &jt->review_view);
+    if (*err) {
+        jankey_type_destroy(&jt);
+        return;
+    }
+
+    // History is optional, rounds are still playable without a data dir
+    results_history_init(err, &jt->history, NULL);
+    if (*err) {
+        RESET_ERR(*err);
+    }
+    key_log_init(err, &jt->key_log, NULL);
+    if (*err) {
+        RESET_ERR(*err);
+    }
+    ghost_init(err, &jt->ghost, NULL);
+    if (*err) {
+        RESET_ERR(*err);
+    }
+    // Live stats are for onlookers, rounds run the same without them
+    live_stats_init(err, &jt->live);
+    if (*err) {
+        RESET_ERR(*err);
+    }
+    typing_test_setlive(jt->typing_test, jt->live);
+    key_heatmap_init(err, &jt->heatmap, NULL);
+    if (!*err) {
+        word_store_setweakness(err, jt->word_store, jt->heatmap, NULL);
+    }
+    if (*err) {
+        RESET_ERR(*err);
+    }
+    jt->mode = TEST_MODE_RANDOM;
+
     *jankey_type = jt;
     return;
 }
 
+// Race against everyone on the server at race_path instead of playing alone
+void jankey_type_join(Err **err, JankeyType *jankey_type,
+                      const char *race_path) {
+    race_client_init(err, &jankey_type->race, race_path);
+}
+
+// Record the session's keys and frames to path as an asciicast
+void jankey_type_record(Err **err, JankeyType *jankey_type, const char *path) {
+    session_recorder_init(err, &jankey_type->rec, path, COLS, LINES);
+    if (*err) {
+        return;
+    }
+    typing_test_setrecorder(jankey_type->typing_test, jankey_type->rec);
+}
+
 void jankey_type_run(Err **err, JankeyType *jankey_type,
                      JankeyState initial_state) {
     JankeyState state = initial_state;
     Err *e = NULL;
     while (state != JANKEY_STATE_QUITTING && !e) {
         switch (state) {
-        case JANKEY_STATE_RUNNING_TEST:
+        case JANKEY_STATE_RUNNING_TEST: {
+            size_t word_count = WORDS_PER_TEST;
+            if (jankey_type->race) {
+                jt_join_race(&e, jankey_type, &state, &word_count);
+                if (e || state != JANKEY_STATE_RUNNING_TEST) {
+                    break;
+                }
+            }
+            Ghost *ghost = jankey_type->mode == TEST_MODE_GHOST
+                               ? jt_ghost(jankey_type)
+                               : NULL;
             typing_test_run(&e, &state, jankey_type->typing_test,
-                            jankey_type->word_store, WORDS_PER_TEST,
-                            jankey_type->stats);
+                            jankey_type->word_store, jankey_type->mode,
+                            word_count, jankey_type->stats,
+                            jankey_type->key_log, jankey_type->race, ghost);
+            if (!e && state == JANKEY_STATE_DISPLAYING_POST_TEST_MODAL) {
+                jt_record_round(&e, jankey_type);
+            }
             break;
-        case JANKEY_STATE_DISPLAYING_POST_TEST_MODAL:
+        }
+        case JANKEY_STATE_DISPLAYING_POST_TEST_MODAL: {
+            jt_show_notice(jankey_type);
+            size_t dict = jankey_type->dict;
             post_round_modal_run(&e, &state, jankey_type->post_round_modal,
-                                 jankey_type->stats);
+                                 jankey_type->stats, jankey_type->history,
+                                 &jankey_type->mode, jankey_type->dicts,
+                                 &dict, jankey_type->race != NULL);
+            if (!e && dict != jankey_type->dict) {
+                jt_select_dict(&e, jankey_type, dict);
+            }
             break;
+        }
+        case JANKEY_STATE_DISPLAYING_HEATMAP:
+            heatmap_view_run(&e, &state, jankey_type->heatmap_view,
+                             jankey_type->heatmap);
+            break;
+        case JANKEY_STATE_DISPLAYING_REVIEW: {
+            const RoundReview *review =
+                typing_test_review(&e, jankey_type->typing_test);
+            review_view_run(&e, &state, jankey_type->review_view, review);
+            break;
+        }
         case JANKEY_STATE_QUITTING:
             break;
         default:
@@ -81,17 +217,180 @@ void jankey_type_destroy(JankeyType **jankey_type) {
     }
 
     JankeyType *jt = *jankey_type;
+    if (jt->history) {
+        results_history_destroy(&jt->history);
+    }
+    if (jt->key_log) {
+        key_log_destroy(&jt->key_log);
+    }
+    if (jt->heatmap) {
+        key_heatmap_destroy(&jt->heatmap);
+    }
+    if (jt->heatmap_view) {
+        heatmap_view_destroy(&jt->heatmap_view);
+    }
+    if (jt->review_view) {
+        review_view_destroy(&jt->review_view);
+    }
     if (jt->post_round_modal) {
         post_round_modal_destroy(&jt->post_round_modal);
     }
     if (jt->typing_test) {
         typing_test_destroy(&jt->typing_test);
     }
-    if (jt->word_store) {
-        word_store_destroy(&jt->word_store);
+    if (jt->stats) {
+        tt_stats_destoy(&jt->stats);
+    }
+    if (jt->race) {
+        race_client_destroy(&jt->race);
+    }
+    if (jt->ghost) {
+        ghost_destroy(&jt->ghost);
     }
+    if (jt->live) {
+        live_stats_destroy(&jt->live);
+    }
+    if (jt->rec) {
+        session_recorder_destroy(&jt->rec);
+    }
+    // The registry owns every word store
+    if (jt->dicts) {
+        dict_registry_destroy(&jt->dicts);
+    }
+    jt->word_store = NULL;
 
     free(jt);
     jt = NULL;
     *jankey_type = NULL;
 }
+
+void jt_record_round(Err **err, JankeyType *jt) {
+    int64_t now = (int64_t)time(NULL);
+
+    // Shared timestamp ties the key log round to its result
+    if (jt->key_log) {
+        key_log_commit(err, jt->key_log, now, (uint32_t)jt->mode);
+        if (*err) {
+            jt_report(jt, err);
+        }
+    }
+
+    if (jt->heatmap) {
+        const KeyHeatmap *round = typing_test_getheatmap(jt->typing_test);
+        key_heatmap_merge(jt->heatmap, round);
+        word_store_setweakness(err, jt->word_store, jt->heatmap, round);
+        if (*err) {
+            return;
+        }
+        // Saved every round so an interrupted session keeps what it played
+        key_heatmap_save(err, jt->heatmap, NULL);
+        if (*err) {
+            jt_report(jt, err);
+        }
+    }
+
+    // A faster round replaces the ghost next time it is raced
+    if (jt->ghost && tt_stats_getwpm(jt->stats) > ghost_wpm(jt->ghost)) {
+        jt->ghost_stale = true;
+    }
+
+    if (!jt->history) {
+        return;
+    }
+
+    ResultRecord r = {
+        .timestamp = now,
+        .mode = (uint32_t)jt->mode,
+        .word_count = (uint32_t)WORDS_PER_TEST,
+        .wpm = (float)tt_stats_getwpm(jt->stats),
+        .accuracy = (float)tt_stats_getAccuracy(jt->stats),
+        .elapsed_sec = (float)tt_stats_getSecondsElapsed(jt->stats),
+    };
+    results_history_append(err, jt->history, &r);
+    if (*err) {
+        jt_report(jt, err);
+    }
+}
+
+// Saving is best effort, as loading is. A failure is kept to show under
+// the next post-round modal and play goes on.
+void jt_report(JankeyType *jt, Err **err) {
+    snprintf(jt->notice, sizeof(jt->notice), "%s", (*err)->msg);
+    RESET_ERR(*err);
+}
+
+// Show the last save failure on the bottom line, once
+void jt_show_notice(JankeyType *jt) {
+    if (!jt->notice[0]) {
+        return;
+    }
+    mvprintw(LINES - 1, 0, "Not saved: %.*s", MAX_N(COLS - 12, 0),
+             jt->notice);
+    clrtoeol();
+    refresh();
+    jt->notice[0] = '\0';
+}
+
+// Switch dictionary, loading it on first use. Weakness weights are refreshed
+// from the full history as rounds since it was last used only updated the
+// active one.
+void jt_select_dict(Err **err, JankeyType *jt, size_t dict) {
+    WordStore *ws = dict_registry_get(err, jt->dicts, dict);
+    if (*err) {
+        return;
+    }
+    jt->word_store = ws;
+    jt->dict = dict;
+
+    if (jt->heatmap) {
+        word_store_setweakness(err, ws, jt->heatmap, NULL);
+    }
+}
+
+// Wait for the server to start a race, then seed the word picks with its
+// seed so every racer gets the same test
+void jt_join_race(Err **err, JankeyType *jt, JankeyState *state,
+                  size_t *word_count) {
+    const char *msg = "Waiting for the next race... [Q]uit";
+    clear();
+    mvprintw(LINES / 2, MAX_N((COLS - (int)strlen(msg)) / 2, 0), "%s", msg);
+    refresh();
+
+    // Keys arriving meanwhile wake the wait, Q or Esc gives up on the race
+    RaceStart start;
+    race_client_join(err, jt->race, jt->word_store->dict_hash);
+    while (!*err && !race_client_wait(err, jt->race, STDIN_FILENO, &start)) {
+        int c = getch();
+        if (c == 'q' || c == 'Q' || c == 27) {
+            *state = JANKEY_STATE_QUITTING;
+            return;
+        }
+    }
+    if (*err) {
+        return;
+    }
+    typing_test_seed(jt->typing_test, start.seed);
+    jt->mode = TEST_MODE_RANDOM;
+    *word_count = start.word_count;
+}
+
+// Personal best on the current dictionary, reloaded when the dictionary
+// changed or a round since may have beaten it. NULL if there is none, in
+// which case the round is played with random words.
+Ghost *jt_ghost(JankeyType *jt) {
+    if (!jt->ghost) {
+        return NULL;
+    }
+    if (jt->ghost_stale ||
+        !ghost_matches(jt->ghost, jt->word_store->dict_hash)) {
+        jt->ghost_stale = false;
+        Err *e = NULL;
+        bool found = ghost_load(&e, jt->ghost, jt->word_store);
+        if (e) {
+            RESET_ERR(e);
+        }
+        return found ? jt->ghost : NULL;
+    }
+    size_t word_count = 0;
+    return ghost_words(jt->ghost, &word_count) ? jt->ghost : NULL;
+}
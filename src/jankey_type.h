@@ -7,6 +7,9 @@
 typedef struct JankeyType JankeyType;
 
 void jankey_type_init(Err **err, JankeyType **jankey_type);
+void jankey_type_join(Err **err, JankeyType *jankey_type,
+                      const char *race_path);
+void jankey_type_record(Err **err, JankeyType *jankey_type, const char *path);
 void jankey_type_run(Err **err, JankeyType *jankey_type,
                      JankeyState initialState);
 void jankey_type_destroy(JankeyType **jankey_type);
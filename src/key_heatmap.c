@@ -0,0 +1,133 @@
+#include "key_heatmap.h"
+#include "data_dir.h"
+#include "err.h"
+#include "helpers.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define KH_MAGIC "JKHEAT1"
+#define KH_VERSION 1u
+
+typedef struct KHHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t keys;
+} KHHeader;
+
+void kh_resolve_path(Err **err, char *buff, size_t buff_size,
+                     const char **path);
+
+// Load the persisted heatmap, starting empty if none exists
+void key_heatmap_init(Err **err, KeyHeatmap **heatmap, const char *path) {
+    KeyHeatmap *hm = ZALLOC(sizeof(*hm));
+    if (!hm) {
+        *err =
+            ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate memory for heatmap");
+        return;
+    }
+
+    char default_path[DATA_PATH_CAP];
+    kh_resolve_path(err, default_path, sizeof(default_path), &path);
+    if (*err) {
+        key_heatmap_destroy(&hm);
+        return;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        KHHeader hdr;
+        bool valid = fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+                     memcmp(hdr.magic, KH_MAGIC, sizeof(hdr.magic)) == 0 &&
+                     hdr.version == KH_VERSION && hdr.keys == HEATMAP_KEYS &&
+                     fread(hm, sizeof(*hm), 1, f) == 1;
+        fclose(f);
+        if (!valid) {
+            // Unreadable history only loses past counts
+            key_heatmap_clear(hm);
+        }
+    }
+
+    *heatmap = hm;
+}
+
+void key_heatmap_clear(KeyHeatmap *hm) { memset(hm, 0, sizeof(*hm)); }
+
+void key_heatmap_key(KeyHeatmap *hm, uint32_t expected, uint32_t typed) {
+    if (expected < HEATMAP_KEYS && typed < HEATMAP_KEYS) {
+        hm->confusion[expected][typed]++;
+    }
+}
+
+void key_heatmap_bigram(KeyHeatmap *hm, uint32_t prev, uint32_t expected,
+                        bool error, uint32_t latency_ms) {
+    uint32_t a = prev;
+    uint32_t b = expected;
+    if (a >= HEATMAP_KEYS || b >= HEATMAP_KEYS) {
+        return;
+    }
+
+    hm->bigram_count[a][b]++;
+    hm->bigram_errors[a][b] += error;
+    if (latency_ms <= HEATMAP_MAX_LATENCY_MS) {
+        hm->bigram_timed[a][b]++;
+        hm->bigram_latency_ms[a][b] += latency_ms;
+    }
+}
+
+void key_heatmap_merge(KeyHeatmap *tgt, const KeyHeatmap *src) {
+    for (size_t a = 0; a < HEATMAP_KEYS; a++) {
+        for (size_t b = 0; b < HEATMAP_KEYS; b++) {
+            tgt->confusion[a][b] += src->confusion[a][b];
+            tgt->bigram_count[a][b] += src->bigram_count[a][b];
+            tgt->bigram_errors[a][b] += src->bigram_errors[a][b];
+            tgt->bigram_timed[a][b] += src->bigram_timed[a][b];
+            tgt->bigram_latency_ms[a][b] += src->bigram_latency_ms[a][b];
+        }
+    }
+}
+
+void key_heatmap_save(Err **err, const KeyHeatmap *hm, const char *path) {
+    char default_path[DATA_PATH_CAP];
+    kh_resolve_path(err, default_path, sizeof(default_path), &path);
+    if (*err) {
+        return;
+    }
+
+    char tmp_path[DATA_PATH_CAP + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to write %s", tmp_path);
+        return;
+    }
+
+    KHHeader hdr = {.version = KH_VERSION, .keys = HEATMAP_KEYS};
+    memcpy(hdr.magic, KH_MAGIC, sizeof(hdr.magic));
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(hm, sizeof(*hm), 1, f) == 1;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp_path, path)) {
+        remove(tmp_path);
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to write %s", path);
+    }
+}
+
+void key_heatmap_destroy(KeyHeatmap **heatmap) {
+    if (!heatmap || !*heatmap) {
+        return;
+    }
+    free(*heatmap);
+    *heatmap = NULL;
+}
+
+void kh_resolve_path(Err **err, char *buff, size_t buff_size,
+                     const char **path) {
+    if (*path) {
+        return;
+    }
+    data_dir_path(err, buff, buff_size, "heatmap.bin");
+    *path = buff;
+}
@@ -0,0 +1,33 @@
+#ifndef KEY_HEATMAP_H
+#define KEY_HEATMAP_H
+
+#include "err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HEATMAP_KEYS 128
+
+// Bigram latencies above this are pauses rather than transitions
+#define HEATMAP_MAX_LATENCY_MS 2000
+
+// Dense per-key and per-bigram counters indexed by 7-bit ASCII, other code
+// points are not counted. Bigrams are keyed by the expected chars of two
+// consecutively typed positions.
+typedef struct KeyHeatmap {
+    uint32_t confusion[HEATMAP_KEYS][HEATMAP_KEYS];
+    uint32_t bigram_count[HEATMAP_KEYS][HEATMAP_KEYS];
+    uint32_t bigram_errors[HEATMAP_KEYS][HEATMAP_KEYS];
+    uint32_t bigram_timed[HEATMAP_KEYS][HEATMAP_KEYS];
+    uint64_t bigram_latency_ms[HEATMAP_KEYS][HEATMAP_KEYS];
+} KeyHeatmap;
+
+void key_heatmap_init(Err **err, KeyHeatmap **heatmap, const char *path);
+void key_heatmap_clear(KeyHeatmap *heatmap);
+void key_heatmap_key(KeyHeatmap *heatmap, uint32_t expected, uint32_t typed);
+void key_heatmap_bigram(KeyHeatmap *heatmap, uint32_t prev, uint32_t expected,
+                        bool error, uint32_t latency_ms);
+void key_heatmap_merge(KeyHeatmap *tgt, const KeyHeatmap *src);
+void key_heatmap_save(Err **err, const KeyHeatmap *heatmap, const char *path);
+void key_heatmap_destroy(KeyHeatmap **heatmap);
+
+#endif
@@ -0,0 +1,571 @@
+#define _POSIX_C_SOURCE 200809L
+#include "key_log.h"
+#include "arena.h"
+#include "data_dir.h"
+#include "err.h"
+#include "helpers.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// A log is a sequence of rounds. Each round is a header, the test as the
+// dictionary hash and varint word ids (the raw text in version 1), then
+// blocks of encoded events. Every block carries its own checksum so damage is
+// contained to the block it hits.
+//
+// Events are one key byte (bit 7 set when correct) followed by a varint time
+// delta in KEY_LOG_TICK_MS ticks. The index is implied by replaying the cursor:
+// a key hits the cursor and a backspace the char before it. Keys outside
+// 1-127, or indices which differ from the prediction, use a long form where
+// the key byte is zero and varints for the key and the zigzag index offset
+// follow. A typical keystroke costs two bytes.
+
+#define KL_MAGIC 0x524b4b4au
+#define KL_VERSION 2u
+#define KL_VERSION_TEXT 1u
+#define KL_BLOCK_CAP 4096
+#define KL_EVENT_MAX 16
+
+typedef struct KLRoundHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t mode;
+    int64_t timestamp;
+    uint32_t body_len;
+    uint32_t event_count;
+    uint32_t block_count;
+    uint32_t checksum;
+} KLRoundHeader;
+
+typedef struct KLBlockHeader {
+    uint16_t len;
+    uint16_t event_count;
+    uint32_t checksum;
+} KLBlockHeader;
+
+struct KeyLog {
+    int fd;
+    Arena *arena;
+    unsigned char *buff;
+    size_t buff_len;
+    size_t buff_cap;
+    size_t block_start;
+    uint32_t block_events;
+    uint32_t block_count;
+    uint32_t event_count;
+    size_t body_len;
+    uint32_t cursor;
+    struct timespec last;
+    bool started;
+    bool failed;
+};
+
+struct KeyLogReader {
+    FILE *s;
+    unsigned char *body;
+    size_t body_cap;
+    uint32_t *ids;
+    size_t ids_cap;
+    uint32_t blocks_left;
+    unsigned char block[KL_BLOCK_CAP];
+    size_t block_len;
+    size_t block_pos;
+    uint32_t cursor;
+};
+
+bool kl_reserve(KeyLog *log, size_t n);
+void kl_block_open(KeyLog *log);
+void kl_block_close(KeyLog *log);
+size_t kl_put_varint(unsigned char *p, uint64_t v);
+bool kl_get_varint(const unsigned char *p, size_t len, size_t *pos,
+                   uint64_t *v);
+uint32_t kl_header_checksum(const KLRoundHeader *hdr,
+                            const unsigned char *body);
+bool kl_reader_ids(Err **err, KeyLogReader *r, size_t body_len,
+                   KeyLogRound *round);
+bool kl_reader_resync(KeyLogReader *r);
+
+void key_log_init(Err **err, KeyLog **log, const char *path) {
+    KeyLog *l = ZALLOC(sizeof(*l));
+    if (!l) {
+        *err =
+            ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate memory for key log");
+        return;
+    }
+    l->fd = -1;
+
+    char default_path[DATA_PATH_CAP];
+    if (!path) {
+        data_dir_path(err, default_path, sizeof(default_path), "keys.bin");
+        if (*err) {
+            key_log_destroy(&l);
+            return;
+        }
+        path = default_path;
+    }
+
+    l->fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (l->fd < 0) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to open %s: %s", path,
+                             strerror(errno));
+        key_log_destroy(&l);
+        return;
+    }
+
+    *log = l;
+}
+
+// Start a round, the encoded round is built in the round arena
+void key_log_begin(Err **err, KeyLog *log, Arena *arena, uint32_t dict_hash,
+                   const uint32_t *word_ids, size_t word_count,
+                   size_t text_len) {
+    log->arena = arena;
+    size_t body_cap = sizeof(dict_hash) + word_count * 5;
+    log->buff_cap =
+        sizeof(KLRoundHeader) + body_cap + (text_len * 4) + KL_BLOCK_CAP;
+    log->buff = ARENA_ALLOC(arena, unsigned char, log->buff_cap);
+    if (!log->buff) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate key log buffer");
+        return;
+    }
+
+    // A few bytes per word rather than the text itself
+    unsigned char *body = log->buff + sizeof(KLRoundHeader);
+    memcpy(body, &dict_hash, sizeof(dict_hash));
+    size_t n = sizeof(dict_hash);
+    for (size_t i = 0; i < word_count; i++) {
+        n += kl_put_varint(body + n, word_ids[i]);
+    }
+    log->body_len = n;
+    log->buff_len = sizeof(KLRoundHeader) + n;
+    log->block_count = 0;
+    log->event_count = 0;
+    log->cursor = 0;
+    log->started = false;
+    log->failed = false;
+    kl_block_open(log);
+}
+
+void key_log_push(KeyLog *log, int key, size_t index, bool correct) {
+    if (log->failed) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ticks = 0;
+    if (log->started) {
+        int64_t ms = (int64_t)(now.tv_sec - log->last.tv_sec) * 1000 +
+                     (int64_t)(now.tv_nsec - log->last.tv_nsec) / 1000000;
+        ticks = ms > 0 ? ((uint64_t)ms + KEY_LOG_TICK_MS / 2) / KEY_LOG_TICK_MS
+                       : 0;
+    }
+    log->last = now;
+    log->started = true;
+
+    if (log->buff_len - log->block_start - sizeof(KLBlockHeader) +
+            KL_EVENT_MAX >
+        KL_BLOCK_CAP) {
+        kl_block_close(log);
+        kl_block_open(log);
+    }
+    if (!kl_reserve(log, KL_EVENT_MAX + sizeof(KLBlockHeader))) {
+        // Keep the keystroke path infallible, the round is not logged
+        log->failed = true;
+        return;
+    }
+
+    bool backspace = key == KEY_LOG_BACKSPACE;
+    uint32_t predicted = backspace ? log->cursor - 1 : log->cursor;
+    unsigned char *p = log->buff + log->buff_len;
+    size_t n = 0;
+
+    unsigned char flag = correct ? 0x80 : 0x00;
+    if (key > 0 && key < 0x80 && index == predicted) {
+        p[n++] = (unsigned char)key | flag;
+    } else {
+        int64_t off = (int64_t)index - (int64_t)predicted;
+        uint64_t zigzag = (uint64_t)((off << 1) ^ (off >> 63));
+        p[n++] = flag;
+        n += kl_put_varint(p + n, (uint32_t)key);
+        n += kl_put_varint(p + n, zigzag);
+    }
+    n += kl_put_varint(p + n, ticks);
+
+    log->buff_len += n;
+    log->block_events++;
+    log->event_count++;
+    log->cursor = backspace ? (uint32_t)index : (uint32_t)index + 1;
+}
+
+void key_log_commit(Err **err, KeyLog *log, int64_t timestamp, uint32_t mode) {
+    if (log->failed || !log->buff) {
+        return;
+    }
+    kl_block_close(log);
+
+    KLRoundHeader hdr = {
+        .magic = KL_MAGIC,
+        .version = KL_VERSION,
+        .mode = (uint16_t)mode,
+        .timestamp = timestamp,
+        .body_len = (uint32_t)log->body_len,
+        .event_count = log->event_count,
+        .block_count = log->block_count,
+    };
+    hdr.checksum = kl_header_checksum(&hdr, log->buff + sizeof(hdr));
+    memcpy(log->buff, &hdr, sizeof(hdr));
+
+    // Rounds go out in a single write; a torn one is skipped by the reader
+    ssize_t n = write(log->fd, log->buff, log->buff_len);
+    log->buff = NULL;
+    if (n != (ssize_t)log->buff_len) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to write key log: %s",
+                             n < 0 ? strerror(errno) : "short write");
+    }
+}
+
+void key_log_destroy(KeyLog **log) {
+    if (!log || !*log) {
+        return;
+    }
+
+    KeyLog *l = *log;
+    if (l->fd >= 0) {
+        close(l->fd);
+        l->fd = -1;
+    }
+
+    free(l);
+    l = NULL;
+    *log = NULL;
+}
+
+void key_log_reader_init(Err **err, KeyLogReader **reader, const char *path) {
+    KeyLogReader *r = ZALLOC(sizeof(*r));
+    if (!r) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for key log reader");
+        return;
+    }
+
+    char default_path[DATA_PATH_CAP];
+    if (!path) {
+        data_dir_path(err, default_path, sizeof(default_path), "keys.bin");
+        if (*err) {
+            key_log_reader_destroy(&r);
+            return;
+        }
+        path = default_path;
+    }
+
+    r->s = fopen(path, "rb");
+    if (!r->s) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to open %s: %s", path,
+                             strerror(errno));
+        key_log_reader_destroy(&r);
+        return;
+    }
+
+    *reader = r;
+}
+
+// Advance to the next intact round, skipping any unread events of the current
+// one. The round text or word ids stay valid until the next call.
+bool key_log_reader_nextround(Err **err, KeyLogReader *r, KeyLogRound *round) {
+    while (r->blocks_left) {
+        KLBlockHeader bh;
+        if (fread(&bh, sizeof(bh), 1, r->s) != 1) {
+            return false;
+        }
+        if (bh.len > KL_BLOCK_CAP) {
+            r->blocks_left = 0;
+            if (!kl_reader_resync(r)) {
+                return false;
+            }
+            break;
+        }
+        if (fseek(r->s, (long)bh.len, SEEK_CUR)) {
+            return false;
+        }
+        r->blocks_left--;
+    }
+
+    while (true) {
+        long start = ftell(r->s);
+        KLRoundHeader hdr;
+        if (fread(&hdr, sizeof(hdr), 1, r->s) != 1) {
+            return false;
+        }
+        if (hdr.magic != KL_MAGIC ||
+            (hdr.version != KL_VERSION && hdr.version != KL_VERSION_TEXT)) {
+            if (fseek(r->s, start + 1, SEEK_SET) || !kl_reader_resync(r)) {
+                return false;
+            }
+            continue;
+        }
+
+        // The length is unverified until the checksum is, so one longer than
+        // the rest of the file is damage to resync past like any other
+        struct stat st;
+        long body_start = start + (long)sizeof(hdr);
+        if (fstat(fileno(r->s), &st)) {
+            return false;
+        }
+        if ((off_t)hdr.body_len > st.st_size - body_start) {
+            if (fseek(r->s, start + 1, SEEK_SET) || !kl_reader_resync(r)) {
+                return false;
+            }
+            continue;
+        }
+
+        if (hdr.body_len + (size_t)1 > r->body_cap) {
+            unsigned char *t = realloc(r->body, hdr.body_len + (size_t)1);
+            if (!t) {
+                *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to grow round body");
+                return false;
+            }
+            r->body = t;
+            r->body_cap = hdr.body_len + (size_t)1;
+        }
+        if (fread(r->body, 1, hdr.body_len, r->s) != hdr.body_len) {
+            return false;
+        }
+        r->body[hdr.body_len] = '\0';
+
+        if (kl_header_checksum(&hdr, r->body) != hdr.checksum) {
+            if (fseek(r->s, start + 1, SEEK_SET) || !kl_reader_resync(r)) {
+                return false;
+            }
+            continue;
+        }
+
+        *round = (KeyLogRound){0};
+        if (hdr.version == KL_VERSION_TEXT) {
+            round->text = (const char *)r->body;
+            round->text_len = hdr.body_len;
+        } else if (!kl_reader_ids(err, r, hdr.body_len, round)) {
+            if (*err) {
+                return false;
+            }
+            if (fseek(r->s, start + 1, SEEK_SET) || !kl_reader_resync(r)) {
+                return false;
+            }
+            continue;
+        }
+
+        r->blocks_left = hdr.block_count;
+        r->block_len = 0;
+        r->block_pos = 0;
+        r->cursor = 0;
+
+        round->timestamp = hdr.timestamp;
+        round->mode = hdr.mode;
+        round->event_count = hdr.event_count;
+        return true;
+    }
+}
+
+bool key_log_reader_nextevent(Err **err, KeyLogReader *r, KeyEvent *event) {
+    if (r->block_pos >= r->block_len) {
+        if (!r->blocks_left) {
+            return false;
+        }
+
+        KLBlockHeader bh;
+        if (fread(&bh, sizeof(bh), 1, r->s) != 1 || bh.len > KL_BLOCK_CAP ||
+            fread(r->block, 1, bh.len, r->s) != bh.len) {
+            *err = ERR_MAKE_CODE(ERR_IO, "Truncated key log block");
+            r->blocks_left = 0;
+            return false;
+        }
+        r->blocks_left--;
+        if (hash_fnv1a(r->block, bh.len) != bh.checksum) {
+            *err = ERR_MAKE_CODE(ERR_IO, "Corrupt key log block");
+            r->block_len = 0;
+            return false;
+        }
+        r->block_len = bh.len;
+        r->block_pos = 0;
+        if (!bh.len) {
+            return false;
+        }
+    }
+
+    const unsigned char *p = r->block;
+    size_t len = r->block_len;
+    unsigned char b = p[r->block_pos++];
+
+    int key = b & 0x7f;
+    bool correct = b & 0x80;
+    bool backspace;
+    uint32_t index;
+    uint64_t ticks = 0;
+
+    if (key) {
+        backspace = key == KEY_LOG_BACKSPACE;
+        index = backspace ? r->cursor - 1 : r->cursor;
+    } else {
+        uint64_t k = 0;
+        uint64_t zigzag = 0;
+        if (!kl_get_varint(p, len, &r->block_pos, &k) ||
+            !kl_get_varint(p, len, &r->block_pos, &zigzag)) {
+            *err = ERR_MAKE_CODE(ERR_IO, "Malformed key log event");
+            return false;
+        }
+        key = (int)k;
+        backspace = key == KEY_LOG_BACKSPACE;
+        int64_t off = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        uint32_t predicted = backspace ? r->cursor - 1 : r->cursor;
+        index = (uint32_t)((int64_t)predicted + off);
+    }
+    if (!kl_get_varint(p, len, &r->block_pos, &ticks)) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Malformed key log event");
+        return false;
+    }
+
+    r->cursor = backspace ? index : index + 1;
+
+    event->key = key;
+    event->index = index;
+    event->correct = correct;
+    event->dt_ms = (uint32_t)(ticks * KEY_LOG_TICK_MS);
+    return true;
+}
+
+void key_log_reader_destroy(KeyLogReader **reader) {
+    if (!reader || !*reader) {
+        return;
+    }
+
+    KeyLogReader *r = *reader;
+    if (r->s) {
+        fclose(r->s);
+        r->s = NULL;
+    }
+    free(r->body);
+    free(r->ids);
+
+    free(r);
+    r = NULL;
+    *reader = NULL;
+}
+
+bool kl_reserve(KeyLog *log, size_t n) {
+    if (log->buff_len + n <= log->buff_cap) {
+        return true;
+    }
+
+    // Rare, only for rounds far longer than the text; old buffer stays in
+    // the arena until the round ends
+    size_t cap = log->buff_cap * 2;
+    unsigned char *t = ARENA_ALLOC(log->arena, unsigned char, cap);
+    if (!t) {
+        return false;
+    }
+    memcpy(t, log->buff, log->buff_len);
+    log->buff = t;
+    log->buff_cap = cap;
+    return true;
+}
+
+void kl_block_open(KeyLog *log) {
+    log->block_start = log->buff_len;
+    log->block_events = 0;
+    log->buff_len += sizeof(KLBlockHeader);
+}
+
+void kl_block_close(KeyLog *log) {
+    size_t payload = log->block_start + sizeof(KLBlockHeader);
+    KLBlockHeader bh = {
+        .len = (uint16_t)(log->buff_len - payload),
+        .event_count = (uint16_t)log->block_events,
+        .checksum = hash_fnv1a(log->buff + payload, log->buff_len - payload),
+    };
+    memcpy(log->buff + log->block_start, &bh, sizeof(bh));
+    log->block_count++;
+}
+
+size_t kl_put_varint(unsigned char *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+bool kl_get_varint(const unsigned char *p, size_t len, size_t *pos,
+                   uint64_t *v) {
+    uint64_t out = 0;
+    for (unsigned shift = 0; shift < 64 && *pos < len; shift += 7) {
+        unsigned char b = p[(*pos)++];
+        out |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = out;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t kl_header_checksum(const KLRoundHeader *hdr,
+                            const unsigned char *body) {
+    uint32_t h = hash_fnv1a(hdr, offsetof(KLRoundHeader, checksum));
+    return h ^ hash_fnv1a(body, hdr->body_len);
+}
+
+// Decode a round body of dictionary hash and word ids, false if malformed
+bool kl_reader_ids(Err **err, KeyLogReader *r, size_t body_len,
+                   KeyLogRound *round) {
+    if (body_len < sizeof(round->dict_hash)) {
+        return false;
+    }
+    memcpy(&round->dict_hash, r->body, sizeof(round->dict_hash));
+
+    // Every id takes at least a byte
+    size_t cap = body_len - sizeof(round->dict_hash);
+    if (cap > r->ids_cap) {
+        uint32_t *t = realloc(r->ids, cap * sizeof(*t));
+        if (!t) {
+            *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to grow round word ids");
+            return false;
+        }
+        r->ids = t;
+        r->ids_cap = cap;
+    }
+
+    size_t count = 0;
+    size_t pos = sizeof(round->dict_hash);
+    while (pos < body_len) {
+        uint64_t id = 0;
+        if (!kl_get_varint(r->body, body_len, &pos, &id) || id > UINT32_MAX) {
+            return false;
+        }
+        r->ids[count++] = (uint32_t)id;
+    }
+
+    round->word_ids = r->ids;
+    round->word_count = count;
+    return true;
+}
+
+bool kl_reader_resync(KeyLogReader *r) {
+    // Scan byte by byte for the next round magic
+    uint32_t window = 0;
+    int c;
+    size_t seen = 0;
+    while ((c = fgetc(r->s)) != EOF) {
+        window = (window >> 8) | ((uint32_t)c << 24);
+        if (++seen >= 4 && window == KL_MAGIC) {
+            return fseek(r->s, -4, SEEK_CUR) == 0;
+        }
+    }
+    return false;
+}
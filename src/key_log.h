@@ -0,0 +1,51 @@
+#ifndef KEY_LOG_H
+#define KEY_LOG_H
+
+#include "arena.h"
+#include "err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define KEY_LOG_BACKSPACE 0x7f
+#define KEY_LOG_TICK_MS 4
+
+typedef struct KeyEvent {
+    int key;
+    uint32_t index;
+    bool correct;
+    uint32_t dt_ms;
+} KeyEvent;
+
+// Version 1 rounds carry the test text. Later rounds carry word ids into the
+// dictionary whose word_store hash is dict_hash, with text NULL.
+typedef struct KeyLogRound {
+    int64_t timestamp;
+    uint32_t mode;
+    uint32_t event_count;
+    const char *text;
+    size_t text_len;
+    uint32_t dict_hash;
+    const uint32_t *word_ids;
+    size_t word_count;
+} KeyLogRound;
+
+typedef struct KeyLog KeyLog;
+typedef struct KeyLogReader KeyLogReader;
+
+void key_log_init(Err **err, KeyLog **log, const char *path);
+void key_log_begin(Err **err, KeyLog *log, Arena *arena, uint32_t dict_hash,
+                   const uint32_t *word_ids, size_t word_count,
+                   size_t text_len);
+void key_log_push(KeyLog *log, int key, size_t index, bool correct);
+void key_log_commit(Err **err, KeyLog *log, int64_t timestamp, uint32_t mode);
+void key_log_destroy(KeyLog **log);
+
+void key_log_reader_init(Err **err, KeyLogReader **reader, const char *path);
+bool key_log_reader_nextround(Err **err, KeyLogReader *reader,
+                              KeyLogRound *round);
+bool key_log_reader_nextevent(Err **err, KeyLogReader *reader,
+                              KeyEvent *event);
+void key_log_reader_destroy(KeyLogReader **reader);
+
+#endif
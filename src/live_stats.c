@@ -0,0 +1,186 @@
+// O_NOFOLLOW, ftruncate, lstat
+#define _POSIX_C_SOURCE 200809L
+#include "live_stats.h"
+#include "err.h"
+#include "helpers.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LS_MAGIC "JKLIVE"
+#define LS_VERSION 1u
+#define LS_READ_TRIES 1000
+
+// One page per process, named after its uid and pid. The typing thread is
+// the only writer and never waits: it makes the sequence odd, stores the
+// fields and makes it even again. Readers copy the fields and retry if the
+// sequence was odd or moved meanwhile, so a snapshot is never torn and
+// publishing costs a handful of stores into the mapping.
+typedef struct LSSegment {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+    _Atomic uint64_t seq;
+    _Atomic uint64_t round;
+    _Atomic uint64_t state;
+    _Atomic uint64_t started_ns;
+    _Atomic uint64_t last_key_ns;
+    _Atomic uint64_t cursor;
+    _Atomic uint64_t text_len;
+    _Atomic uint64_t typed;
+    _Atomic uint64_t correct;
+    _Atomic uint64_t wpm_centi;
+    _Atomic uint64_t accuracy_centi;
+} LSSegment;
+
+struct LiveStats {
+    char path[LIVE_STATS_PATH_CAP];
+    LSSegment *seg;
+    uint64_t seq;
+};
+
+void live_stats_init(Err **err, LiveStats **live) {
+    LiveStats *l = ZALLOC(sizeof(*l));
+    if (!l) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for live stats");
+        return;
+    }
+    live_stats_path(l->path, sizeof(l->path), geteuid(), getpid());
+
+    // A crashed process with the same pid may have left its page behind.
+    // Only our own is cleared, and the page is always created afresh so a
+    // file planted by another user is never written to.
+    struct stat st;
+    if (!lstat(l->path, &st) && st.st_uid == geteuid()) {
+        unlink(l->path);
+    }
+    int fd = open(l->path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                  0644);
+    if (fd < 0) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to create %s: %s", l->path,
+                             strerror(errno));
+        free(l);
+        return;
+    }
+    void *map = MAP_FAILED;
+    if (!ftruncate(fd, sizeof(LSSegment))) {
+        map = mmap(NULL, sizeof(LSSegment), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to map %s", l->path);
+        unlink(l->path);
+        free(l);
+        return;
+    }
+
+    l->seg = map;
+    memcpy(l->seg->magic, LS_MAGIC, sizeof(LS_MAGIC));
+    l->seg->version = LS_VERSION;
+    l->seg->size = sizeof(LSSegment);
+    *live = l;
+}
+
+void live_stats_publish(LiveStats *live, const LiveSnapshot *snap) {
+    LSSegment *s = live->seg;
+    atomic_store_explicit(&s->seq, ++live->seq, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&s->round, snap->round, memory_order_relaxed);
+    atomic_store_explicit(&s->state, snap->state, memory_order_relaxed);
+    atomic_store_explicit(&s->started_ns, snap->started_ns,
+                          memory_order_relaxed);
+    atomic_store_explicit(&s->last_key_ns, snap->last_key_ns,
+                          memory_order_relaxed);
+    atomic_store_explicit(&s->cursor, snap->cursor, memory_order_relaxed);
+    atomic_store_explicit(&s->text_len, snap->text_len, memory_order_relaxed);
+    atomic_store_explicit(&s->typed, snap->typed, memory_order_relaxed);
+    atomic_store_explicit(&s->correct, snap->correct, memory_order_relaxed);
+    atomic_store_explicit(&s->wpm_centi, snap->wpm_centi,
+                          memory_order_relaxed);
+    atomic_store_explicit(&s->accuracy_centi, snap->accuracy_centi,
+                          memory_order_relaxed);
+    atomic_store_explicit(&s->seq, ++live->seq, memory_order_release);
+}
+
+void live_stats_destroy(LiveStats **live) {
+    if (!live || !*live) {
+        return;
+    }
+    LiveStats *l = *live;
+    munmap(l->seg, sizeof(LSSegment));
+    unlink(l->path);
+    free(l);
+    *live = NULL;
+}
+
+void live_stats_path(char *buff, size_t buff_size, uid_t uid, pid_t pid) {
+    snprintf(buff, buff_size, "%s/%s%lu-%ld", LIVE_STATS_DIR,
+             LIVE_STATS_PREFIX, (unsigned long)uid, (long)pid);
+}
+
+// Consistent snapshot of the page at path, false if there is no valid page
+// or the writer kept it busy throughout
+bool live_stats_read(const char *path, LiveSnapshot *snap) {
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (!fstat(fd, &st) && (size_t)st.st_size == sizeof(LSSegment)) {
+        map = mmap(NULL, sizeof(LSSegment), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    LSSegment *s = map;
+    bool ok = !memcmp(s->magic, LS_MAGIC, sizeof(LS_MAGIC)) &&
+              s->version == LS_VERSION && s->size == sizeof(LSSegment);
+    for (int tries = 0; ok; tries++) {
+        if (tries == LS_READ_TRIES) {
+            ok = false;
+            break;
+        }
+        uint64_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        snap->round = atomic_load_explicit(&s->round, memory_order_relaxed);
+        snap->state = atomic_load_explicit(&s->state, memory_order_relaxed);
+        snap->started_ns =
+            atomic_load_explicit(&s->started_ns, memory_order_relaxed);
+        snap->last_key_ns =
+            atomic_load_explicit(&s->last_key_ns, memory_order_relaxed);
+        snap->cursor = atomic_load_explicit(&s->cursor, memory_order_relaxed);
+        snap->text_len =
+            atomic_load_explicit(&s->text_len, memory_order_relaxed);
+        snap->typed = atomic_load_explicit(&s->typed, memory_order_relaxed);
+        snap->correct =
+            atomic_load_explicit(&s->correct, memory_order_relaxed);
+        snap->wpm_centi =
+            atomic_load_explicit(&s->wpm_centi, memory_order_relaxed);
+        snap->accuracy_centi =
+            atomic_load_explicit(&s->accuracy_centi, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s->seq, memory_order_relaxed) == seq) {
+            break;
+        }
+    }
+    munmap(map, sizeof(LSSegment));
+    return ok;
+}
@@ -0,0 +1,45 @@
+#ifndef LIVE_STATS_H
+#define LIVE_STATS_H
+
+#include "err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define LIVE_STATS_DIR "/dev/shm"
+#define LIVE_STATS_PREFIX "jankey-live-"
+#define LIVE_STATS_PATH_CAP 64
+
+typedef enum LiveState {
+    LIVE_STATE_READY,
+    LIVE_STATE_TYPING,
+    LIVE_STATE_DONE,
+} LiveState;
+
+// The current round as published. Times are CLOCK_MONOTONIC ns, which every
+// process on the host shares, so readers can age a round themselves. wpm and
+// accuracy are hundredths and only set once the round is done.
+typedef struct LiveSnapshot {
+    uint64_t round;
+    uint64_t state;
+    uint64_t started_ns;
+    uint64_t last_key_ns;
+    uint64_t cursor;
+    uint64_t text_len;
+    uint64_t typed;
+    uint64_t correct;
+    uint64_t wpm_centi;
+    uint64_t accuracy_centi;
+} LiveSnapshot;
+
+typedef struct LiveStats LiveStats;
+
+void live_stats_init(Err **err, LiveStats **live);
+void live_stats_publish(LiveStats *live, const LiveSnapshot *snap);
+void live_stats_destroy(LiveStats **live);
+
+void live_stats_path(char *buff, size_t buff_size, uid_t uid, pid_t pid);
+bool live_stats_read(const char *path, LiveSnapshot *snap);
+
+#endif
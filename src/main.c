@@ -1,20 +1,46 @@
 #include "constants.h"
 #include "err.h"
 #include "jankey_type.h"
+#include "race_server.h"
+#include "results_history.h"
+#include "results_stats.h"
+#include <locale.h>
 #include <ncurses.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
 
 void init_ncurses(Err **err);
 void cleanup_ncurses(void);
 void clean_up(Err **err, JankeyType **jt);
+int print_stats(void);
+int serve_race(const char *path);
+int print_usage(const char *prog);
 
-int main() {
+int main(int argc, char *argv[]) {
     Err *err = NULL;
     JankeyType *jt = NULL;
 
-    srand((unsigned int)time(NULL));
+    if (argc == 2 && strcmp(argv[1], "--stats") == 0) {
+        return print_stats();
+    }
+    if (argc == 3 && strcmp(argv[1], "--serve") == 0) {
+        return serve_race(argv[2]);
+    }
+
+    const char *race_path = NULL;
+    const char *record_path = NULL;
+    for (int a = 1; a < argc; a++) {
+        if (a + 1 < argc && !race_path && strcmp(argv[a], "--race") == 0) {
+            race_path = argv[++a];
+        } else if (a + 1 < argc && !record_path &&
+                   strcmp(argv[a], "--record") == 0) {
+            record_path = argv[++a];
+        } else {
+            return print_usage(argv[0]);
+        }
+    }
 
     init_ncurses(&err);
     if (err) {
@@ -28,6 +54,22 @@ int main() {
         return EXIT_FAILURE;
     }
 
+    if (record_path) {
+        jankey_type_record(&err, jt, record_path);
+        if (err) {
+            clean_up(&err, &jt);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (race_path) {
+        jankey_type_join(&err, jt, race_path);
+        if (err) {
+            clean_up(&err, &jt);
+            return EXIT_FAILURE;
+        }
+    }
+
     jankey_type_run(&err, jt, JANKEY_STATE_RUNNING_TEST);
     if (err) {
         clean_up(&err, &jt);
@@ -51,6 +93,8 @@ void clean_up(Err **err, JankeyType **jt) {
 }
 
 void init_ncurses(Err **err) {
+    // UTF-8 text needs the terminal's character set, numbers stay in C
+    setlocale(LC_CTYPE, "");
     initscr();
 
     if (!has_colors()) {
@@ -80,6 +124,12 @@ void init_ncurses(Err **err) {
         *err = ERR_MAKE("Unable to initialise pair");
         return;
     }
+
+    if (init_extended_pair(COLOR_PAIR_YELLOW, COLOR_YELLOW, COLOR_BLACK) ==
+        ERR) {
+        *err = ERR_MAKE("Unable to initialise pair");
+        return;
+    }
 }
 
 void cleanup_ncurses(void) {
@@ -88,3 +138,53 @@ void cleanup_ncurses(void) {
     reset_prog_mode(); // Reset terminal to program mode
     endwin();          // End ncurses mode
 }
+
+int print_stats(void) {
+    Err *err = NULL;
+    ResultsHistory *history = NULL;
+
+    results_history_init(&err, &history, NULL);
+    if (!err) {
+        results_stats_report(&err, history, NULL, stdout);
+    }
+    results_history_destroy(&history);
+
+    if (err) {
+        err_print(err, stderr);
+        err_destroy(&err);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Runs without the terminal UI until interrupted
+int serve_race(const char *path) {
+    Err *err = NULL;
+    RaceServer *server = NULL;
+
+    race_server_init(&err, &server, path, (uint16_t)WORDS_PER_TEST);
+    if (!err) {
+        fprintf(stderr, "Race server listening on %s\n", path);
+        race_server_run(&err, server);
+    }
+    race_server_destroy(&server);
+
+    if (err) {
+        err_print(err, stderr);
+        err_destroy(&err);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int print_usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--stats | --serve SOCKET | "
+            "[--race SOCKET] [--record FILE]]\n",
+            prog);
+    fprintf(stderr, "  --stats    Print statistics over recorded rounds\n");
+    fprintf(stderr, "  --serve    Run a race server on a Unix socket\n");
+    fprintf(stderr, "  --race     Race against others on a race server\n");
+    fprintf(stderr, "  --record   Record the session as an asciicast\n");
+    return EXIT_FAILURE;
+}
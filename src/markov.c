@@ -0,0 +1,396 @@
+#define _POSIX_C_SOURCE 200809L
+#include "markov.h"
+#include "data_dir.h"
+#include "err.h"
+#include "helpers.h"
+#include "rng.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MK_MAGIC "JKMARKV"
+#define MK_VERSION 1u
+#define MK_TOKEN_CAP 64
+#define MK_READ_CAP 65536
+
+// A word bigram model over dictionary ids in CSR form. Row w lists the words
+// seen after w with their cumulative counts, so the next word is a binary
+// search for a random draw below the row total. Row word_count is the
+// sentence start, and a transition to it ends the sentence.
+//
+// The model file is a header followed by the row offsets, next word ids and
+// cumulative counts, all uint32 and used in place through a read-only map.
+// It is rebuilt when the dictionary or corpus changes.
+typedef struct MKHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dict_hash;
+    uint32_t word_count;
+    uint32_t edge_count;
+    int64_t corpus_size;
+    int64_t corpus_mtime;
+} MKHeader;
+
+struct MarkovModel {
+    void *map;
+    size_t map_len;
+    uint32_t word_count;
+    const uint32_t *row_offs;
+    const uint32_t *next;
+    const uint32_t *cum;
+};
+
+bool mk_push(uint64_t **pairs, size_t *count, size_t *cap, uint32_t from,
+             uint32_t to);
+int mk_cmp_u64(const void *a, const void *b);
+bool mk_map(MarkovModel *m, const char *model_path, uint32_t dict_hash,
+            uint32_t word_count, const struct stat *corpus);
+uint32_t mk_rand(Rng *rng);
+
+void markov_build(Err **err, const PerfectHash *lookup, size_t word_count,
+                  uint32_t dict_hash, const char *corpus_path,
+                  const char *model_path) {
+    FILE *s = fopen(corpus_path, "rb");
+    if (!s) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to open corpus %s", corpus_path);
+        return;
+    }
+    struct stat st;
+    if (fstat(fileno(s), &st)) {
+        fclose(s);
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to stat corpus %s", corpus_path);
+        return;
+    }
+
+    char *chunk = malloc(MK_READ_CAP);
+    if (!chunk) {
+        fclose(s);
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate corpus buffer");
+        return;
+    }
+
+    // Tokens are runs of letters, lowercased, with UTF-8 sequences counted
+    // as letters. Sentence punctuation links the previous word to the start
+    // row; anything outside the dictionary breaks the chain without ending
+    // the sentence.
+    uint32_t start = (uint32_t)word_count;
+    uint32_t none = UINT32_MAX;
+    uint32_t prev = start;
+    uint64_t *pairs = NULL;
+    size_t pair_count = 0;
+    size_t pair_cap = 0;
+    char token[MK_TOKEN_CAP];
+    size_t token_len = 0;
+    bool overlong = false;
+    bool ok = true;
+
+    size_t n = 0;
+    while (ok && (n = fread(chunk, 1, MK_READ_CAP, s)) > 0) {
+        for (size_t i = 0; i <= n && ok; i++) {
+            int c = i < n ? (unsigned char)chunk[i] : -1;
+            if (c >= 'A' && c <= 'Z') {
+                c += 'a' - 'A';
+            }
+            if ((c >= 'a' && c <= 'z') || c >= 0x80) {
+                if (token_len < MK_TOKEN_CAP) {
+                    token[token_len++] = (char)c;
+                } else {
+                    overlong = true;
+                }
+                continue;
+            }
+            if (i == n) {
+                // Token may continue in the next chunk
+                break;
+            }
+
+            if (token_len) {
+                uint32_t id = none;
+                if (!overlong) {
+                    perfect_hash_find(lookup, token, token_len, &id);
+                }
+                if (id != none && prev != none) {
+                    ok = mk_push(&pairs, &pair_count, &pair_cap, prev, id);
+                }
+                prev = id;
+                token_len = 0;
+                overlong = false;
+            }
+            if (c == '.' || c == '!' || c == '?') {
+                if (prev != none && prev != start) {
+                    ok = mk_push(&pairs, &pair_count, &pair_cap, prev, start);
+                }
+                prev = start;
+            }
+        }
+    }
+    if (ok && token_len && !overlong && prev != none) {
+        uint32_t id = none;
+        if (perfect_hash_find(lookup, token, token_len, &id)) {
+            ok = mk_push(&pairs, &pair_count, &pair_cap, prev, id);
+        }
+    }
+    bool read_failed = ferror(s);
+    fclose(s);
+    free(chunk);
+    if (!ok || read_failed) {
+        free(pairs);
+        *err = read_failed ? ERR_MAKE_CODE(ERR_IO, "Error reading corpus")
+                           : ERR_MAKE_CODE(ERR_NOMEM,
+                                           "Unable to allocate corpus pairs");
+        return;
+    }
+
+    // Sorting groups rows and repeats, run lengths become the counts
+    qsort(pairs, pair_count, sizeof(*pairs), mk_cmp_u64);
+
+    size_t rows = word_count + 1;
+    uint32_t *row_offs = calloc(rows + 1, sizeof(uint32_t));
+    uint32_t *next = calloc(MAX_N(pair_count, 1), sizeof(uint32_t));
+    uint32_t *cum = calloc(MAX_N(pair_count, 1), sizeof(uint32_t));
+    if (!row_offs || !next || !cum) {
+        free(pairs);
+        free(row_offs);
+        free(next);
+        free(cum);
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate transition table");
+        return;
+    }
+
+    size_t edges = 0;
+    for (size_t i = 0; i < pair_count;) {
+        size_t j = i;
+        while (j < pair_count && pairs[j] == pairs[i]) {
+            j++;
+        }
+        uint32_t from = (uint32_t)(pairs[i] >> 32);
+        bool row_start = !edges || (uint32_t)(pairs[i - 1] >> 32) != from;
+        next[edges] = (uint32_t)pairs[i];
+        cum[edges] = (uint32_t)(j - i) + (row_start ? 0 : cum[edges - 1]);
+        row_offs[from + 1]++;
+        edges++;
+        i = j;
+    }
+    for (size_t r = 0; r < rows; r++) {
+        row_offs[r + 1] += row_offs[r];
+    }
+    free(pairs);
+
+    MKHeader hdr = {
+        .version = MK_VERSION,
+        .dict_hash = dict_hash,
+        .word_count = (uint32_t)word_count,
+        .edge_count = (uint32_t)edges,
+        .corpus_size = (int64_t)st.st_size,
+        .corpus_mtime = (int64_t)st.st_mtime,
+    };
+    memcpy(hdr.magic, MK_MAGIC, sizeof(hdr.magic));
+
+    char tmp_path[DATA_PATH_CAP + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", model_path);
+    FILE *f = fopen(tmp_path, "wb");
+    ok = f && fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+         fwrite(row_offs, sizeof(uint32_t), rows + 1, f) == rows + 1 &&
+         fwrite(next, sizeof(uint32_t), edges, f) == edges &&
+         fwrite(cum, sizeof(uint32_t), edges, f) == edges;
+    if (f) {
+        ok = fclose(f) == 0 && ok;
+    }
+    free(row_offs);
+    free(next);
+    free(cum);
+    if (!ok || rename(tmp_path, model_path)) {
+        remove(tmp_path);
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to write %s", model_path);
+    }
+}
+
+// Map the model, building it first from the corpus if missing or stale
+void markov_init(Err **err, MarkovModel **model,
+                 const PerfectHash *lookup, size_t word_count,
+                 uint32_t dict_hash, const char *corpus_path,
+                 const char *model_path) {
+    MarkovModel *m = ZALLOC(sizeof(*m));
+    if (!m) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for markov model");
+        return;
+    }
+
+    char default_path[DATA_PATH_CAP];
+    if (!model_path) {
+        data_dir_path(err, default_path, sizeof(default_path), "markov.bin");
+        if (*err) {
+            markov_destroy(&m);
+            return;
+        }
+        model_path = default_path;
+    }
+
+    struct stat corpus;
+    if (stat(corpus_path, &corpus)) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to stat corpus %s: %s",
+                             corpus_path, strerror(errno));
+        markov_destroy(&m);
+        return;
+    }
+
+    if (!mk_map(m, model_path, dict_hash, (uint32_t)word_count, &corpus)) {
+        markov_build(err, lookup, word_count, dict_hash, corpus_path,
+                     model_path);
+        if (*err) {
+            markov_destroy(&m);
+            return;
+        }
+        if (!mk_map(m, model_path, dict_hash, (uint32_t)word_count,
+                    &corpus)) {
+            *err = ERR_MAKE_CODE(ERR_IO, "Invalid markov model %s",
+                                 model_path);
+            markov_destroy(&m);
+            return;
+        }
+    }
+
+    *model = m;
+}
+
+// Walk the chain for n words, restarting sentences at dead ends
+void markov_generate(const MarkovModel *m, Rng *rng, size_t n,
+                     uint32_t ids[n]) {
+    uint32_t start = m->word_count;
+    uint32_t state = start;
+    for (size_t i = 0; i < n;) {
+        uint32_t lo = m->row_offs[state];
+        uint32_t hi = m->row_offs[state + 1];
+        if (lo == hi) {
+            if (state == start) {
+                // Empty model, fall back to uniform picks
+                ids[i++] = mk_rand(rng) % m->word_count;
+                continue;
+            }
+            state = start;
+            continue;
+        }
+
+        uint32_t r = mk_rand(rng) % m->cum[hi - 1];
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (m->cum[mid] <= r) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        state = m->next[lo];
+        if (state != start) {
+            ids[i++] = state;
+        }
+    }
+}
+
+void markov_destroy(MarkovModel **model) {
+    if (!model || !*model) {
+        return;
+    }
+
+    MarkovModel *m = *model;
+    if (m->map) {
+        munmap(m->map, m->map_len);
+        m->map = NULL;
+    }
+
+    free(m);
+    m = NULL;
+    *model = NULL;
+}
+
+bool mk_push(uint64_t **pairs, size_t *count, size_t *cap, uint32_t from,
+             uint32_t to) {
+    if (*count == *cap) {
+        size_t new_cap = MAX_N(*cap * 2, 1024);
+        uint64_t *t = realloc(*pairs, new_cap * sizeof(*t));
+        if (!t) {
+            return false;
+        }
+        *pairs = t;
+        *cap = new_cap;
+    }
+    (*pairs)[(*count)++] = (uint64_t)from << 32 | to;
+    return true;
+}
+
+int mk_cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Map and validate a model file, false if it is missing, stale or damaged
+bool mk_map(MarkovModel *m, const char *model_path, uint32_t dict_hash,
+            uint32_t word_count, const struct stat *corpus) {
+    int fd = open(model_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(MKHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const MKHeader *hdr = map;
+    size_t rows = (size_t)word_count + 1;
+    bool valid =
+        !memcmp(hdr->magic, MK_MAGIC, sizeof(hdr->magic)) &&
+        hdr->version == MK_VERSION && hdr->dict_hash == dict_hash &&
+        hdr->word_count == word_count && word_count &&
+        hdr->corpus_size == (int64_t)corpus->st_size &&
+        hdr->corpus_mtime == (int64_t)corpus->st_mtime &&
+        len == sizeof(*hdr) + (rows + 1 + 2 * (size_t)hdr->edge_count) *
+                                  sizeof(uint32_t);
+
+    const uint32_t *row_offs = (const uint32_t *)(hdr + 1);
+    const uint32_t *next = row_offs + rows + 1;
+    const uint32_t *cum = next + (valid ? hdr->edge_count : 0);
+
+    // Bounds are checked once here so generation can trust the table. The
+    // start row may not lead to itself or a walk could spin without output.
+    valid = valid && row_offs[0] == 0 && row_offs[rows] == hdr->edge_count;
+    for (size_t r = 0; valid && r < rows; r++) {
+        valid = row_offs[r] <= row_offs[r + 1];
+        for (uint32_t k = valid ? row_offs[r] : 0;
+             valid && k < row_offs[r + 1]; k++) {
+            valid = next[k] <= word_count &&
+                    !(r == word_count && next[k] == word_count) &&
+                    cum[k] > (k == row_offs[r] ? 0 : cum[k - 1]);
+        }
+    }
+    if (!valid) {
+        munmap(map, len);
+        return false;
+    }
+
+    m->map = map;
+    m->map_len = len;
+    m->word_count = word_count;
+    m->row_offs = row_offs;
+    m->next = next;
+    m->cum = cum;
+    return true;
+}
+
+// High bits of the caller's generator, the model itself is never written
+uint32_t mk_rand(Rng *rng) { return (uint32_t)(rng_next(rng) >> 32); }
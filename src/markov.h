@@ -0,0 +1,23 @@
+#ifndef MARKOV_H
+#define MARKOV_H
+
+#include "err.h"
+#include "perfect_hash.h"
+#include "rng.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct MarkovModel MarkovModel;
+
+void markov_build(Err **err, const PerfectHash *lookup, size_t word_count,
+                  uint32_t dict_hash, const char *corpus_path,
+                  const char *model_path);
+void markov_init(Err **err, MarkovModel **model,
+                 const PerfectHash *lookup, size_t word_count,
+                 uint32_t dict_hash, const char *corpus_path,
+                 const char *model_path);
+void markov_generate(const MarkovModel *model, Rng *rng, size_t n,
+                     uint32_t ids[n]);
+void markov_destroy(MarkovModel **model);
+
+#endif
@@ -0,0 +1,607 @@
+#include "ngram_index.h"
+#include "err.h"
+#include "helpers.h"
+#include "parallel.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bigrams and trigrams of ASCII characters within a word, packed as
+// len << 21 | c0 << 14 | c1 << 7 | c2
+#define NI_MIN_N 2
+#define NI_MAX_N 3
+#define NI_SHARD_MIN_WORDS 2048
+
+// Each n-gram maps to the sorted ids of the words containing it. Sparse lists
+// are stored as varint deltas, lists where that would take more room than a
+// bitset over the whole dictionary are stored as the bitset. Postings are
+// sorted by key for binary search. None of it changes once built, so an index
+// can also be used in place from an image.
+typedef struct NiPosting {
+    uint32_t key;
+    uint32_t count;
+    uint32_t off;
+    bool is_bitset;
+} NiPosting;
+
+struct NgramIndex {
+    size_t word_count;
+    size_t bitset_words;
+    size_t posting_count;
+    size_t varint_len;
+    size_t bitset_len;
+    NiPosting *postings;
+    unsigned char *varints;
+    uint64_t *bitsets;
+    bool mapped;
+};
+
+// An index saved for use in place: this header, then the postings, the
+// varints and the bitsets, each 8 byte aligned
+typedef struct NIImage {
+    uint64_t word_count;
+    uint64_t posting_count;
+    uint64_t varint_len;
+    uint64_t bitset_len;
+} NIImage;
+
+// Walks one posting list in id order, whichever way it is stored
+typedef struct NiCursor {
+    uint32_t left;
+    uint32_t id;
+    const unsigned char *v;
+    const uint64_t *set;
+    size_t w;
+    uint64_t bits;
+} NiCursor;
+
+typedef struct NIBuild {
+    char *const *words;
+    size_t word_count;
+    uint64_t *pairs[PARALLEL_MAX_THREADS];
+    size_t counts[PARALLEL_MAX_THREADS];
+} NIBuild;
+
+void ni_build_shard(void *ctx, size_t shard, size_t shard_count);
+uint32_t ni_key(const char *s, size_t n);
+int ni_cmp_u64(const void *a, const void *b);
+size_t ni_varint_len(uint32_t v);
+size_t ni_put_varint(unsigned char *p, uint32_t v);
+size_t ni_align8(size_t n);
+const NiPosting *ni_find(NgramIndex *ni, const char *ngram);
+void ni_cursor(NgramIndex *ni, const NiPosting *p, NiCursor *c);
+bool ni_next(NiCursor *c, uint32_t *id);
+size_t ni_union(Err **err, NgramIndex *ni, const char *const *ngrams,
+                size_t ngram_count, uint32_t **ids);
+size_t ni_intersect(Err **err, NgramIndex *ni, const char *const *ngrams,
+                    size_t ngram_count, uint32_t **ids);
+
+void ngram_index_init(Err **err, NgramIndex **index, char *const *words,
+                      size_t word_count) {
+    NgramIndex *ni = ZALLOC(sizeof(*ni));
+    if (!ni) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for n-gram index");
+        return;
+    }
+    ni->word_count = word_count;
+    ni->bitset_words = (word_count + 63) / 64;
+
+    // Shards gather and sort (key, word id) pairs for their own words
+    NIBuild build = {.words = words, .word_count = word_count};
+    size_t shard_count = parallel_shards(word_count, NI_SHARD_MIN_WORDS);
+    parallel_run(shard_count, ni_build_shard, &build);
+
+    size_t pair_count = 0;
+    bool failed = false;
+    for (size_t shard = 0; shard < shard_count; shard++) {
+        pair_count += build.counts[shard];
+        failed = failed || !build.pairs[shard];
+    }
+    uint64_t *pairs = shard_count == 1
+                          ? build.pairs[0]
+                          : calloc(MAX_N(pair_count, 1), sizeof(*pairs));
+    if (failed || !pairs) {
+        for (size_t shard = 0; shard < shard_count; shard++) {
+            free(build.pairs[shard]);
+        }
+        if (shard_count > 1) {
+            free(pairs);
+        }
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate n-gram pairs");
+        ngram_index_destroy(&ni);
+        return;
+    }
+
+    // Merge the sorted runs. Word ranges are disjoint, so whole pairs never
+    // tie and each list comes out in id order.
+    if (shard_count > 1) {
+        size_t pos[PARALLEL_MAX_THREADS] = {0};
+        for (size_t i = 0; i < pair_count; i++) {
+            size_t best = shard_count;
+            for (size_t shard = 0; shard < shard_count; shard++) {
+                if (pos[shard] < build.counts[shard] &&
+                    (best == shard_count ||
+                     build.pairs[shard][pos[shard]] <
+                         build.pairs[best][pos[best]])) {
+                    best = shard;
+                }
+            }
+            pairs[i] = build.pairs[best][pos[best]++];
+        }
+        for (size_t shard = 0; shard < shard_count; shard++) {
+            free(build.pairs[shard]);
+        }
+    }
+
+    // Size each list in both encodings to pick the smaller one
+    size_t bitset_bytes = ni->bitset_words * sizeof(uint64_t);
+    size_t varint_total = 0;
+    size_t bitset_total = 0;
+    for (size_t i = 0; i < pair_count;) {
+        uint32_t key = (uint32_t)(pairs[i] >> 32);
+        size_t len = 0;
+        uint32_t prev = 0;
+        size_t j = i;
+        for (; j < pair_count && (uint32_t)(pairs[j] >> 32) == key; j++) {
+            uint32_t id = (uint32_t)pairs[j];
+            len += ni_varint_len(id - prev);
+            prev = id;
+        }
+        ni->posting_count++;
+        if (len > bitset_bytes) {
+            bitset_total += ni->bitset_words;
+        } else {
+            varint_total += len;
+        }
+        i = j;
+    }
+
+    ni->varint_len = varint_total;
+    ni->bitset_len = bitset_total;
+    ni->postings = calloc(MAX_N(ni->posting_count, 1), sizeof(NiPosting));
+    ni->varints = calloc(MAX_N(varint_total, 1), sizeof(unsigned char));
+    ni->bitsets = calloc(MAX_N(bitset_total, 1), sizeof(uint64_t));
+    if (!ni->postings || !ni->varints || !ni->bitsets) {
+        free(pairs);
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate n-gram postings");
+        ngram_index_destroy(&ni);
+        return;
+    }
+
+    size_t p = 0;
+    size_t varint_off = 0;
+    size_t bitset_off = 0;
+    for (size_t i = 0; i < pair_count;) {
+        uint32_t key = (uint32_t)(pairs[i] >> 32);
+        size_t len = 0;
+        uint32_t prev = 0;
+        size_t j = i;
+        for (; j < pair_count && (uint32_t)(pairs[j] >> 32) == key; j++) {
+            uint32_t id = (uint32_t)pairs[j];
+            len += ni_varint_len(id - prev);
+            prev = id;
+        }
+
+        NiPosting *post = &ni->postings[p++];
+        post->key = key;
+        post->count = (uint32_t)(j - i);
+        post->is_bitset = len > bitset_bytes;
+        if (post->is_bitset) {
+            post->off = (uint32_t)bitset_off;
+            uint64_t *set = &ni->bitsets[bitset_off];
+            for (size_t k = i; k < j; k++) {
+                uint32_t id = (uint32_t)pairs[k];
+                set[id / 64] |= (uint64_t)1 << (id % 64);
+            }
+            bitset_off += ni->bitset_words;
+        } else {
+            post->off = (uint32_t)varint_off;
+            prev = 0;
+            for (size_t k = i; k < j; k++) {
+                uint32_t id = (uint32_t)pairs[k];
+                unsigned char *v = &ni->varints[varint_off];
+                varint_off += ni_put_varint(v, id - prev);
+                prev = id;
+            }
+        }
+        i = j;
+    }
+    free(pairs);
+
+    *index = ni;
+}
+
+// Number of words containing ngram
+size_t ngram_index_count(NgramIndex *ni, const char *ngram) {
+    const NiPosting *p = ni_find(ni, ngram);
+    return p ? p->count : 0;
+}
+
+// Ids of the words containing any (union) or all (intersect) of ngrams,
+// written in ascending order to a newly allocated *ids owned by the caller.
+// Sorted lists are merged or intersected directly, so the work follows the
+// lists rather than the dictionary. Only a union with a dense list, whose
+// result is dense anyway, goes through a bitset.
+size_t ngram_index_match(Err **err, NgramIndex *ni, const char *const *ngrams,
+                         size_t ngram_count, NgramOp op, uint32_t **ids) {
+    *ids = NULL;
+    if (*err || !ngram_count) {
+        return 0;
+    }
+    return op == NGRAM_OP_UNION
+               ? ni_union(err, ni, ngrams, ngram_count, ids)
+               : ni_intersect(err, ni, ngrams, ngram_count, ids);
+}
+
+// Bytes ngram_index_writeimage needs
+size_t ngram_index_imagelen(const NgramIndex *ni) {
+    return sizeof(NIImage) +
+           ni_align8(ni->posting_count * sizeof(NiPosting)) +
+           ni_align8(ni->varint_len) + ni->bitset_len * sizeof(uint64_t);
+}
+
+void ngram_index_writeimage(const NgramIndex *ni, void *image) {
+    NIImage hdr = {
+        .word_count = ni->word_count,
+        .posting_count = ni->posting_count,
+        .varint_len = ni->varint_len,
+        .bitset_len = ni->bitset_len,
+    };
+    char *p = image;
+    memset(p, 0, ngram_index_imagelen(ni));
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    memcpy(p, ni->postings, ni->posting_count * sizeof(NiPosting));
+    p += ni_align8(ni->posting_count * sizeof(NiPosting));
+    memcpy(p, ni->varints, ni->varint_len);
+    p += ni_align8(ni->varint_len);
+    memcpy(p, ni->bitsets, ni->bitset_len * sizeof(uint64_t));
+}
+
+// Use a written image in place for the same words. False if its sections do
+// not add up to len; the postings are trusted as the image's owner wrote them.
+bool ngram_index_mapimage(Err **err, NgramIndex **index, size_t word_count,
+                          void *image, size_t len) {
+    NIImage hdr;
+    if (len < sizeof(hdr)) {
+        return false;
+    }
+    memcpy(&hdr, image, sizeof(hdr));
+    if (hdr.word_count != word_count || hdr.posting_count > len ||
+        hdr.varint_len > len || hdr.bitset_len > len) {
+        return false;
+    }
+
+    NgramIndex *ni = ZALLOC(sizeof(*ni));
+    if (!ni) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for n-gram index");
+        return false;
+    }
+    ni->mapped = true;
+    ni->word_count = word_count;
+    ni->bitset_words = (word_count + 63) / 64;
+    ni->posting_count = (size_t)hdr.posting_count;
+    ni->varint_len = (size_t)hdr.varint_len;
+    ni->bitset_len = (size_t)hdr.bitset_len;
+    if (ngram_index_imagelen(ni) != len) {
+        ngram_index_destroy(&ni);
+        return false;
+    }
+
+    char *p = (char *)image + sizeof(hdr);
+    ni->postings = (void *)p;
+    p += ni_align8(ni->posting_count * sizeof(NiPosting));
+    ni->varints = (void *)p;
+    p += ni_align8(ni->varint_len);
+    ni->bitsets = (void *)p;
+
+    *index = ni;
+    return true;
+}
+
+void ngram_index_destroy(NgramIndex **index) {
+    if (!index || !*index) {
+        return;
+    }
+
+    NgramIndex *ni = *index;
+    if (!ni->mapped) {
+        free(ni->postings);
+        free(ni->varints);
+        free(ni->bitsets);
+    }
+
+    free(ni);
+    ni = NULL;
+    *index = NULL;
+}
+
+// Sorted, deduplicated pairs of the shard's words, NULL pairs on failure
+void ni_build_shard(void *ctx, size_t shard, size_t shard_count) {
+    NIBuild *build = ctx;
+    size_t start = 0;
+    size_t end = 0;
+    parallel_range(build->word_count, shard, shard_count, &start, &end);
+
+    size_t cap = 0;
+    for (size_t i = start; i < end; i++) {
+        cap += strlen(build->words[i]) * (NI_MAX_N - NI_MIN_N + 1);
+    }
+    uint64_t *pairs = calloc(MAX_N(cap, 1), sizeof(*pairs));
+    if (!pairs) {
+        return;
+    }
+
+    size_t count = 0;
+    for (size_t i = start; i < end; i++) {
+        const char *w = build->words[i];
+        size_t len = strlen(w);
+        for (size_t n = NI_MIN_N; n <= NI_MAX_N; n++) {
+            for (size_t k = 0; k + n <= len; k++) {
+                uint32_t key = ni_key(&w[k], n);
+                if (key) {
+                    pairs[count++] = (uint64_t)key << 32 | i;
+                }
+            }
+        }
+    }
+
+    // Sorting brings each posting list together in id order, with repeats
+    // within a word next to each other
+    qsort(pairs, count, sizeof(*pairs), ni_cmp_u64);
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!unique || pairs[i] != pairs[unique - 1]) {
+            pairs[unique++] = pairs[i];
+        }
+    }
+
+    build->pairs[shard] = pairs;
+    build->counts[shard] = unique;
+}
+
+// 0 for n-grams outside the indexed sizes or character range
+uint32_t ni_key(const char *s, size_t n) {
+    if (n < NI_MIN_N || n > NI_MAX_N) {
+        return 0;
+    }
+    uint32_t key = (uint32_t)n << 21;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (!c || c >= 0x80) {
+            return 0;
+        }
+        key |= (uint32_t)c << (14 - 7 * i);
+    }
+    return key;
+}
+
+int ni_cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+size_t ni_varint_len(uint32_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+size_t ni_put_varint(unsigned char *p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+const NiPosting *ni_find(NgramIndex *ni, const char *ngram) {
+    uint32_t key = ni_key(ngram, strlen(ngram));
+    size_t lo = 0;
+    size_t hi = ni->posting_count;
+    while (key && lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ni->postings[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (!key || lo == ni->posting_count || ni->postings[lo].key != key) {
+        return NULL;
+    }
+    return &ni->postings[lo];
+}
+
+void ni_cursor(NgramIndex *ni, const NiPosting *p, NiCursor *c) {
+    *c = (NiCursor){.left = p->count};
+    if (p->is_bitset) {
+        c->set = &ni->bitsets[p->off];
+        c->bits = c->set[0];
+    } else {
+        c->v = &ni->varints[p->off];
+    }
+}
+
+// Next id of the list in ascending order, false once it is exhausted
+bool ni_next(NiCursor *c, uint32_t *id) {
+    if (!c->left) {
+        return false;
+    }
+    c->left--;
+
+    if (c->set) {
+        while (!c->bits) {
+            c->bits = c->set[++c->w];
+        }
+        *id = (uint32_t)(c->w * 64 + (size_t)__builtin_ctzll(c->bits));
+        c->bits &= c->bits - 1;
+        return true;
+    }
+
+    uint32_t delta = 0;
+    unsigned shift = 0;
+    do {
+        delta |= (uint32_t)(*c->v & 0x7f) << shift;
+        shift += 7;
+    } while (*c->v++ & 0x80);
+    c->id += delta;
+    *id = c->id;
+    return true;
+}
+
+// Sparse lists are merged pairwise into the result. A dense list means a
+// dense result, so those are ORed into a bitset over the dictionary.
+size_t ni_union(Err **err, NgramIndex *ni, const char *const *ngrams,
+                size_t ngram_count, uint32_t **ids) {
+    size_t total = 0;
+    bool dense = false;
+    for (size_t i = 0; i < ngram_count; i++) {
+        const NiPosting *p = ni_find(ni, ngrams[i]);
+        if (p) {
+            total += p->count;
+            dense = dense || p->is_bitset;
+        }
+    }
+    if (!total) {
+        return 0;
+    }
+
+    uint32_t *out = calloc(total, sizeof(*out));
+    uint32_t *tmp = dense ? NULL : calloc(total, sizeof(*tmp));
+    uint64_t *set = dense ? calloc(ni->bitset_words, sizeof(*set)) : NULL;
+    if (!out || (!tmp && !set)) {
+        free(out);
+        free(tmp);
+        free(set);
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate n-gram match");
+        return 0;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < ngram_count; i++) {
+        const NiPosting *p = ni_find(ni, ngrams[i]);
+        if (!p) {
+            continue;
+        }
+        NiCursor c;
+        ni_cursor(ni, p, &c);
+        uint32_t id = 0;
+        if (dense) {
+            while (ni_next(&c, &id)) {
+                set[id / 64] |= (uint64_t)1 << (id % 64);
+            }
+            continue;
+        }
+
+        size_t a = 0;
+        size_t n = 0;
+        bool more = ni_next(&c, &id);
+        while (a < count || more) {
+            if (!more || (a < count && out[a] < id)) {
+                tmp[n++] = out[a++];
+            } else {
+                if (a < count && out[a] == id) {
+                    a++;
+                }
+                tmp[n++] = id;
+                more = ni_next(&c, &id);
+            }
+        }
+        uint32_t *t = out;
+        out = tmp;
+        tmp = t;
+        count = n;
+    }
+
+    if (dense) {
+        for (size_t w = 0; w < ni->bitset_words; w++) {
+            for (uint64_t bits = set[w]; bits; bits &= bits - 1) {
+                out[count++] =
+                    (uint32_t)(w * 64 + (size_t)__builtin_ctzll(bits));
+            }
+        }
+    }
+    free(tmp);
+    free(set);
+
+    uint32_t *t = realloc(out, count * sizeof(*out));
+    *ids = t ? t : out;
+    return count;
+}
+
+// The shortest list seeds the candidates, each other list then filters them
+// in place: a dense list by testing its bits, a sparse one by merging.
+size_t ni_intersect(Err **err, NgramIndex *ni, const char *const *ngrams,
+                    size_t ngram_count, uint32_t **ids) {
+    const NiPosting *first = NULL;
+    for (size_t i = 0; i < ngram_count; i++) {
+        const NiPosting *p = ni_find(ni, ngrams[i]);
+        if (!p) {
+            return 0;
+        }
+        if (!first || p->count < first->count) {
+            first = p;
+        }
+    }
+
+    uint32_t *out = calloc(first->count, sizeof(*out));
+    if (!out) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate n-gram match");
+        return 0;
+    }
+    NiCursor c;
+    ni_cursor(ni, first, &c);
+    size_t count = 0;
+    while (ni_next(&c, &out[count])) {
+        count++;
+    }
+
+    for (size_t i = 0; i < ngram_count && count; i++) {
+        const NiPosting *p = ni_find(ni, ngrams[i]);
+        if (p == first) {
+            continue;
+        }
+
+        size_t kept = 0;
+        if (p->is_bitset) {
+            const uint64_t *set = &ni->bitsets[p->off];
+            for (size_t k = 0; k < count; k++) {
+                if (set[out[k] / 64] >> (out[k] % 64) & 1) {
+                    out[kept++] = out[k];
+                }
+            }
+        } else {
+            ni_cursor(ni, p, &c);
+            uint32_t id = 0;
+            bool more = ni_next(&c, &id);
+            for (size_t k = 0; k < count && more; k++) {
+                while (more && id < out[k]) {
+                    more = ni_next(&c, &id);
+                }
+                if (more && id == out[k]) {
+                    out[kept++] = out[k];
+                }
+            }
+        }
+        count = kept;
+    }
+
+    if (!count) {
+        free(out);
+        return 0;
+    }
+    uint32_t *t = realloc(out, count * sizeof(*out));
+    *ids = t ? t : out;
+    return count;
+}
+
+size_t ni_align8(size_t n) { return (n + 7) & ~(size_t)7; }
@@ -0,0 +1,28 @@
+#ifndef NGRAM_INDEX_H
+#define NGRAM_INDEX_H
+
+#include "err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct NgramIndex NgramIndex;
+
+typedef enum NgramOp {
+    NGRAM_OP_UNION,
+    NGRAM_OP_INTERSECT,
+} NgramOp;
+
+void ngram_index_init(Err **err, NgramIndex **index, char *const *words,
+                      size_t word_count);
+size_t ngram_index_count(NgramIndex *index, const char *ngram);
+size_t ngram_index_match(Err **err, NgramIndex *index,
+                         const char *const *ngrams, size_t ngram_count,
+                         NgramOp op, uint32_t **ids);
+size_t ngram_index_imagelen(const NgramIndex *index);
+void ngram_index_writeimage(const NgramIndex *index, void *image);
+bool ngram_index_mapimage(Err **err, NgramIndex **index, size_t word_count,
+                          void *image, size_t len);
+void ngram_index_destroy(NgramIndex **index);
+
+#endif
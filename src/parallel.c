@@ -0,0 +1,60 @@
+#include "parallel.h"
+#include "helpers.h"
+#include <stdbool.h>
+#include <threads.h>
+#include <unistd.h>
+
+typedef struct PShard {
+    ParallelFn fn;
+    void *ctx;
+    size_t shard;
+    size_t shard_count;
+} PShard;
+
+int p_shard_main(void *arg);
+
+// Shards for item_count items, at most one per core and never so many that
+// a shard is left with fewer than min_items_per_shard
+size_t parallel_shards(size_t item_count, size_t min_items_per_shard) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max = cores > 0 ? (size_t)cores : 1;
+    max = MIN_N(max, PARALLEL_MAX_THREADS);
+    size_t by_size = item_count / MAX_N(min_items_per_shard, 1);
+    return MAX_N(MIN_N(max, by_size), 1);
+}
+
+// Run fn for every shard and wait for all of them. Shard 0 runs on the
+// calling thread; if a thread cannot be started its shard runs there too.
+void parallel_run(size_t shard_count, ParallelFn fn, void *ctx) {
+    PShard shards[PARALLEL_MAX_THREADS];
+    thrd_t threads[PARALLEL_MAX_THREADS];
+    bool started[PARALLEL_MAX_THREADS] = {0};
+    shard_count = MAX_N(MIN_N(shard_count, PARALLEL_MAX_THREADS), 1);
+
+    for (size_t i = 1; i < shard_count; i++) {
+        shards[i] = (PShard){fn, ctx, i, shard_count};
+        started[i] = thrd_create(&threads[i], p_shard_main, &shards[i]) ==
+                     thrd_success;
+    }
+    fn(ctx, 0, shard_count);
+    for (size_t i = 1; i < shard_count; i++) {
+        if (started[i]) {
+            thrd_join(threads[i], NULL);
+        } else {
+            fn(ctx, i, shard_count);
+        }
+    }
+}
+
+// Contiguous slice [start, end) of item_count items for a shard
+void parallel_range(size_t item_count, size_t shard, size_t shard_count,
+                    size_t *start, size_t *end) {
+    *start = item_count * shard / shard_count;
+    *end = item_count * (shard + 1) / shard_count;
+}
+
+int p_shard_main(void *arg) {
+    PShard *s = arg;
+    s->fn(s->ctx, s->shard, s->shard_count);
+    return 0;
+}
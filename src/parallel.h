@@ -0,0 +1,15 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+#define PARALLEL_MAX_THREADS 8
+
+typedef void (*ParallelFn)(void *ctx, size_t shard, size_t shard_count);
+
+size_t parallel_shards(size_t item_count, size_t min_items_per_shard);
+void parallel_run(size_t shard_count, ParallelFn fn, void *ctx);
+void parallel_range(size_t item_count, size_t shard, size_t shard_count,
+                    size_t *start, size_t *end);
+
+#endif
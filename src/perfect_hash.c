@@ -0,0 +1,362 @@
+#include "perfect_hash.h"
+#include "err.h"
+#include "helpers.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PH_MAX_LEVELS 32
+#define PH_GAMMA 2
+#define PH_RANK_WORDS 8
+
+// BBHash style minimal perfect hash. Each level is a bitset of GAMMA times
+// the keys still unplaced; a key whose slot no other key hits sets its bit
+// and the rest fall through to the next level. A key's index is the rank of
+// its bit across all levels, kept in a sampled rank table every
+// PH_RANK_WORDS words. That costs about three bits per key, plus the table
+// mapping indices back to word ids so hits can be verified against the word.
+struct PerfectHash {
+    char *const *words;
+    size_t word_count;
+    uint64_t *bits;
+    size_t bit_words;
+    uint32_t *ranks;
+    uint32_t *ids;
+    size_t level_count;
+    size_t level_off[PH_MAX_LEVELS];
+    size_t level_size[PH_MAX_LEVELS];
+    bool mapped;
+};
+
+// A hash saved for use in place: this header, then the bits, the rank
+// samples and the id table, each 8 byte aligned
+typedef struct PHImage {
+    uint64_t word_count;
+    uint64_t bit_words;
+    uint64_t level_count;
+    uint64_t level_off[PH_MAX_LEVELS];
+    uint64_t level_size[PH_MAX_LEVELS];
+} PHImage;
+
+typedef struct PHKey {
+    uint64_t h;
+    uint32_t id;
+} PHKey;
+
+uint64_t ph_hash(const char *s, size_t len);
+size_t ph_slot(uint64_t h, size_t level, size_t size);
+int ph_cmp_key(const void *a, const void *b);
+size_t ph_dedupe(Err **err, PHKey *keys, size_t n, char *const *words);
+bool ph_index(const PerfectHash *ph, uint64_t h, size_t *index);
+size_t ph_align8(size_t n);
+
+void perfect_hash_init(Err **err, PerfectHash **hash, char *const *words,
+                       size_t word_count) {
+    PerfectHash *ph = ZALLOC(sizeof(*ph));
+    PHKey *keys = calloc(MAX_N(word_count, 1), sizeof(*keys));
+    if (!ph || !keys) {
+        free(keys);
+        free(ph);
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate perfect hash");
+        return;
+    }
+    ph->words = words;
+    ph->word_count = word_count;
+
+    for (size_t i = 0; i < word_count; i++) {
+        keys[i] = (PHKey){ph_hash(words[i], strlen(words[i])), (uint32_t)i};
+    }
+    // Place keys level by level, keeping only the collided ones each time
+    size_t remaining = word_count;
+    while (remaining && ph->level_count < PH_MAX_LEVELS) {
+        size_t level = ph->level_count++;
+        size_t size = MAX_N((remaining * PH_GAMMA + 63) / 64, (size_t)1) * 64;
+        size_t words_needed = ph->bit_words + size / 64 * 2;
+        uint64_t *t = realloc(ph->bits, words_needed * sizeof(*t));
+        if (!t) {
+            free(keys);
+            perfect_hash_destroy(&ph);
+            *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to grow perfect hash");
+            return;
+        }
+        ph->bits = t;
+
+        // Scratch collision bitset rides after the level's own bits
+        uint64_t *seen = &ph->bits[ph->bit_words];
+        uint64_t *collide = seen + size / 64;
+        memset(seen, 0, size / 64 * 2 * sizeof(*seen));
+        for (size_t i = 0; i < remaining; i++) {
+            size_t pos = ph_slot(keys[i].h, level, size);
+            uint64_t bit = (uint64_t)1 << (pos % 64);
+            collide[pos / 64] |= seen[pos / 64] & bit;
+            seen[pos / 64] |= bit;
+        }
+        for (size_t w = 0; w < size / 64; w++) {
+            seen[w] &= ~collide[w];
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < remaining; i++) {
+            size_t pos = ph_slot(keys[i].h, level, size);
+            if (collide[pos / 64] >> (pos % 64) & 1) {
+                keys[kept++] = keys[i];
+            }
+        }
+        ph->level_off[level] = ph->bit_words * 64;
+        ph->level_size[level] = size;
+        ph->bit_words += size / 64;
+        if (kept == remaining) {
+            // Keys with equal hashes collide on every level, so a level
+            // placing nothing is the cue to drop repeated words
+            kept = ph_dedupe(err, keys, kept, words);
+            if (*err) {
+                free(keys);
+                perfect_hash_destroy(&ph);
+                return;
+            }
+        }
+        remaining = kept;
+    }
+    if (remaining) {
+        free(keys);
+        perfect_hash_destroy(&ph);
+        *err = ERR_MAKE("Unable to place %zu words in perfect hash", remaining);
+        return;
+    }
+
+    size_t rank_count = ph->bit_words / PH_RANK_WORDS + 1;
+    ph->ranks = calloc(rank_count, sizeof(uint32_t));
+    ph->ids = calloc(MAX_N(word_count, 1), sizeof(uint32_t));
+    if (!ph->ranks || !ph->ids) {
+        free(keys);
+        perfect_hash_destroy(&ph);
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate perfect hash");
+        return;
+    }
+    uint32_t rank = 0;
+    for (size_t w = 0; w < ph->bit_words; w++) {
+        if (w % PH_RANK_WORDS == 0) {
+            ph->ranks[w / PH_RANK_WORDS] = rank;
+        }
+        rank += (uint32_t)__builtin_popcountll(ph->bits[w]);
+    }
+
+    // Keys were consumed by placement, so hash the words again for the ids.
+    // Walking backwards leaves repeated words with their first id.
+    for (size_t i = word_count; i-- > 0;) {
+        size_t index = 0;
+        if (ph_index(ph, ph_hash(words[i], strlen(words[i])), &index)) {
+            ph->ids[index] = (uint32_t)i;
+        }
+    }
+    free(keys);
+
+    *hash = ph;
+}
+
+// Id of word, verified against the stored string
+bool perfect_hash_find(const PerfectHash *ph, const char *word, size_t len,
+                       uint32_t *id) {
+    size_t index = 0;
+    if (!ph_index(ph, ph_hash(word, len), &index)) {
+        return false;
+    }
+    uint32_t i = ph->ids[index];
+    const char *w = ph->words[i];
+    if (strncmp(w, word, len) || w[len] != '\0') {
+        return false;
+    }
+    *id = i;
+    return true;
+}
+
+// Size of the hash function itself, excluding the id table
+size_t perfect_hash_bits(const PerfectHash *ph) {
+    size_t rank_count = ph->bit_words / PH_RANK_WORDS + 1;
+    return ph->bit_words * 64 + rank_count * 32;
+}
+
+// Bytes perfect_hash_writeimage needs
+size_t perfect_hash_imagelen(const PerfectHash *ph) {
+    size_t rank_count = ph->bit_words / PH_RANK_WORDS + 1;
+    return sizeof(PHImage) + ph->bit_words * sizeof(uint64_t) +
+           ph_align8(rank_count * sizeof(uint32_t)) +
+           ph_align8(ph->word_count * sizeof(uint32_t));
+}
+
+void perfect_hash_writeimage(const PerfectHash *ph, void *image) {
+    PHImage hdr = {
+        .word_count = ph->word_count,
+        .bit_words = ph->bit_words,
+        .level_count = ph->level_count,
+    };
+    for (size_t l = 0; l < ph->level_count; l++) {
+        hdr.level_off[l] = ph->level_off[l];
+        hdr.level_size[l] = ph->level_size[l];
+    }
+    size_t rank_count = ph->bit_words / PH_RANK_WORDS + 1;
+    char *p = image;
+    memset(p, 0, perfect_hash_imagelen(ph));
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    memcpy(p, ph->bits, ph->bit_words * sizeof(uint64_t));
+    p += ph->bit_words * sizeof(uint64_t);
+    memcpy(p, ph->ranks, rank_count * sizeof(uint32_t));
+    p += ph_align8(rank_count * sizeof(uint32_t));
+    memcpy(p, ph->ids, ph->word_count * sizeof(uint32_t));
+}
+
+// Use a written image in place over the same words. False if it does not
+// fit them; the levels, ranks and ids are checked so lookups stay in bounds.
+bool perfect_hash_mapimage(Err **err, PerfectHash **hash, char *const *words,
+                           size_t word_count, void *image, size_t len) {
+    PHImage hdr;
+    if (len < sizeof(hdr)) {
+        return false;
+    }
+    memcpy(&hdr, image, sizeof(hdr));
+    if (hdr.word_count != word_count || hdr.level_count > PH_MAX_LEVELS ||
+        hdr.bit_words > len / sizeof(uint64_t)) {
+        return false;
+    }
+
+    PerfectHash *ph = ZALLOC(sizeof(*ph));
+    if (!ph) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate perfect hash");
+        return false;
+    }
+    ph->mapped = true;
+    ph->words = words;
+    ph->word_count = word_count;
+    ph->bit_words = (size_t)hdr.bit_words;
+    ph->level_count = (size_t)hdr.level_count;
+    if (perfect_hash_imagelen(ph) != len) {
+        perfect_hash_destroy(&ph);
+        return false;
+    }
+
+    size_t rank_count = ph->bit_words / PH_RANK_WORDS + 1;
+    char *p = image;
+    ph->bits = (void *)(p + sizeof(hdr));
+    ph->ranks = (void *)(p + sizeof(hdr) + ph->bit_words * sizeof(uint64_t));
+    ph->ids = (void *)((char *)(void *)ph->ranks +
+                       ph_align8(rank_count * sizeof(uint32_t)));
+
+    bool valid = true;
+    for (size_t l = 0; valid && l < ph->level_count; l++) {
+        ph->level_off[l] = (size_t)hdr.level_off[l];
+        ph->level_size[l] = (size_t)hdr.level_size[l];
+        valid = ph->level_size[l] && ph->level_size[l] % 64 == 0 &&
+                ph->level_size[l] <= UINT32_MAX &&
+                ph->level_off[l] <= ph->bit_words * 64 &&
+                ph->level_size[l] <= ph->bit_words * 64 - ph->level_off[l];
+    }
+    uint64_t rank = 0;
+    for (size_t w = 0; valid && w < ph->bit_words; w++) {
+        valid = w % PH_RANK_WORDS || ph->ranks[w / PH_RANK_WORDS] == rank;
+        rank += (uint64_t)__builtin_popcountll(ph->bits[w]);
+    }
+    valid = valid && rank <= word_count;
+    for (size_t i = 0; valid && i < rank; i++) {
+        valid = ph->ids[i] < word_count;
+    }
+    if (!valid) {
+        perfect_hash_destroy(&ph);
+        return false;
+    }
+
+    *hash = ph;
+    return true;
+}
+
+void perfect_hash_destroy(PerfectHash **hash) {
+    if (!hash || !*hash) {
+        return;
+    }
+
+    PerfectHash *ph = *hash;
+    if (!ph->mapped) {
+        free(ph->bits);
+        free(ph->ranks);
+        free(ph->ids);
+    }
+
+    free(ph);
+    ph = NULL;
+    *hash = NULL;
+}
+
+// 64 bit FNV-1a with a final avalanche so every bit is usable
+uint64_t ph_hash(const char *s, size_t len) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Slot for a key in a level, reseeding the hash per level and mapping it to
+// the level size by multiply-shift rather than division
+size_t ph_slot(uint64_t h, size_t level, size_t size) {
+    uint64_t x = h ^ (0x9e3779b97f4a7c15ull * (level + 1));
+    x ^= x >> 31;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 29;
+    return (size_t)(((x >> 32) * (uint64_t)size) >> 32);
+}
+
+int ph_cmp_key(const void *a, const void *b) {
+    const PHKey *x = a;
+    const PHKey *y = b;
+    if (x->h != y->h) {
+        return x->h < y->h ? -1 : 1;
+    }
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+// Drop keys sharing a hash with an earlier key, failing if their words differ
+size_t ph_dedupe(Err **err, PHKey *keys, size_t n, char *const *words) {
+    qsort(keys, n, sizeof(*keys), ph_cmp_key);
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (kept && keys[i].h == keys[kept - 1].h) {
+            if (strcmp(words[keys[i].id], words[keys[kept - 1].id])) {
+                *err = ERR_MAKE("Hash collision between %s and %s",
+                                words[keys[i].id], words[keys[kept - 1].id]);
+                return 0;
+            }
+            continue;
+        }
+        keys[kept++] = keys[i];
+    }
+    return kept;
+}
+
+// Index of the key with hash h, false if no level holds a bit for it
+bool ph_index(const PerfectHash *ph, uint64_t h, size_t *index) {
+    for (size_t level = 0; level < ph->level_count; level++) {
+        size_t pos =
+            ph->level_off[level] + ph_slot(h, level, ph->level_size[level]);
+        size_t w = pos / 64;
+        uint64_t word = ph->bits[w];
+        if (!(word >> (pos % 64) & 1)) {
+            continue;
+        }
+
+        size_t rank = ph->ranks[w / PH_RANK_WORDS];
+        for (size_t k = w - w % PH_RANK_WORDS; k < w; k++) {
+            rank += (size_t)__builtin_popcountll(ph->bits[k]);
+        }
+        uint64_t below = ((uint64_t)1 << (pos % 64)) - 1;
+        *index = rank + (size_t)__builtin_popcountll(word & below);
+        return true;
+    }
+    return false;
+}
+
+size_t ph_align8(size_t n) { return (n + 7) & ~(size_t)7; }
@@ -0,0 +1,22 @@
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+#include "err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct PerfectHash PerfectHash;
+
+void perfect_hash_init(Err **err, PerfectHash **hash, char *const *words,
+                       size_t word_count);
+bool perfect_hash_find(const PerfectHash *hash, const char *word, size_t len,
+                       uint32_t *id);
+size_t perfect_hash_bits(const PerfectHash *hash);
+size_t perfect_hash_imagelen(const PerfectHash *hash);
+void perfect_hash_writeimage(const PerfectHash *hash, void *image);
+bool perfect_hash_mapimage(Err **err, PerfectHash **hash, char *const *words,
+                           size_t word_count, void *image, size_t len);
+void perfect_hash_destroy(PerfectHash **hash);
+
+#endif
@@ -1,27 +1,44 @@
 
 #include "post_round_modal.h"
 #include "constants.h"
+#include "dict_registry.h"
 #include "helpers.h"
 #include "ncurses.h"
+#include "results_history.h"
 #include "stdlib.h"
 #include "string.h"
 #include "typing_test_stats.h"
+#include <time.h>
+
+#define PRM_HEIGHT 11
+#define PRM_WIDTH 50
 
 struct PostRoundModal {
     WINDOW *win;
 };
 
-void prm_render(PostRoundModal *modal, TypingTestStats *stats);
+static const char *const prm_mode_names[TEST_MODE_COUNT] = {
+    [TEST_MODE_RANDOM] = "RANDOM",
+    [TEST_MODE_ADAPTIVE] = "ADAPTIVE",
+    [TEST_MODE_DRILL] = "DRILL",
+    [TEST_MODE_SENTENCES] = "SENTENCES",
+    [TEST_MODE_GHOST] = "GHOST",
+};
+
+void prm_render(PostRoundModal *modal, TypingTestStats *stats,
+                ResultsHistory *history, TestMode mode, const char *dict_name,
+                bool dict_locked);
 
 void post_round_modal_init(Err **err, PostRoundModal **modal) {
     PostRoundModal *m = ZALLOC(sizeof(*m));
     if (!m) {
-        *err = ERR_MAKE("Unable to allocate memory for round end view");
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for round end view");
         return;
     }
 
-    int h = 7;
-    int w = 50;
+    int h = PRM_HEIGHT;
+    int w = PRM_WIDTH;
     int x = (int)((COLS - w) / 2);
     int y = (int)((LINES - h) / 2);
     m->win = newwin(h, w, y, x);
@@ -35,11 +52,14 @@ void post_round_modal_init(Err **err, PostRoundModal **modal) {
 }
 
 void post_round_modal_run(Err **err, JankeyState *state, PostRoundModal *modal,
-                          TypingTestStats *stats) {
+                          TypingTestStats *stats, ResultsHistory *history,
+                          TestMode *mode, const DictRegistry *dicts,
+                          size_t *dict, bool dict_locked) {
     if (*err) {
         return;
     }
-    prm_render(modal, stats);
+    prm_render(modal, stats, history, *mode, dict_registry_name(dicts, *dict),
+               dict_locked);
     while (true) {
         int ui = getch();
         if (ui < 0) {
@@ -51,6 +71,31 @@ void post_round_modal_run(Err **err, JankeyState *state, PostRoundModal *modal,
         case 'N':
             *state = JANKEY_STATE_RUNNING_TEST;
             return;
+        case 'm':
+        case 'M':
+            *mode = (TestMode)((*mode + 1) % TEST_MODE_COUNT);
+            prm_render(modal, stats, history, *mode,
+                       dict_registry_name(dicts, *dict), dict_locked);
+            continue;
+        case 'd':
+        case 'D':
+            // Loaded when the next round starts. A race server pins every
+            // racer to one dictionary, so it cannot change mid-session.
+            if (dict_locked) {
+                continue;
+            }
+            *dict = (*dict + 1) % dict_registry_count(dicts);
+            prm_render(modal, stats, history, *mode,
+                       dict_registry_name(dicts, *dict), dict_locked);
+            continue;
+        case 'h':
+        case 'H':
+            *state = JANKEY_STATE_DISPLAYING_HEATMAP;
+            return;
+        case 'r':
+        case 'R':
+            *state = JANKEY_STATE_DISPLAYING_REVIEW;
+            return;
         case 'q':
         case 'Q':
             *state = JANKEY_STATE_QUITTING;
@@ -64,12 +109,17 @@ void post_round_modal_run(Err **err, JankeyState *state, PostRoundModal *modal,
     refresh();
 }
 
-void prm_render(PostRoundModal *modal, TypingTestStats *s) {
+void prm_render(PostRoundModal *modal, TypingTestStats *s,
+                ResultsHistory *history, TestMode mode, const char *dict_name,
+                bool dict_locked) {
     curs_set(0);
 
+    // Redraw in full, the screen may have been cleared by another view
+    touchwin(modal->win);
     box(modal->win, 0, 0);
 
-    const char *instructions = " [N]ew    [Q]uit ";
+    const char *instructions =
+        " [N]ew [M]ode [D]ict [H]eatmap [R]eview [Q]uit ";
 
     wmove(modal->win, 2, 2);
     wprintw(modal->win, "TIME            %.2lfs",
@@ -79,7 +129,31 @@ void prm_render(PostRoundModal *modal, TypingTestStats *s) {
     wmove(modal->win, 4, 2);
     wprintw(modal->win, "ACCURACY:       %.2lf%%", tt_stats_getAccuracy(s));
 
-    wmove(modal->win, 6, (int)((50 - strlen(instructions)) / 2));
+    if (history) {
+        const ResultRecord *best = results_history_best(history);
+        int64_t since = (int64_t)time(NULL) - (int64_t)30 * 24 * 60 * 60;
+        size_t n = 0;
+        double avg = results_history_avgsince(history, since, &n);
+
+        wmove(modal->win, 6, 2);
+        wprintw(modal->win, "BEST WPM:       %.2lf",
+                best ? (double)best->wpm : 0.);
+        wmove(modal->win, 7, 2);
+        wprintw(modal->win, "30 DAY AVG:     %.2lf (%zu rounds)", avg, n);
+    }
+
+    // Pad to clear the previous mode name on toggle
+    wmove(modal->win, 8, 2);
+    wprintw(modal->win, "NEXT MODE:      %-10s", prm_mode_names[mode]);
+    wmove(modal->win, 9, 2);
+    if (dict_locked) {
+        wprintw(modal->win, "DICTIONARY:     %-.22s (race)", dict_name);
+    } else {
+        wprintw(modal->win, "DICTIONARY:     %-30.30s", dict_name);
+    }
+
+    wmove(modal->win, PRM_HEIGHT - 1,
+          (int)((PRM_WIDTH - strlen(instructions)) / 2));
     waddstr(modal->win, instructions);
 
     wrefresh(modal->win);
@@ -2,14 +2,19 @@
 #define POST_ROUND_MODAL_H
 
 #include "constants.h"
+#include "dict_registry.h"
 #include "err.h"
+#include "results_history.h"
 #include "typing_test_stats.h"
+#include <stdbool.h>
 
 typedef struct PostRoundModal PostRoundModal;
 
 void post_round_modal_init(Err **err, PostRoundModal **modal);
 void post_round_modal_run(Err **err, JankeyState *state, PostRoundModal *modal,
-                          TypingTestStats *stats);
+                          TypingTestStats *stats, ResultsHistory *history,
+                          TestMode *mode, const DictRegistry *dicts,
+                          size_t *dict, bool dict_locked);
 void post_round_modal_destroy(PostRoundModal **view);
 
 #endif
@@ -0,0 +1,244 @@
+// MSG_NOSIGNAL
+#define _GNU_SOURCE
+#include "race_client.h"
+#include "err.h"
+#include "helpers.h"
+#include "race_protocol.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define RC_IN_CAP 1024
+
+// The socket is non-blocking so polling it from the typing loop never
+// stalls a frame. Progress updates that the socket cannot take right away
+// are dropped, the next one carries the newer position anyway.
+struct RaceClient {
+    int fd;
+    uint32_t self_id;
+    uint32_t race_id;
+    uint16_t racers;
+    RaceRacer shown[RACE_SHOWN];
+    size_t shown_count;
+    size_t in_len;
+    unsigned char in[RC_IN_CAP];
+};
+
+bool rc_read(Err **err, RaceClient *rc, RaceStart *start, bool *started);
+void rc_send_all(Err **err, RaceClient *rc, const unsigned char *data,
+                 size_t len);
+
+void race_client_init(Err **err, RaceClient **client, const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    size_t len = strlen(path);
+    if (!len || len >= sizeof(addr.sun_path)) {
+        *err = ERR_MAKE("Race socket path must be 1 to %zu chars",
+                        sizeof(addr.sun_path) - 1);
+        return;
+    }
+    memcpy(addr.sun_path, path, len + 1);
+
+    RaceClient *rc = ZALLOC(sizeof(*rc));
+    if (!rc) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate race client");
+        return;
+    }
+
+    rc->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (rc->fd < 0 ||
+        connect(rc->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        fcntl(rc->fd, F_SETFL, O_NONBLOCK) < 0) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to join race server %s: %s",
+                             path, strerror(errno));
+        race_client_destroy(&rc);
+        return;
+    }
+
+    *client = rc;
+}
+
+// Ask for a place in a race, race_client_wait then waits for it to start
+void race_client_join(Err **err, RaceClient *rc, uint32_t dict_hash) {
+    if (*err) {
+        return;
+    }
+    RaceMsg join = {.type = RACE_MSG_JOIN, .a = dict_hash};
+    unsigned char msg[RACE_MSG_SIZE];
+    race_put_msg(msg, &join);
+    rc_send_all(err, rc, msg, sizeof(msg));
+}
+
+// Wait until the server starts the race, or wake_fd has input for the
+// caller, in which case it returns false. Frames still queued from the
+// previous race are skipped.
+bool race_client_wait(Err **err, RaceClient *rc, int wake_fd,
+                      RaceStart *start) {
+    bool started = false;
+    while (!*err && !started) {
+        struct pollfd pfd[2] = {
+            {.fd = rc->fd, .events = POLLIN},
+            {.fd = wake_fd, .events = POLLIN},
+        };
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *err = ERR_MAKE_CODE(ERR_IO, "Unable to wait for race: %s",
+                                 strerror(errno));
+            return false;
+        }
+        if (pfd[0].revents) {
+            rc_read(err, rc, start, &started);
+        }
+        if (!started && pfd[1].revents) {
+            return false;
+        }
+    }
+    return started;
+}
+
+void race_client_progress(Err **err, RaceClient *rc, size_t cursor,
+                          double wpm, bool finished) {
+    if (*err) {
+        return;
+    }
+    RaceMsg progress = {
+        .type = RACE_MSG_PROGRESS,
+        .flags = finished ? RACE_FINISHED : 0,
+        .wpm = (uint16_t)MIN_N(MAX_N(lround(wpm), 0L), (long)UINT16_MAX),
+        .a = rc->race_id,
+        .b = (uint32_t)MIN_N(cursor, (size_t)UINT32_MAX),
+    };
+    unsigned char msg[RACE_MSG_SIZE];
+    race_put_msg(msg, &progress);
+
+    // The finish must arrive, it is what lets the next race start
+    if (finished) {
+        rc_send_all(err, rc, msg, sizeof(msg));
+        return;
+    }
+    if (send(rc->fd, msg, sizeof(msg), MSG_NOSIGNAL) < 0 && errno != EAGAIN &&
+        errno != EWOULDBLOCK && errno != EINTR) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Lost the race server: %s",
+                             strerror(errno));
+    }
+}
+
+// Read whatever the server sent, true if the standings changed
+bool race_client_poll(Err **err, RaceClient *rc) {
+    if (*err) {
+        return false;
+    }
+    return rc_read(err, rc, NULL, NULL);
+}
+
+// Leading racers, furthest first, with total set to everyone in the race
+size_t race_client_racers(const RaceClient *rc, const RaceRacer **shown,
+                          size_t *total) {
+    *shown = rc->shown;
+    *total = rc->racers;
+    return rc->shown_count;
+}
+
+uint32_t race_client_self(const RaceClient *rc) { return rc->self_id; }
+
+void race_client_destroy(RaceClient **client) {
+    if (!client || !*client) {
+        return;
+    }
+    RaceClient *rc = *client;
+    if (rc->fd >= 0) {
+        close(rc->fd);
+    }
+    free(rc);
+    *client = NULL;
+}
+
+bool rc_read(Err **err, RaceClient *rc, RaceStart *start, bool *started) {
+    bool changed = false;
+    for (;;) {
+        ssize_t n =
+            recv(rc->fd, rc->in + rc->in_len, RC_IN_CAP - rc->in_len, 0);
+        if (n == 0) {
+            *err = ERR_MAKE_CODE(ERR_IO, "Race server closed the connection");
+            return changed;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                *err = ERR_MAKE_CODE(ERR_IO, "Lost the race server: %s",
+                                     strerror(errno));
+            }
+            return changed;
+        }
+        rc->in_len += (size_t)n;
+
+        size_t off = 0;
+        size_t len;
+        while ((len = race_msg_len(rc->in + off, rc->in_len - off))) {
+            if (len == SIZE_MAX) {
+                *err = ERR_MAKE_CODE(ERR_IO, "Malformed race message");
+                return changed;
+            }
+            const unsigned char *msg = rc->in + off;
+            off += len;
+
+            if (msg[0] == RACE_MSG_START) {
+                if (!start) {
+                    continue;
+                }
+                race_get_start(msg, start);
+                *started = true;
+                rc->race_id = start->race_id;
+                rc->self_id = start->self_id;
+                rc->racers = 0;
+                rc->shown_count = 0;
+                changed = true;
+                continue;
+            }
+
+            RaceRacer shown[RACE_SHOWN];
+            uint32_t race_id;
+            uint16_t racers;
+            size_t count = race_get_state(msg, &race_id, &racers, shown);
+            if (race_id == rc->race_id) {
+                memcpy(rc->shown, shown, count * sizeof(*shown));
+                rc->shown_count = count;
+                rc->racers = racers;
+                changed = true;
+            }
+        }
+        memmove(rc->in, rc->in + off, rc->in_len - off);
+        rc->in_len -= off;
+    }
+}
+
+void rc_send_all(Err **err, RaceClient *rc, const unsigned char *data,
+                 size_t len) {
+    while (len) {
+        ssize_t n = send(rc->fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                struct pollfd pfd = {.fd = rc->fd, .events = POLLOUT};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            *err = ERR_MAKE_CODE(ERR_IO, "Lost the race server: %s",
+                                 strerror(errno));
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
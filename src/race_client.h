@@ -0,0 +1,24 @@
+#ifndef RACE_CLIENT_H
+#define RACE_CLIENT_H
+
+#include "err.h"
+#include "race_protocol.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct RaceClient RaceClient;
+
+void race_client_init(Err **err, RaceClient **client, const char *path);
+void race_client_join(Err **err, RaceClient *client, uint32_t dict_hash);
+bool race_client_wait(Err **err, RaceClient *client, int wake_fd,
+                      RaceStart *start);
+void race_client_progress(Err **err, RaceClient *client, size_t cursor,
+                          double wpm, bool finished);
+bool race_client_poll(Err **err, RaceClient *client);
+size_t race_client_racers(const RaceClient *client, const RaceRacer **shown,
+                          size_t *total);
+uint32_t race_client_self(const RaceClient *client);
+void race_client_destroy(RaceClient **client);
+
+#endif
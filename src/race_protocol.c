@@ -0,0 +1,124 @@
+#include "race_protocol.h"
+#include "helpers.h"
+#include <stddef.h>
+#include <stdint.h>
+
+void rp_put16(unsigned char *p, uint16_t v);
+void rp_put32(unsigned char *p, uint32_t v);
+uint16_t rp_get16(const unsigned char *p);
+uint32_t rp_get32(const unsigned char *p);
+
+void race_put_msg(unsigned char out[RACE_MSG_SIZE], const RaceMsg *msg) {
+    out[0] = msg->type;
+    out[1] = msg->flags;
+    rp_put16(out + 2, msg->wpm);
+    rp_put32(out + 4, msg->a);
+    rp_put32(out + 8, msg->b);
+}
+
+void race_get_msg(const unsigned char in[RACE_MSG_SIZE], RaceMsg *msg) {
+    msg->type = in[0];
+    msg->flags = in[1];
+    msg->wpm = rp_get16(in + 2);
+    msg->a = rp_get32(in + 4);
+    msg->b = rp_get32(in + 8);
+}
+
+void race_put_start(unsigned char out[RACE_START_SIZE],
+                    const RaceStart *start) {
+    out[0] = RACE_MSG_START;
+    out[1] = 0;
+    rp_put16(out + 2, start->word_count);
+    rp_put32(out + 4, start->race_id);
+    rp_put32(out + 8, start->seed);
+    rp_put32(out + 12, start->self_id);
+}
+
+void race_get_start(const unsigned char in[RACE_START_SIZE],
+                    RaceStart *start) {
+    start->word_count = rp_get16(in + 2);
+    start->race_id = rp_get32(in + 4);
+    start->seed = rp_get32(in + 8);
+    start->self_id = rp_get32(in + 12);
+}
+
+// Returns the frame length
+size_t race_put_state(unsigned char out[RACE_STATE_MAX], uint32_t race_id,
+                      uint16_t racers, const RaceRacer *shown, size_t count) {
+    count = MIN_N(count, (size_t)RACE_SHOWN);
+    out[0] = RACE_MSG_STATE;
+    out[1] = (unsigned char)count;
+    rp_put16(out + 2, racers);
+    rp_put32(out + 4, race_id);
+
+    unsigned char *p = out + RACE_STATE_HEADER;
+    for (size_t i = 0; i < count; i++, p += RACE_RACER_SIZE) {
+        rp_put32(p, shown[i].id);
+        rp_put32(p + 4, shown[i].cursor);
+        rp_put16(p + 8, shown[i].wpm);
+        rp_put16(p + 10, shown[i].flags);
+    }
+    return RACE_STATE_HEADER + count * RACE_RACER_SIZE;
+}
+
+// Returns the number of racers in the frame, in must hold a whole frame as
+// measured by race_msg_len
+size_t race_get_state(const unsigned char *in, uint32_t *race_id,
+                      uint16_t *racers, RaceRacer shown[RACE_SHOWN]) {
+    size_t count = MIN_N((size_t)in[1], (size_t)RACE_SHOWN);
+    *racers = rp_get16(in + 2);
+    *race_id = rp_get32(in + 4);
+
+    const unsigned char *p = in + RACE_STATE_HEADER;
+    for (size_t i = 0; i < count; i++, p += RACE_RACER_SIZE) {
+        shown[i].id = rp_get32(p);
+        shown[i].cursor = rp_get32(p + 4);
+        shown[i].wpm = rp_get16(p + 8);
+        shown[i].flags = rp_get16(p + 10);
+    }
+    return count;
+}
+
+// Length of the server message at the start of in, 0 if it is not all there
+// yet and SIZE_MAX for an unknown type
+size_t race_msg_len(const unsigned char *in, size_t len) {
+    if (!len) {
+        return 0;
+    }
+    size_t need = SIZE_MAX;
+    if (in[0] == RACE_MSG_START) {
+        need = RACE_START_SIZE;
+    } else if (in[0] == RACE_MSG_STATE) {
+        if (len < 2) {
+            return 0;
+        }
+        if (in[1] > RACE_SHOWN) {
+            return SIZE_MAX;
+        }
+        need = RACE_STATE_HEADER + (size_t)in[1] * RACE_RACER_SIZE;
+    }
+    if (need == SIZE_MAX) {
+        return SIZE_MAX;
+    }
+    return len < need ? 0 : need;
+}
+
+void rp_put16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+void rp_put32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+uint16_t rp_get16(const unsigned char *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+uint32_t rp_get32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
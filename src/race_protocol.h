@@ -0,0 +1,63 @@
+#ifndef RACE_PROTOCOL_H
+#define RACE_PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Wire format shared by the race server and its clients. Every field is
+// little-endian and every message starts with its type byte. Clients only
+// send fixed-size RaceMsg; the server sends RaceStart once per race and a
+// state frame with the leading racers every tick something changed.
+#define RACE_TICK_MS 100
+#define RACE_SHOWN 4
+
+#define RACE_MSG_JOIN 1
+#define RACE_MSG_PROGRESS 2
+#define RACE_MSG_START 3
+#define RACE_MSG_STATE 4
+
+#define RACE_FINISHED 1u
+
+#define RACE_MSG_SIZE 12
+#define RACE_START_SIZE 16
+#define RACE_STATE_HEADER 8
+#define RACE_RACER_SIZE 12
+#define RACE_STATE_MAX (RACE_STATE_HEADER + RACE_SHOWN * RACE_RACER_SIZE)
+
+// Client to server. A join carries the dict hash in a, a progress update
+// the race id in a and the cursor in b.
+typedef struct RaceMsg {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t wpm;
+    uint32_t a;
+    uint32_t b;
+} RaceMsg;
+
+typedef struct RaceStart {
+    uint32_t race_id;
+    uint32_t seed;
+    uint32_t self_id;
+    uint16_t word_count;
+} RaceStart;
+
+typedef struct RaceRacer {
+    uint32_t id;
+    uint32_t cursor;
+    uint16_t wpm;
+    uint16_t flags;
+} RaceRacer;
+
+void race_put_msg(unsigned char out[RACE_MSG_SIZE], const RaceMsg *msg);
+void race_get_msg(const unsigned char in[RACE_MSG_SIZE], RaceMsg *msg);
+void race_put_start(unsigned char out[RACE_START_SIZE],
+                    const RaceStart *start);
+void race_get_start(const unsigned char in[RACE_START_SIZE], RaceStart *start);
+size_t race_put_state(unsigned char out[RACE_STATE_MAX], uint32_t race_id,
+                      uint16_t racers, const RaceRacer *shown, size_t count);
+size_t race_get_state(const unsigned char *in, uint32_t *race_id,
+                      uint16_t *racers, RaceRacer shown[RACE_SHOWN]);
+size_t race_msg_len(const unsigned char *in, size_t len);
+
+#endif
@@ -0,0 +1,675 @@
+// accept4, SOCK_NONBLOCK and MSG_NOSIGNAL
+#define _GNU_SOURCE
+#include "race_server.h"
+#include "err.h"
+#include "helpers.h"
+#include "race_protocol.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RS_EVENTS 256
+#define RS_IN_CAP (RACE_MSG_SIZE * 16)
+#define RS_OUT_CAP 256
+#define RS_PATH_CAP sizeof(((struct sockaddr_un *)NULL)->sun_path)
+#define RS_NONE UINT32_MAX
+#define RS_TAG_LISTEN UINT32_MAX
+#define RS_TAG_TIMER (UINT32_MAX - 1)
+// A racer whose cursor has not moved this long is taken out of the race once
+// others wait on it
+#define RS_IDLE_TICKS (15000 / RACE_TICK_MS)
+
+typedef enum RSState {
+    RS_FREE,
+    RS_IDLE,
+    RS_WAITING,
+    RS_RACING,
+    RS_FINISHED
+} RSState;
+
+// Client slots are allocated once and recycled through a free list, so
+// neither connections nor messages allocate. A tick's bytes are gathered in
+// out and leave in one send; what the socket does not take waits there for
+// EPOLLOUT.
+typedef struct RSClient {
+    int fd;
+    RSState state;
+    uint32_t id;
+    uint32_t race_id;
+    uint32_t cursor;
+    uint16_t wpm;
+    uint64_t last_tick;
+    bool polling_out;
+    uint32_t next_free;
+    size_t in_len;
+    size_t out_len;
+    unsigned char in[RS_IN_CAP];
+    unsigned char out[RS_OUT_CAP];
+} RSClient;
+
+// One race runs at a time. Joiners enter it while nobody has finished,
+// otherwise they wait and every waiter starts the next race together once
+// the last racer finishes or leaves. A racer who stops typing while others
+// wait is dropped from the race, though not disconnected, so it cannot hold
+// everyone up. All racers share the race's seed and so its test.
+struct RaceServer {
+    int listen_fd;
+    int epoll_fd;
+    int timer_fd;
+    char path[RS_PATH_CAP];
+    bool bound;
+    RSClient *clients;
+    uint32_t free_head;
+    uint32_t slots_used;
+    size_t connected;
+    uint32_t next_id;
+    uint64_t rng;
+    uint16_t word_count;
+    uint32_t dict_hash;
+    bool has_dict;
+    uint32_t race_id;
+    uint32_t seed;
+    bool race_open;
+    size_t racing;
+    size_t waiting;
+    bool dirty;
+    uint64_t ticks;
+    unsigned char frame[RACE_STATE_MAX];
+};
+
+static volatile sig_atomic_t rs_stop = 0;
+
+void rs_listen(Err **err, RaceServer *rs, const char *path);
+void rs_watch(Err **err, RaceServer *rs, int fd, uint32_t tag);
+void rs_accept(Err **err, RaceServer *rs);
+bool rs_read(RaceServer *rs, RSClient *c);
+bool rs_handle(RaceServer *rs, RSClient *c, const RaceMsg *msg);
+bool rs_join(RaceServer *rs, RSClient *c, uint32_t dict_hash);
+void rs_progress(RaceServer *rs, RSClient *c, const RaceMsg *msg);
+void rs_new_race(RaceServer *rs);
+void rs_rollover(RaceServer *rs);
+bool rs_start(RaceServer *rs, RSClient *c);
+void rs_tick(RaceServer *rs);
+void rs_expire(RaceServer *rs);
+void rs_rank_push(RaceRacer *shown, size_t *count, const RSClient *c);
+bool rs_queue(RSClient *c, const unsigned char *data, size_t len);
+bool rs_flush(RaceServer *rs, RSClient *c);
+void rs_leave(RaceServer *rs, RSClient *c);
+void rs_drop(RaceServer *rs, uint32_t slot);
+void rs_raise_fd_limit(void);
+uint32_t rs_rand(RaceServer *rs);
+void rs_on_signal(int sig);
+
+void race_server_init(Err **err, RaceServer **server, const char *path,
+                      uint16_t word_count) {
+    RaceServer *rs = ZALLOC(sizeof(*rs));
+    if (!rs) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate race server");
+        return;
+    }
+    rs->listen_fd = -1;
+    rs->epoll_fd = -1;
+    rs->timer_fd = -1;
+    rs->word_count = word_count;
+
+    rs->clients = calloc(RACE_SERVER_MAX_CLIENTS, sizeof(*rs->clients));
+    if (!rs->clients) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate race clients");
+        race_server_destroy(&rs);
+        return;
+    }
+    for (uint32_t i = 0; i < RACE_SERVER_MAX_CLIENTS; i++) {
+        rs->clients[i].fd = -1;
+        rs->clients[i].next_free =
+            i + 1 < RACE_SERVER_MAX_CLIENTS ? i + 1 : RS_NONE;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    rs->rng = ((uint64_t)now.tv_sec << 32 ^ (uint64_t)now.tv_nsec ^
+               (uint64_t)getpid()) |
+              1;
+
+    rs_raise_fd_limit();
+    rs_listen(err, rs, path);
+    if (*err) {
+        race_server_destroy(&rs);
+        return;
+    }
+
+    rs->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    rs->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (rs->epoll_fd < 0 || rs->timer_fd < 0) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to set up race server: %s",
+                             strerror(errno));
+        race_server_destroy(&rs);
+        return;
+    }
+    struct itimerspec tick = {
+        .it_interval = {.tv_sec = 0, .tv_nsec = RACE_TICK_MS * 1000000L},
+        .it_value = {.tv_sec = 0, .tv_nsec = RACE_TICK_MS * 1000000L},
+    };
+    if (timerfd_settime(rs->timer_fd, 0, &tick, NULL) < 0) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to start race tick: %s",
+                             strerror(errno));
+        race_server_destroy(&rs);
+        return;
+    }
+    rs_watch(err, rs, rs->listen_fd, RS_TAG_LISTEN);
+    rs_watch(err, rs, rs->timer_fd, RS_TAG_TIMER);
+    if (*err) {
+        race_server_destroy(&rs);
+        return;
+    }
+
+    *server = rs;
+}
+
+// Serve until SIGINT or SIGTERM. The tick timer keeps epoll_wait returning,
+// so a signal between the check and the wait is seen within a tick.
+void race_server_run(Err **err, RaceServer *rs) {
+    struct sigaction sa = {.sa_handler = rs_on_signal};
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    struct epoll_event events[RS_EVENTS];
+    while (!rs_stop) {
+        int n = epoll_wait(rs->epoll_fd, events, RS_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            *err = ERR_MAKE_CODE(ERR_IO, "Race server wait failed: %s",
+                                 strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            uint32_t tag = events[i].data.u32;
+            uint32_t ev = events[i].events;
+            if (tag == RS_TAG_LISTEN) {
+                rs_accept(err, rs);
+                if (*err) {
+                    return;
+                }
+                continue;
+            }
+            if (tag == RS_TAG_TIMER) {
+                rs_tick(rs);
+                continue;
+            }
+
+            // A slot dropped earlier in this batch may have been reused
+            RSClient *c = &rs->clients[tag];
+            if (c->state == RS_FREE) {
+                continue;
+            }
+            bool keep = true;
+            if (ev & EPOLLIN) {
+                keep = rs_read(rs, c);
+            }
+            if (keep && (ev & EPOLLOUT)) {
+                keep = rs_flush(rs, c);
+            }
+            if (!keep || (ev & (EPOLLHUP | EPOLLERR))) {
+                rs_drop(rs, tag);
+                rs_rollover(rs);
+            }
+        }
+    }
+}
+
+void race_server_destroy(RaceServer **server) {
+    if (!server || !*server) {
+        return;
+    }
+    RaceServer *rs = *server;
+
+    if (rs->clients) {
+        for (uint32_t i = 0; i < rs->slots_used; i++) {
+            if (rs->clients[i].fd >= 0) {
+                close(rs->clients[i].fd);
+            }
+        }
+        free(rs->clients);
+    }
+    if (rs->timer_fd >= 0) {
+        close(rs->timer_fd);
+    }
+    if (rs->epoll_fd >= 0) {
+        close(rs->epoll_fd);
+    }
+    if (rs->listen_fd >= 0) {
+        close(rs->listen_fd);
+    }
+    if (rs->bound) {
+        unlink(rs->path);
+    }
+
+    free(rs);
+    *server = NULL;
+}
+
+// Bind the socket, replacing a stale one left by a server that died but not
+// one that is still accepting
+void rs_listen(Err **err, RaceServer *rs, const char *path) {
+    size_t len = strlen(path);
+    if (!len || len >= RS_PATH_CAP) {
+        *err = ERR_MAKE("Race socket path must be 1 to %zu chars",
+                        RS_PATH_CAP - 1);
+        return;
+    }
+    memcpy(rs->path, path, len + 1);
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    memcpy(addr.sun_path, path, len + 1);
+
+    rs->listen_fd =
+        socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (rs->listen_fd < 0) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to create race socket: %s",
+                             strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool live = probe >= 0 && connect(probe, (struct sockaddr *)&addr,
+                                          sizeof(addr)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (live) {
+            *err = ERR_MAKE_CODE(ERR_IO, "A race server is already on %s",
+                                 path);
+            return;
+        }
+        unlink(path);
+    }
+
+    if (bind(rs->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to bind %s: %s", path,
+                             strerror(errno));
+        return;
+    }
+    rs->bound = true;
+    if (listen(rs->listen_fd, SOMAXCONN) < 0) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to listen on %s: %s", path,
+                             strerror(errno));
+        return;
+    }
+}
+
+void rs_watch(Err **err, RaceServer *rs, int fd, uint32_t tag) {
+    if (*err) {
+        return;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = tag};
+    if (epoll_ctl(rs->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to watch race socket: %s",
+                             strerror(errno));
+    }
+}
+
+// Accept every pending connection. Past the slot cap, or the fd limit,
+// connections are refused rather than stopping the server.
+void rs_accept(Err **err, RaceServer *rs) {
+    for (;;) {
+        int fd = accept4(rs->listen_fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EMFILE ||
+                errno == ENFILE) {
+                return;
+            }
+            *err = ERR_MAKE_CODE(ERR_IO, "Unable to accept racer: %s",
+                                 strerror(errno));
+            return;
+        }
+        if (rs->free_head == RS_NONE) {
+            close(fd);
+            continue;
+        }
+
+        uint32_t slot = rs->free_head;
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = slot};
+        if (epoll_ctl(rs->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            continue;
+        }
+        RSClient *c = &rs->clients[slot];
+        rs->free_head = c->next_free;
+        rs->slots_used = MAX_N(rs->slots_used, slot + 1);
+        rs->connected++;
+
+        c->fd = fd;
+        c->state = RS_IDLE;
+        c->id = ++rs->next_id;
+        c->race_id = 0;
+        c->polling_out = false;
+        c->in_len = 0;
+        c->out_len = 0;
+    }
+}
+
+// Read and handle every whole message, false once the client is gone or
+// broke the protocol
+bool rs_read(RaceServer *rs, RSClient *c) {
+    for (;;) {
+        ssize_t n = recv(c->fd, c->in + c->in_len, RS_IN_CAP - c->in_len, 0);
+        if (n == 0) {
+            return false;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c->in_len += (size_t)n;
+
+        size_t off = 0;
+        for (; c->in_len - off >= RACE_MSG_SIZE; off += RACE_MSG_SIZE) {
+            RaceMsg msg;
+            race_get_msg(c->in + off, &msg);
+            if (!rs_handle(rs, c, &msg)) {
+                return false;
+            }
+        }
+        memmove(c->in, c->in + off, c->in_len - off);
+        c->in_len -= off;
+    }
+}
+
+bool rs_handle(RaceServer *rs, RSClient *c, const RaceMsg *msg) {
+    if (msg->type == RACE_MSG_JOIN) {
+        return rs_join(rs, c, msg->a);
+    }
+    if (msg->type == RACE_MSG_PROGRESS) {
+        rs_progress(rs, c, msg);
+        return true;
+    }
+    return false;
+}
+
+// Races are pinned to the first joiner's dictionary until everyone leaves,
+// as the shared seed only yields the same test over the same words
+bool rs_join(RaceServer *rs, RSClient *c, uint32_t dict_hash) {
+    if (!rs->has_dict) {
+        rs->dict_hash = dict_hash;
+        rs->has_dict = true;
+    } else if (dict_hash != rs->dict_hash) {
+        return false;
+    }
+
+    // Joining again abandons the current race
+    rs_leave(rs, c);
+    rs_rollover(rs);
+
+    if (!rs->racing) {
+        rs_new_race(rs);
+    } else if (!rs->race_open) {
+        c->state = RS_WAITING;
+        rs->waiting++;
+        return true;
+    }
+    return c->state == RS_RACING || rs_start(rs, c);
+}
+
+void rs_progress(RaceServer *rs, RSClient *c, const RaceMsg *msg) {
+    if (c->state != RS_RACING || msg->a != rs->race_id) {
+        return;
+    }
+    // Progress is sent every tick, only a moving cursor shows someone typing
+    if (msg->b != c->cursor) {
+        c->last_tick = rs->ticks;
+    }
+    c->cursor = msg->b;
+    c->wpm = msg->wpm;
+    rs->dirty = true;
+
+    if (msg->flags & RACE_FINISHED) {
+        c->state = RS_FINISHED;
+        rs->racing--;
+        rs->race_open = false;
+        rs_rollover(rs);
+    }
+}
+
+// Start a race with a fresh seed for everyone waiting
+void rs_new_race(RaceServer *rs) {
+    rs->race_id++;
+    rs->seed = rs_rand(rs);
+    rs->race_open = true;
+    rs->dirty = true;
+
+    for (uint32_t i = 0; i < rs->slots_used && rs->waiting; i++) {
+        RSClient *c = &rs->clients[i];
+        if (c->state != RS_WAITING) {
+            continue;
+        }
+        rs->waiting--;
+        c->state = RS_IDLE;
+        if (!rs_start(rs, c)) {
+            rs_drop(rs, i);
+        }
+    }
+}
+
+void rs_rollover(RaceServer *rs) {
+    if (!rs->racing && rs->waiting) {
+        rs_new_race(rs);
+    }
+}
+
+bool rs_start(RaceServer *rs, RSClient *c) {
+    RaceStart start = {
+        .race_id = rs->race_id,
+        .seed = rs->seed,
+        .self_id = c->id,
+        .word_count = rs->word_count,
+    };
+    unsigned char msg[RACE_START_SIZE];
+    race_put_start(msg, &start);
+
+    c->state = RS_RACING;
+    c->race_id = rs->race_id;
+    c->cursor = 0;
+    c->wpm = 0;
+    c->last_tick = rs->ticks;
+    rs->racing++;
+    rs->dirty = true;
+    return rs_queue(c, msg, sizeof(msg)) && rs_flush(rs, c);
+}
+
+// Broadcast the leading racers if anything changed since the last tick. The
+// frame is built once and copied to each racer; one that still has a frame
+// queued skips this one, as the next supersedes it anyway.
+void rs_tick(RaceServer *rs) {
+    uint64_t expirations;
+    if (read(rs->timer_fd, &expirations, sizeof(expirations)) < 0) {
+        return;
+    }
+    rs->ticks += expirations;
+    if (rs->waiting) {
+        rs_expire(rs);
+    }
+    if (!rs->dirty) {
+        return;
+    }
+    rs->dirty = false;
+
+    RaceRacer shown[RACE_SHOWN];
+    size_t count = 0;
+    size_t racers = 0;
+    for (uint32_t i = 0; i < rs->slots_used; i++) {
+        const RSClient *c = &rs->clients[i];
+        if ((c->state == RS_RACING || c->state == RS_FINISHED) &&
+            c->race_id == rs->race_id) {
+            racers++;
+            rs_rank_push(shown, &count, c);
+        }
+    }
+    size_t len = race_put_state(rs->frame, rs->race_id,
+                                (uint16_t)MIN_N(racers, (size_t)UINT16_MAX),
+                                shown, count);
+
+    bool dropped = false;
+    for (uint32_t i = 0; i < rs->slots_used; i++) {
+        RSClient *c = &rs->clients[i];
+        if (c->state != RS_RACING || c->out_len) {
+            continue;
+        }
+        if (rs_queue(c, rs->frame, len) && !rs_flush(rs, c)) {
+            rs_drop(rs, i);
+            dropped = true;
+        }
+    }
+    if (dropped) {
+        rs_rollover(rs);
+    }
+}
+
+// Take idle racers out of the race so the waiters can start the next one.
+// Their later progress is ignored until they join again.
+void rs_expire(RaceServer *rs) {
+    for (uint32_t i = 0; i < rs->slots_used; i++) {
+        RSClient *c = &rs->clients[i];
+        if (c->state == RS_RACING &&
+            rs->ticks - c->last_tick >= RS_IDLE_TICKS) {
+            rs_leave(rs, c);
+        }
+    }
+    rs_rollover(rs);
+}
+
+// Keep the RACE_SHOWN furthest racers, furthest first
+void rs_rank_push(RaceRacer *shown, size_t *count, const RSClient *c) {
+    size_t i = *count;
+    if (i == RACE_SHOWN) {
+        if (shown[i - 1].cursor >= c->cursor) {
+            return;
+        }
+        i--;
+    } else {
+        (*count)++;
+    }
+    for (; i > 0 && shown[i - 1].cursor < c->cursor; i--) {
+        shown[i] = shown[i - 1];
+    }
+    shown[i] = (RaceRacer){
+        .id = c->id,
+        .cursor = c->cursor,
+        .wpm = c->wpm,
+        .flags = c->state == RS_FINISHED ? RACE_FINISHED : 0,
+    };
+}
+
+bool rs_queue(RSClient *c, const unsigned char *data, size_t len) {
+    if (RS_OUT_CAP - c->out_len < len) {
+        return false;
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return true;
+}
+
+// Send what the socket takes, watching for EPOLLOUT while bytes remain
+bool rs_flush(RaceServer *rs, RSClient *c) {
+    while (c->out_len) {
+        ssize_t n = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            if (!c->polling_out) {
+                struct epoll_event ev = {
+                    .events = EPOLLIN | EPOLLOUT,
+                    .data.u32 = (uint32_t)(c - rs->clients),
+                };
+                epoll_ctl(rs->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+                c->polling_out = true;
+            }
+            return true;
+        }
+        memmove(c->out, c->out + n, c->out_len - (size_t)n);
+        c->out_len -= (size_t)n;
+    }
+    if (c->polling_out) {
+        struct epoll_event ev = {
+            .events = EPOLLIN,
+            .data.u32 = (uint32_t)(c - rs->clients),
+        };
+        epoll_ctl(rs->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->polling_out = false;
+    }
+    return true;
+}
+
+void rs_leave(RaceServer *rs, RSClient *c) {
+    if (c->state == RS_RACING) {
+        rs->racing--;
+        rs->dirty = true;
+    } else if (c->state == RS_WAITING) {
+        rs->waiting--;
+    }
+    c->state = RS_IDLE;
+}
+
+// Callers roll the race over afterwards, as dropping may empty it
+void rs_drop(RaceServer *rs, uint32_t slot) {
+    RSClient *c = &rs->clients[slot];
+    rs_leave(rs, c);
+    close(c->fd);
+    c->fd = -1;
+    c->state = RS_FREE;
+    c->next_free = rs->free_head;
+    rs->free_head = slot;
+
+    rs->connected--;
+    if (!rs->connected) {
+        rs->has_dict = false;
+    }
+}
+
+// Thousands of racers need more descriptors than the usual soft limit
+void rs_raise_fd_limit(void) {
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+}
+
+// xorshift64*, seeds are only meant to differ between races
+uint32_t rs_rand(RaceServer *rs) {
+    rs->rng ^= rs->rng >> 12;
+    rs->rng ^= rs->rng << 25;
+    rs->rng ^= rs->rng >> 27;
+    return (uint32_t)((rs->rng * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+void rs_on_signal(int sig) {
+    (void)sig;
+    rs_stop = 1;
+}
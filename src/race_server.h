@@ -0,0 +1,16 @@
+#ifndef RACE_SERVER_H
+#define RACE_SERVER_H
+
+#include "err.h"
+#include <stdint.h>
+
+#define RACE_SERVER_MAX_CLIENTS 4096
+
+typedef struct RaceServer RaceServer;
+
+void race_server_init(Err **err, RaceServer **server, const char *path,
+                      uint16_t word_count);
+void race_server_run(Err **err, RaceServer *server);
+void race_server_destroy(RaceServer **server);
+
+#endif
@@ -0,0 +1,306 @@
+#define _POSIX_C_SOURCE 200809L
+#include "results_history.h"
+#include "data_dir.h"
+#include "err.h"
+#include "helpers.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RH_MAGIC "JKRSLTS"
+#define RH_VERSION 1u
+
+typedef struct RHHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t reserved[2];
+} RHHeader;
+
+// The log is a header followed by fixed-size records. Rounds are appended
+// with a single write so a crash can at most leave a torn final record, which
+// is truncated away on the next open. Every process appending to the log
+// holds a write lock while it does, so the end it sees is its own to trim.
+// Reads go through a read-only mapping that is extended lazily once the file
+// has grown.
+struct ResultsHistory {
+    int fd;
+    size_t file_size;
+    void *map;
+    size_t map_len;
+    const ResultRecord *records;
+    size_t count;
+    size_t scanned;
+    size_t best_i;
+    bool has_best;
+};
+
+void rh_open(Err **err, ResultsHistory *rh, const char *path);
+void rh_sync(Err **err, ResultsHistory *rh);
+bool rh_lock(int fd, short type);
+uint32_t rh_checksum(const ResultRecord *record);
+
+void results_history_init(Err **err, ResultsHistory **history,
+                          const char *path) {
+    ResultsHistory *rh = ZALLOC(sizeof(*rh));
+    if (!rh) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for results history");
+        return;
+    }
+    rh->fd = -1;
+
+    char default_path[DATA_PATH_CAP];
+    if (!path) {
+        data_dir_path(err, default_path, sizeof(default_path), "results.bin");
+        if (*err) {
+            results_history_destroy(&rh);
+            return;
+        }
+        path = default_path;
+    }
+
+    rh_open(err, rh, path);
+    if (*err) {
+        results_history_destroy(&rh);
+        return;
+    }
+
+    rh_sync(err, rh);
+    if (*err) {
+        results_history_destroy(&rh);
+        return;
+    }
+
+    *history = rh;
+}
+
+void results_history_append(Err **err, ResultsHistory *rh,
+                            ResultRecord *record) {
+    record->checksum = rh_checksum(record);
+
+    if (!rh_lock(rh->fd, F_WRLCK)) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to lock results log: %s",
+                             strerror(errno));
+        return;
+    }
+    // Other processes may have appended since this one last looked
+    off_t end = lseek(rh->fd, 0, SEEK_END);
+    ssize_t n = end < 0 ? -1 : write(rh->fd, record, sizeof(*record));
+    int e = errno;
+    // Drop any partial record so later appends stay aligned
+    bool torn = n > 0 && n != (ssize_t)sizeof(*record);
+    bool repaired = !torn || !ftruncate(rh->fd, end);
+    rh_lock(rh->fd, F_UNLCK);
+
+    if (!repaired) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to roll back results log");
+        return;
+    }
+    if (n != (ssize_t)sizeof(*record)) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to append result: %s",
+                             n < 0 ? strerror(e) : "short write");
+        return;
+    }
+    rh->file_size = (size_t)end + sizeof(*record);
+}
+
+size_t results_history_count(ResultsHistory *rh) {
+    Err *err = NULL;
+    rh_sync(&err, rh);
+    err_destroy(&err);
+    return rh->count;
+}
+
+const ResultRecord *results_history_get(ResultsHistory *rh, size_t i) {
+    if (i >= results_history_count(rh)) {
+        return NULL;
+    }
+    return &rh->records[i];
+}
+
+const ResultRecord *results_history_best(ResultsHistory *rh) {
+    results_history_count(rh);
+    return rh->has_best ? &rh->records[rh->best_i] : NULL;
+}
+
+size_t results_history_lastn(ResultsHistory *rh, size_t n,
+                             const ResultRecord **records) {
+    size_t count = results_history_count(rh);
+    n = MIN_N(n, count);
+    *records = &rh->records[count - n];
+    return n;
+}
+
+// Mean WPM of rounds since the given unix time. Records are appended in time
+// order so the start of the range is found by binary search.
+double results_history_avgsince(ResultsHistory *rh, int64_t since,
+                                size_t *count) {
+    size_t total = results_history_count(rh);
+
+    size_t lo = 0;
+    size_t hi = total;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (rh->records[mid].timestamp < since) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    double sum = 0.;
+    size_t n = 0;
+    for (size_t i = lo; i < total; i++) {
+        if (results_history_isvalid(&rh->records[i])) {
+            sum += (double)rh->records[i].wpm;
+            n++;
+        }
+    }
+
+    if (count) {
+        *count = n;
+    }
+    return n ? sum / (double)n : 0.;
+}
+
+bool results_history_isvalid(const ResultRecord *record) {
+    return record->checksum == rh_checksum(record);
+}
+
+void results_history_destroy(ResultsHistory **history) {
+    if (!history || !*history) {
+        return;
+    }
+
+    ResultsHistory *rh = *history;
+    if (rh->map) {
+        munmap(rh->map, rh->map_len);
+        rh->map = NULL;
+    }
+    if (rh->fd >= 0) {
+        close(rh->fd);
+        rh->fd = -1;
+    }
+
+    free(rh);
+    rh = NULL;
+    *history = NULL;
+}
+
+void rh_open(Err **err, ResultsHistory *rh, const char *path) {
+    rh->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (rh->fd < 0) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to open %s: %s", path,
+                             strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    if (fstat(rh->fd, &st)) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to stat %s", path);
+        return;
+    }
+    size_t size = (size_t)st.st_size;
+
+    RHHeader hdr;
+    if (size == 0) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, RH_MAGIC, sizeof(hdr.magic));
+        hdr.version = RH_VERSION;
+        hdr.record_size = (uint32_t)sizeof(ResultRecord);
+        if (write(rh->fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) {
+            *err = ERR_MAKE_CODE(ERR_IO, "Unable to write header to %s", path);
+            return;
+        }
+        rh->file_size = sizeof(hdr);
+        return;
+    }
+
+    if (size < sizeof(hdr) ||
+        pread(rh->fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        memcmp(hdr.magic, RH_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != RH_VERSION ||
+        hdr.record_size != sizeof(ResultRecord)) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unrecognised results log: %s", path);
+        return;
+    }
+
+    // Drop a torn final record left by a crash mid-append. Under the lock
+    // no other process is part way through writing one.
+    size_t tail = (size - sizeof(hdr)) % sizeof(ResultRecord);
+    if (tail) {
+        struct stat locked;
+        bool repaired = rh_lock(rh->fd, F_WRLCK);
+        if (repaired) {
+            repaired = !fstat(rh->fd, &locked);
+            size = repaired ? (size_t)locked.st_size : size;
+            size -= (size - sizeof(hdr)) % sizeof(ResultRecord);
+            repaired = repaired && !ftruncate(rh->fd, (off_t)size);
+            rh_lock(rh->fd, F_UNLCK);
+        }
+        if (!repaired) {
+            *err = ERR_MAKE_CODE(ERR_IO, "Unable to repair %s", path);
+            return;
+        }
+    }
+    rh->file_size = size;
+}
+
+void rh_sync(Err **err, ResultsHistory *rh) {
+    if (rh->map_len == rh->file_size) {
+        return;
+    }
+
+    if (rh->map) {
+        munmap(rh->map, rh->map_len);
+        rh->map = NULL;
+        rh->map_len = 0;
+        rh->records = NULL;
+        rh->count = 0;
+    }
+
+    void *map = mmap(NULL, rh->file_size, PROT_READ, MAP_SHARED, rh->fd, 0);
+    if (map == MAP_FAILED) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to map results log: %s",
+                             strerror(errno));
+        return;
+    }
+    rh->map = map;
+    rh->map_len = rh->file_size;
+    rh->records = (const void *)((const char *)map + sizeof(RHHeader));
+    rh->count = (rh->file_size - sizeof(RHHeader)) / sizeof(ResultRecord);
+
+    // Only records added since the last sync need checking for a new best
+    for (size_t i = rh->scanned; i < rh->count; i++) {
+        const ResultRecord *r = &rh->records[i];
+        if (!results_history_isvalid(r)) {
+            continue;
+        }
+        if (!rh->has_best || r->wpm > rh->records[rh->best_i].wpm) {
+            rh->best_i = i;
+            rh->has_best = true;
+        }
+    }
+    rh->scanned = rh->count;
+}
+
+// Take or release a whole-file lock, waiting for other processes
+bool rh_lock(int fd, short type) {
+    struct flock l = {.l_type = type, .l_whence = SEEK_SET};
+    while (fcntl(fd, F_SETLKW, &l)) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t rh_checksum(const ResultRecord *record) {
+    return hash_fnv1a(record, offsetof(ResultRecord, checksum));
+}
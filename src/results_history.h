@@ -0,0 +1,38 @@
+#ifndef RESULTS_HISTORY_H
+#define RESULTS_HISTORY_H
+
+#include "err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// On-disk record, appended once per round. Native byte order.
+typedef struct ResultRecord {
+    int64_t timestamp;
+    uint32_t mode;
+    uint32_t word_count;
+    float wpm;
+    float accuracy;
+    float elapsed_sec;
+    uint32_t checksum;
+} ResultRecord;
+
+typedef struct ResultsHistory ResultsHistory;
+
+void results_history_init(Err **err, ResultsHistory **history,
+                          const char *path);
+void results_history_append(Err **err, ResultsHistory *history,
+                            ResultRecord *record);
+
+size_t results_history_count(ResultsHistory *history);
+const ResultRecord *results_history_get(ResultsHistory *history, size_t i);
+const ResultRecord *results_history_best(ResultsHistory *history);
+size_t results_history_lastn(ResultsHistory *history, size_t n,
+                             const ResultRecord **records);
+double results_history_avgsince(ResultsHistory *history, int64_t since,
+                                size_t *count);
+bool results_history_isvalid(const ResultRecord *record);
+
+void results_history_destroy(ResultsHistory **history);
+
+#endif
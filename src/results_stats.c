@@ -0,0 +1,392 @@
+#define _POSIX_C_SOURCE 200809L
+#include "results_stats.h"
+#include "data_dir.h"
+#include "err.h"
+#include "helpers.h"
+#include "results_history.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define RS_MAGIC "JKDAYS1"
+#define RS_VERSION 1u
+#define RS_SECS_PER_DAY ((int64_t)24 * 60 * 60)
+#define RS_TOPK 10
+
+// Log-bucketed WPM histogram in the style of DDSketch. Bucket k holds values
+// in (gamma^(k-1), gamma^k], giving ~1% relative error on any quantile, and
+// two sketches merge by adding counts.
+#define RS_SKETCH_GAMMA 1.02
+#define RS_SKETCH_BUCKETS 352
+
+typedef struct RSTopEntry {
+    float wpm;
+    uint32_t record_i;
+    int64_t timestamp;
+} RSTopEntry;
+
+// Summary of one calendar day (UTC) of rounds, cached on disk so that a query
+// only streams records appended since the cache was written
+typedef struct RSDay {
+    int64_t day;
+    uint64_t count;
+    double wpm_sum;
+    double accuracy_sum;
+    float wpm_min;
+    float wpm_max;
+    uint32_t top_len;
+    uint32_t reserved;
+    RSTopEntry top[RS_TOPK];
+    uint32_t sketch[RS_SKETCH_BUCKETS];
+} RSDay;
+
+typedef struct RSCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t day_size;
+    uint64_t records_covered;
+    uint64_t day_count;
+} RSCacheHeader;
+
+typedef struct RSCache {
+    uint64_t records_covered;
+    size_t day_count;
+    size_t day_cap;
+    RSDay *days;
+} RSCache;
+
+void rs_cache_load(Err **err, RSCache *cache, const char *path);
+void rs_cache_save(Err **err, RSCache *cache, const char *path);
+void rs_cache_update(Err **err, RSCache *cache, ResultsHistory *history);
+RSDay *rs_cache_day(Err **err, RSCache *cache, int64_t day);
+void rs_day_add(RSDay *d, const ResultRecord *r, uint32_t record_i);
+void rs_top_push(RSTopEntry *top, uint32_t *top_len, RSTopEntry e);
+size_t rs_sketch_bucket(double wpm);
+double rs_sketch_value(size_t bucket);
+double rs_sketch_quantile(const uint32_t *sketch, uint64_t count, double q);
+void rs_print(RSCache *cache, FILE *fs);
+
+void results_stats_report(Err **err, ResultsHistory *history,
+                          const char *cache_path, FILE *fs) {
+    char default_path[DATA_PATH_CAP];
+    if (!cache_path) {
+        data_dir_path(err, default_path, sizeof(default_path), "results.days");
+        if (*err) {
+            return;
+        }
+        cache_path = default_path;
+    }
+
+    RSCache cache = {0};
+    rs_cache_load(err, &cache, cache_path);
+    if (*err) {
+        free(cache.days);
+        return;
+    }
+
+    rs_cache_update(err, &cache, history);
+    if (*err) {
+        free(cache.days);
+        return;
+    }
+
+    // A stale cache only costs a rescan next time, so failing to write it
+    // does not fail the report
+    Err *save_err = NULL;
+    rs_cache_save(&save_err, &cache, cache_path);
+    if (save_err) {
+        err_print(save_err, stderr);
+        err_destroy(&save_err);
+    }
+
+    rs_print(&cache, fs);
+    free(cache.days);
+}
+
+void rs_cache_load(Err **err, RSCache *cache, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return;
+    }
+
+    RSCacheHeader hdr;
+    bool valid = fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+                 memcmp(hdr.magic, RS_MAGIC, sizeof(hdr.magic)) == 0 &&
+                 hdr.version == RS_VERSION && hdr.day_size == sizeof(RSDay);
+    // The day count has to account for the file exactly, else it is
+    // truncated or corrupt and sizing anything by it is unsafe
+    struct stat st;
+    valid = valid && !fstat(fileno(f), &st) &&
+            (uint64_t)st.st_size >= sizeof(hdr) &&
+            hdr.day_count ==
+                ((uint64_t)st.st_size - sizeof(hdr)) / sizeof(RSDay) &&
+            ((uint64_t)st.st_size - sizeof(hdr)) % sizeof(RSDay) == 0;
+    if (!valid) {
+        // Unknown or corrupt cache is rebuilt from the log
+        fclose(f);
+        return;
+    }
+
+    RSDay *days = calloc(MAX_N(hdr.day_count, 1), sizeof(*days));
+    if (!days) {
+        fclose(f);
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate day summaries");
+        return;
+    }
+    if (fread(days, sizeof(*days), hdr.day_count, f) != hdr.day_count) {
+        free(days);
+        fclose(f);
+        return;
+    }
+    fclose(f);
+
+    cache->days = days;
+    cache->day_count = hdr.day_count;
+    cache->day_cap = MAX_N(hdr.day_count, 1);
+    cache->records_covered = hdr.records_covered;
+}
+
+void rs_cache_save(Err **err, RSCache *cache, const char *path) {
+    char tmp_path[DATA_PATH_CAP + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to write %s", tmp_path);
+        return;
+    }
+
+    RSCacheHeader hdr = {
+        .version = RS_VERSION,
+        .day_size = sizeof(RSDay),
+        .records_covered = cache->records_covered,
+        .day_count = cache->day_count,
+    };
+    memcpy(hdr.magic, RS_MAGIC, sizeof(hdr.magic));
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              (!cache->day_count ||
+               fwrite(cache->days, sizeof(RSDay), cache->day_count, f) ==
+                   cache->day_count);
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp_path, path)) {
+        remove(tmp_path);
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to write %s", path);
+    }
+}
+
+// Stream the records not yet covered by the cache into their day summaries
+void rs_cache_update(Err **err, RSCache *cache, ResultsHistory *history) {
+    size_t count = results_history_count(history);
+    if (cache->records_covered > count) {
+        // Log was replaced, start over
+        cache->day_count = 0;
+        cache->records_covered = 0;
+    }
+
+    for (size_t i = (size_t)cache->records_covered; i < count; i++) {
+        const ResultRecord *r = results_history_get(history, i);
+        if (!results_history_isvalid(r)) {
+            continue;
+        }
+
+        int64_t day = r->timestamp / RS_SECS_PER_DAY;
+        RSDay *d = rs_cache_day(err, cache, day);
+        if (*err) {
+            return;
+        }
+        rs_day_add(d, r, (uint32_t)i);
+    }
+    cache->records_covered = count;
+}
+
+RSDay *rs_cache_day(Err **err, RSCache *cache, int64_t day) {
+    // Records arrive in time order; a clock stepping backwards is folded
+    // into the latest day rather than reordering the summaries
+    if (cache->day_count && cache->days[cache->day_count - 1].day >= day) {
+        return &cache->days[cache->day_count - 1];
+    }
+
+    if (cache->day_count >= cache->day_cap) {
+        size_t cap = MAX_N(cache->day_cap * 2, 64);
+        RSDay *t = realloc(cache->days, cap * sizeof(*t));
+        if (!t) {
+            *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to grow day summaries");
+            return NULL;
+        }
+        cache->days = t;
+        cache->day_cap = cap;
+    }
+
+    RSDay *d = &cache->days[cache->day_count++];
+    memset(d, 0, sizeof(*d));
+    d->day = day;
+    return d;
+}
+
+void rs_day_add(RSDay *d, const ResultRecord *r, uint32_t record_i) {
+    if (!d->count || r->wpm < d->wpm_min) {
+        d->wpm_min = r->wpm;
+    }
+    if (!d->count || r->wpm > d->wpm_max) {
+        d->wpm_max = r->wpm;
+    }
+    d->count++;
+    d->wpm_sum += (double)r->wpm;
+    d->accuracy_sum += (double)r->accuracy;
+    d->sketch[rs_sketch_bucket((double)r->wpm)]++;
+
+    RSTopEntry e = {
+        .wpm = r->wpm, .record_i = record_i, .timestamp = r->timestamp};
+    rs_top_push(d->top, &d->top_len, e);
+}
+
+// Keep the k best entries, sorted descending
+void rs_top_push(RSTopEntry *top, uint32_t *top_len, RSTopEntry e) {
+    uint32_t n = *top_len;
+    if (n == RS_TOPK && e.wpm <= top[n - 1].wpm) {
+        return;
+    }
+    if (n < RS_TOPK) {
+        n++;
+    }
+
+    uint32_t i = n - 1;
+    while (i > 0 && top[i - 1].wpm < e.wpm) {
+        top[i] = top[i - 1];
+        i--;
+    }
+    top[i] = e;
+    *top_len = n;
+}
+
+size_t rs_sketch_bucket(double wpm) {
+    if (!(wpm > 1.)) {
+        return 0;
+    }
+    double k = ceil(log(wpm) / log(RS_SKETCH_GAMMA));
+    return (size_t)MIN_N(k, (double)(RS_SKETCH_BUCKETS - 1));
+}
+
+double rs_sketch_value(size_t bucket) {
+    // Midpoint of the bucket in relative terms
+    return 2. * pow(RS_SKETCH_GAMMA, (double)bucket) / (RS_SKETCH_GAMMA + 1.);
+}
+
+double rs_sketch_quantile(const uint32_t *sketch, uint64_t count, double q) {
+    if (!count) {
+        return 0.;
+    }
+    uint64_t rank = (uint64_t)(q * (double)(count - 1));
+    uint64_t seen = 0;
+    for (size_t k = 0; k < RS_SKETCH_BUCKETS; k++) {
+        seen += sketch[k];
+        if (seen > rank) {
+            return rs_sketch_value(k);
+        }
+    }
+    return rs_sketch_value(RS_SKETCH_BUCKETS - 1);
+}
+
+void rs_print(RSCache *cache, FILE *fs) {
+    uint64_t count = 0;
+    double wpm_sum = 0.;
+    double accuracy_sum = 0.;
+    uint32_t sketch[RS_SKETCH_BUCKETS] = {0};
+    RSTopEntry top[RS_TOPK];
+    uint32_t top_len = 0;
+
+    int64_t today = (int64_t)time(NULL) / RS_SECS_PER_DAY;
+    uint64_t week_count = 0;
+    double week_sum = 0.;
+    uint64_t month_count = 0;
+    double month_sum = 0.;
+
+    // Least squares fit of daily mean WPM against day, weighted by rounds
+    double sw = 0.;
+    double sx = 0.;
+    double sy = 0.;
+    double sxx = 0.;
+    double sxy = 0.;
+
+    for (size_t i = 0; i < cache->day_count; i++) {
+        const RSDay *d = &cache->days[i];
+        if (!d->count) {
+            continue;
+        }
+        count += d->count;
+        wpm_sum += d->wpm_sum;
+        accuracy_sum += d->accuracy_sum;
+        for (size_t k = 0; k < RS_SKETCH_BUCKETS; k++) {
+            sketch[k] += d->sketch[k];
+        }
+        for (uint32_t k = 0; k < d->top_len; k++) {
+            rs_top_push(top, &top_len, d->top[k]);
+        }
+
+        if (d->day > today - 7) {
+            week_count += d->count;
+            week_sum += d->wpm_sum;
+        }
+        if (d->day > today - 30) {
+            month_count += d->count;
+            month_sum += d->wpm_sum;
+        }
+
+        double w = (double)d->count;
+        double x = (double)(d->day - cache->days[0].day);
+        double y = d->wpm_sum / w;
+        sw += w;
+        sx += w * x;
+        sy += w * y;
+        sxx += w * x * x;
+        sxy += w * x * y;
+    }
+
+    if (!count) {
+        fprintf(fs, "No rounds recorded yet\n");
+        return;
+    }
+
+    fprintf(fs, "ROUNDS          %llu\n", (unsigned long long)count);
+    fprintf(fs, "MEAN WPM        %.2lf\n", wpm_sum / (double)count);
+    fprintf(fs, "MEAN ACCURACY   %.2lf%%\n", accuracy_sum / (double)count);
+    fprintf(fs, "P50 WPM         %.2lf\n",
+            rs_sketch_quantile(sketch, count, 0.50));
+    fprintf(fs, "P90 WPM         %.2lf\n",
+            rs_sketch_quantile(sketch, count, 0.90));
+    fprintf(fs, "P99 WPM         %.2lf\n",
+            rs_sketch_quantile(sketch, count, 0.99));
+    fprintf(fs, "7 DAY AVG       %.2lf (%llu rounds)\n",
+            week_count ? week_sum / (double)week_count : 0.,
+            (unsigned long long)week_count);
+    fprintf(fs, "30 DAY AVG      %.2lf (%llu rounds)\n",
+            month_count ? month_sum / (double)month_count : 0.,
+            (unsigned long long)month_count);
+
+    double denom = sw * sxx - sx * sx;
+    if (denom > 0.) {
+        double slope = (sw * sxy - sx * sy) / denom;
+        fprintf(fs, "TREND           %+.2lf WPM per 30 days\n", slope * 30.);
+    } else {
+        fprintf(fs, "TREND           n/a (need rounds on two days)\n");
+    }
+
+    fprintf(fs, "\nTOP %u ROUNDS\n", (unsigned)top_len);
+    for (uint32_t i = 0; i < top_len; i++) {
+        char date[32];
+        time_t t = (time_t)top[i].timestamp;
+        struct tm tm;
+        if (!localtime_r(&t, &tm) ||
+            !strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm)) {
+            snprintf(date, sizeof(date), "?");
+        }
+        fprintf(fs, "%2u. %7.2f WPM  %s\n", (unsigned)(i + 1),
+                (double)top[i].wpm, date);
+    }
+}
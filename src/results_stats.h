@@ -0,0 +1,11 @@
+#ifndef RESULTS_STATS_H
+#define RESULTS_STATS_H
+
+#include "err.h"
+#include "results_history.h"
+#include <stdio.h>
+
+void results_stats_report(Err **err, ResultsHistory *history,
+                          const char *cache_path, FILE *fs);
+
+#endif
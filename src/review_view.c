@@ -0,0 +1,183 @@
+#include "review_view.h"
+#include "constants.h"
+#include "helpers.h"
+#include "round_review.h"
+#include "utf8.h"
+#include "word_store.h"
+#include <ncurses.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RV_HEIGHT 20
+#define RV_WIDTH (MAX_CHARS_PER_LINE + 4)
+#define RV_TEXT_Y 5
+
+struct ReviewView {
+    WINDOW *win;
+    int height;
+    int width;
+};
+
+void rv_render(ReviewView *view, const RoundReview *review);
+void rv_render_text(ReviewView *view, const RoundReview *review);
+size_t rv_fit(const char *word, size_t len, size_t n);
+
+void review_view_init(Err **err, ReviewView **view) {
+    ReviewView *v = ZALLOC(sizeof(*v));
+    if (!v) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for review view");
+        return;
+    }
+
+    v->height = MIN_N(RV_HEIGHT, LINES);
+    v->width = MIN_N(RV_WIDTH, COLS);
+    int x = (COLS - v->width) / 2;
+    int y = (LINES - v->height) / 2;
+    v->win = newwin(v->height, v->width, y, x);
+    if (!v->win) {
+        *err = ERR_MAKE("Unable to initialise ncurses window");
+        review_view_destroy(&v);
+        return;
+    }
+
+    *view = v;
+}
+
+void review_view_run(Err **err, JankeyState *state, ReviewView *view,
+                     const RoundReview *review) {
+    if (*err) {
+        return;
+    }
+
+    clear();
+    refresh();
+    rv_render(view, review);
+
+    while (true) {
+        int ui = getch();
+        if (ui < 0) {
+            continue;
+        }
+        char c = (char)ui;
+        switch (c) {
+        case 'b':
+        case 'B':
+            *state = JANKEY_STATE_DISPLAYING_POST_TEST_MODAL;
+            break;
+        case 'n':
+        case 'N':
+            *state = JANKEY_STATE_RUNNING_TEST;
+            break;
+        case 'q':
+        case 'Q':
+            *state = JANKEY_STATE_QUITTING;
+            break;
+        default:
+            continue;
+        }
+        break;
+    }
+
+    werase(view->win);
+    wrefresh(view->win);
+    clear();
+    refresh();
+}
+
+void review_view_destroy(ReviewView **view) {
+    if (!view || !*view) {
+        return;
+    }
+    ReviewView *v = *view;
+    if (v->win) {
+        delwin(v->win);
+        v->win = NULL;
+    }
+
+    free(v);
+    v = NULL;
+    *view = NULL;
+}
+
+void rv_render(ReviewView *v, const RoundReview *r) {
+    curs_set(0);
+    werase(v->win);
+    box(v->win, 0, 0);
+
+    wmove(v->win, 0, 2);
+    waddstr(v->win, " MISTAKES ");
+    wmove(v->win, 2, 2);
+    wprintw(v->win, "WORDS MISSED:   %zu of %zu (%zu corrected)",
+            r->missed_words, r->text.word_count, r->fixed_words);
+    wmove(v->win, 3, 2);
+    wprintw(v->win, "CHARS MISSED:   %zu (%zu corrected)", r->missed_chars,
+            r->fixed_chars);
+
+    rv_render_text(v, r);
+
+    const char *instructions = " [B]ack  [N]ew  [Q]uit ";
+    wmove(v->win, v->height - 2, 2);
+    wattron(v->win, COLOR_PAIR(COLOR_PAIR_RED));
+    waddstr(v->win, "missed");
+    wattroff(v->win, COLOR_PAIR(COLOR_PAIR_RED));
+    waddstr(v->win, "  ");
+    wattron(v->win, COLOR_PAIR(COLOR_PAIR_YELLOW));
+    waddstr(v->win, "corrected");
+    wattroff(v->win, COLOR_PAIR(COLOR_PAIR_YELLOW));
+    wmove(v->win, v->height - 1,
+          MAX_N((v->width - (int)strlen(instructions)) / 2, 0));
+    waddstr(v->win, instructions);
+
+    wrefresh(v->win);
+}
+
+// The round's text wrapped to the window, words with a first-attempt miss
+// in red, or yellow if every miss was put right
+void rv_render_text(ReviewView *v, const RoundReview *r) {
+    const WordStore *ws = r->ws;
+    int left = 2;
+    int right = v->width - 2;
+    int bottom = v->height - 3;
+    int y = RV_TEXT_Y;
+    int x = left;
+    for (size_t i = 0; i < r->text.word_count; i++) {
+        uint32_t id = r->text.ids[i];
+        int chars = (int)ws->word_chars[id];
+        if (x > left && x + chars > right) {
+            y++;
+            x = left;
+        }
+        if (y >= bottom) {
+            wmove(v->win, bottom - 1, MAX_N(right - 3, left));
+            waddstr(v->win, "...");
+            return;
+        }
+
+        attr_t attrs = A_NORMAL;
+        int pair = COLOR_PAIR_WHITE;
+        if (r->missed[i]) {
+            pair = r->fixed[i] == r->missed[i] ? COLOR_PAIR_YELLOW
+                                               : COLOR_PAIR_RED;
+            attrs = A_BOLD;
+        }
+        wmove(v->win, y, x);
+        wattron(v->win, COLOR_PAIR(pair) | attrs);
+        waddnstr(v->win, ws->words[id],
+                 (int)rv_fit(ws->words[id], ws->word_lens[id],
+                             (size_t)MIN_N(chars, right - x)));
+        wattroff(v->win, COLOR_PAIR(pair) | attrs);
+        x += chars + 1;
+    }
+}
+
+// Bytes taken by the first n code points of a word of len bytes
+size_t rv_fit(const char *word, size_t len, size_t n) {
+    size_t b = 0;
+    for (size_t i = 0; i < n && b < len; i++) {
+        uint32_t c = 0;
+        size_t used = utf8_decode(word + b, len - b, &c);
+        b += used ? used : 1;
+    }
+    return b;
+}
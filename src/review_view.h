@@ -0,0 +1,15 @@
+#ifndef REVIEW_VIEW_H
+#define REVIEW_VIEW_H
+
+#include "constants.h"
+#include "err.h"
+#include "round_review.h"
+
+typedef struct ReviewView ReviewView;
+
+void review_view_init(Err **err, ReviewView **view);
+void review_view_run(Err **err, JankeyState *state, ReviewView *view,
+                     const RoundReview *review);
+void review_view_destroy(ReviewView **view);
+
+#endif
@@ -0,0 +1,27 @@
+#include "rng.h"
+#include <stdint.h>
+
+// Seeds are spread with a splitmix64 step so nearby seeds, such as
+// consecutive timestamps, start far apart and zero is usable
+void rng_seed(Rng *rng, uint64_t seed) {
+    uint64_t z = seed + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    rng->state = z ? z : 1;
+}
+
+// xorshift64*
+uint64_t rng_next(Rng *rng) {
+    uint64_t x = rng->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+// Uniform in [0, 1)
+double rng_unit(Rng *rng) {
+    return (double)(rng_next(rng) >> 11) * 0x1p-53;
+}
@@ -0,0 +1,16 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// A generator state owned by whoever draws from it, so sessions never share
+// one and a seed replays the same picks on any platform
+typedef struct Rng {
+    uint64_t state;
+} Rng;
+
+void rng_seed(Rng *rng, uint64_t seed);
+uint64_t rng_next(Rng *rng);
+double rng_unit(Rng *rng);
+
+#endif
@@ -0,0 +1,56 @@
+#include "round_review.h"
+#include "arena.h"
+#include "err.h"
+#include "helpers.h"
+#include "word_store.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Counts come from the bitsets the engine kept while typing, a popcount per
+// 64 chars, so the review never reads the chars or their colours back
+void round_review_build(Err **err, RoundReview *review, Arena *arena,
+                        const WordStore *ws, const TestText *text,
+                        const uint64_t *missed, const uint64_t *fixed,
+                        size_t bit_count) {
+    *review = (RoundReview){.ws = ws, .text = *text};
+    size_t n = text->word_count;
+    review->missed = ARENA_ALLOC(arena, uint16_t, MAX_N(n, (size_t)1));
+    review->fixed = ARENA_ALLOC(arena, uint16_t, MAX_N(n, (size_t)1));
+    if (!review->missed || !review->fixed) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate round review");
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        size_t from = MIN_N((size_t)text->offs[i], bit_count);
+        size_t to = MIN_N((size_t)text->offs[i + 1], bit_count);
+        size_t m = round_review_countbits(missed, from, to);
+        size_t f = round_review_countbits(fixed, from, to);
+        review->missed[i] = (uint16_t)MIN_N(m, (size_t)UINT16_MAX);
+        review->fixed[i] = (uint16_t)MIN_N(f, (size_t)UINT16_MAX);
+        review->missed_chars += m;
+        review->fixed_chars += f;
+        review->missed_words += m ? 1 : 0;
+        review->fixed_words += m && m == f ? 1 : 0;
+    }
+}
+
+// Set bits in [from, to)
+size_t round_review_countbits(const uint64_t *bits, size_t from, size_t to) {
+    if (from >= to) {
+        return 0;
+    }
+    size_t first = from / 64;
+    size_t last = (to - 1) / 64;
+    uint64_t head = ~(uint64_t)0 << (from % 64);
+    uint64_t tail = ~(uint64_t)0 >> (63 - (to - 1) % 64);
+    if (first == last) {
+        return (size_t)__builtin_popcountll(bits[first] & head & tail);
+    }
+
+    size_t n = (size_t)__builtin_popcountll(bits[first] & head);
+    for (size_t w = first + 1; w < last; w++) {
+        n += (size_t)__builtin_popcountll(bits[w]);
+    }
+    return n + (size_t)__builtin_popcountll(bits[last] & tail);
+}
@@ -0,0 +1,30 @@
+#ifndef ROUND_REVIEW_H
+#define ROUND_REVIEW_H
+
+#include "arena.h"
+#include "err.h"
+#include "word_store.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// A finished round's mistakes by word. Word i spans its chars and the space
+// after it. missed[i] counts chars wrong on the first attempt and fixed[i]
+// those of them retyped right later.
+typedef struct RoundReview {
+    const WordStore *ws;
+    TestText text;
+    uint16_t *missed;
+    uint16_t *fixed;
+    size_t missed_words;
+    size_t fixed_words;
+    size_t missed_chars;
+    size_t fixed_chars;
+} RoundReview;
+
+void round_review_build(Err **err, RoundReview *review, Arena *arena,
+                        const WordStore *ws, const TestText *text,
+                        const uint64_t *missed, const uint64_t *fixed,
+                        size_t bit_count);
+size_t round_review_countbits(const uint64_t *bits, size_t from, size_t to);
+
+#endif
@@ -0,0 +1,505 @@
+// clock_gettime, nanosleep, writev
+#define _POSIX_C_SOURCE 200809L
+#include "session_recorder.h"
+#include "err.h"
+#include "helpers.h"
+#include "utf8.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SR_QUEUE_SLOTS 1024u
+#define SR_BATCH_EVENTS 64
+#define SR_IDLE_NS 10000000L
+#define SR_BUFF_INITIAL 65536u
+#define SR_CACHE_LINE 64
+
+typedef enum SRKind {
+    SR_KIND_KEY,
+    SR_KIND_ROW,
+    SR_KIND_FRAME,
+    SR_KIND_RESIZE,
+} SRKind;
+
+// A queue slot. Rows carry their cells; keys, frame ends and resizes only
+// the two numbers.
+typedef struct SRRecord {
+    uint64_t t_ns;
+    uint32_t kind;
+    int32_t a;
+    int32_t b;
+    uint32_t width;
+    RecCell cells[SESSION_RECORDER_MAX_COLS];
+} SRRecord;
+
+// Recording must never hold up typing, so the input thread only copies
+// records into a single-producer ring and moves on; when the ring is full
+// the record is dropped and counted. A writer thread polls the ring, turns
+// records into asciicast v2 lines and writes a batch of them with one
+// writev, so a slow disk only ever stalls the writer.
+struct SessionRecorder {
+    _Atomic size_t head;
+    char head_pad[SR_CACHE_LINE - sizeof(size_t)];
+    _Atomic size_t tail;
+    char tail_pad[SR_CACHE_LINE - sizeof(size_t)];
+    _Atomic bool stop;
+    SRRecord *slots;
+    size_t dropped;
+    uint64_t frame_ns;
+    uint64_t start_ns;
+    int fd;
+    thrd_t writer;
+    bool writer_started;
+    // Writer thread only
+    char *buff;
+    size_t buff_len;
+    size_t buff_cap;
+    size_t event_off[SR_BATCH_EVENTS + 1];
+    size_t event_count;
+    bool in_frame;
+    bool failed;
+};
+
+uint64_t sr_now_ns(void);
+SRRecord *sr_claim(SessionRecorder *r);
+void sr_commit(SessionRecorder *r);
+int sr_writer_main(void *arg);
+bool sr_drain(SessionRecorder *r);
+void sr_format(SessionRecorder *r, const SRRecord *rec);
+void sr_format_row(SessionRecorder *r, const SRRecord *rec);
+void sr_event_begin(SessionRecorder *r, uint64_t t_ns, char code);
+void sr_event_end(SessionRecorder *r);
+void sr_put(SessionRecorder *r, const char *s, size_t len);
+void sr_putf(SessionRecorder *r, const char *fmt, ...);
+void sr_put_char(SessionRecorder *r, uint32_t cp);
+void sr_flush(SessionRecorder *r);
+bool sr_write_all(int fd, const char *s, size_t len);
+
+void session_recorder_init(Err **err, SessionRecorder **rec,
+                           const char *path, int width, int height) {
+    SessionRecorder *r = ZALLOC(sizeof(*r));
+    if (!r) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for session recorder");
+        return;
+    }
+    r->fd = -1;
+    r->slots = malloc(SR_QUEUE_SLOTS * sizeof(*r->slots));
+    r->buff = malloc(SR_BUFF_INITIAL);
+    if (!r->slots || !r->buff) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate recording queue");
+        session_recorder_destroy(&r);
+        return;
+    }
+    r->buff_cap = SR_BUFF_INITIAL;
+
+    r->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (r->fd < 0) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to create %s: %s", path,
+                             strerror(errno));
+        session_recorder_destroy(&r);
+        return;
+    }
+
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    char header[160];
+    int n = snprintf(header, sizeof(header),
+                     "{\"version\": 2, \"width\": %d, \"height\": %d, "
+                     "\"timestamp\": %lld, \"title\": \"jankey_type\"}\n",
+                     width, height, (long long)wall.tv_sec);
+    if (n < 0 || (size_t)n >= sizeof(header) ||
+        !sr_write_all(r->fd, header, (size_t)n)) {
+        *err = ERR_MAKE_CODE(ERR_IO, "Unable to write %s", path);
+        session_recorder_destroy(&r);
+        return;
+    }
+    r->start_ns = sr_now_ns();
+
+    if (thrd_create(&r->writer, sr_writer_main, r) != thrd_success) {
+        *err = ERR_MAKE("Unable to start recording thread");
+        session_recorder_destroy(&r);
+        return;
+    }
+    r->writer_started = true;
+
+    *rec = r;
+}
+
+// key is a code point or KEY_LOG_BACKSPACE, which is DEL
+void session_recorder_key(SessionRecorder *r, int key) {
+    SRRecord *rec = sr_claim(r);
+    if (!rec) {
+        return;
+    }
+    rec->t_ns = sr_now_ns();
+    rec->kind = SR_KIND_KEY;
+    rec->a = key;
+    sr_commit(r);
+}
+
+// Queue row y of the frame being drawn, false if it was dropped and has to
+// be sent again
+bool session_recorder_row(SessionRecorder *r, int y, const RecCell *cells,
+                          size_t width) {
+    SRRecord *rec = sr_claim(r);
+    if (!rec) {
+        return false;
+    }
+    if (!r->frame_ns) {
+        r->frame_ns = sr_now_ns();
+    }
+    width = MIN_N(width, (size_t)SESSION_RECORDER_MAX_COLS);
+    rec->t_ns = r->frame_ns;
+    rec->kind = SR_KIND_ROW;
+    rec->a = y;
+    rec->width = (uint32_t)width;
+    memcpy(rec->cells, cells, width * sizeof(*cells));
+    sr_commit(r);
+    return true;
+}
+
+// Close the frame whose rows were queued, leaving the cursor where it was
+// drawn
+void session_recorder_frame(SessionRecorder *r, int cursor_y, int cursor_x) {
+    SRRecord *rec = sr_claim(r);
+    if (!rec) {
+        return;
+    }
+    rec->t_ns = r->frame_ns ? r->frame_ns : sr_now_ns();
+    rec->kind = SR_KIND_FRAME;
+    rec->a = cursor_y;
+    rec->b = cursor_x;
+    sr_commit(r);
+    r->frame_ns = 0;
+}
+
+void session_recorder_resize(SessionRecorder *r, int width, int height) {
+    SRRecord *rec = sr_claim(r);
+    if (!rec) {
+        return;
+    }
+    rec->t_ns = sr_now_ns();
+    rec->kind = SR_KIND_RESIZE;
+    rec->a = width;
+    rec->b = height;
+    sr_commit(r);
+}
+
+// Write out everything queued, then note any records that were dropped
+void session_recorder_destroy(SessionRecorder **rec) {
+    if (!rec || !*rec) {
+        return;
+    }
+    SessionRecorder *r = *rec;
+    if (r->writer_started) {
+        atomic_store_explicit(&r->stop, true, memory_order_release);
+        thrd_join(r->writer, NULL);
+    }
+    if (r->fd >= 0 && r->dropped && !r->failed) {
+        double t = (double)(sr_now_ns() - r->start_ns) / 1e9;
+        char line[96];
+        int n = snprintf(line, sizeof(line),
+                         "[%.6f, \"m\", \"%zu records dropped\"]\n", t,
+                         r->dropped);
+        if (n > 0 && (size_t)n < sizeof(line)) {
+            sr_write_all(r->fd, line, (size_t)n);
+        }
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    free(r->slots);
+    free(r->buff);
+    free(r);
+    *rec = NULL;
+}
+
+uint64_t sr_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// The next free slot, NULL if the writer has fallen a whole ring behind
+SRRecord *sr_claim(SessionRecorder *r) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - tail == SR_QUEUE_SLOTS) {
+        r->dropped++;
+        return NULL;
+    }
+    return &r->slots[head % SR_QUEUE_SLOTS];
+}
+
+void sr_commit(SessionRecorder *r) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+int sr_writer_main(void *arg) {
+    SessionRecorder *r = arg;
+    struct timespec idle = {.tv_sec = 0, .tv_nsec = SR_IDLE_NS};
+    for (;;) {
+        // Seen before the drain, so records queued before stop are written
+        bool stopping = atomic_load_explicit(&r->stop, memory_order_acquire);
+        if (sr_drain(r)) {
+            continue;
+        }
+        if (stopping) {
+            break;
+        }
+        nanosleep(&idle, NULL);
+    }
+    if (r->in_frame) {
+        sr_event_end(r);
+        r->in_frame = false;
+        sr_flush(r);
+    }
+    return 0;
+}
+
+// Format and write whatever is queued, false if there was nothing
+bool sr_drain(SessionRecorder *r) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail == head) {
+        return false;
+    }
+    for (; tail != head; tail++) {
+        sr_format(r, &r->slots[tail % SR_QUEUE_SLOTS]);
+        // The record is copied out, so its slot can be reused
+        atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+        if (r->event_count == SR_BATCH_EVENTS) {
+            sr_flush(r);
+        }
+    }
+    if (!r->in_frame) {
+        sr_flush(r);
+    }
+    return true;
+}
+
+void sr_format(SessionRecorder *r, const SRRecord *rec) {
+    // A frame whose end was dropped is closed before the next event
+    if (r->in_frame && rec->kind != SR_KIND_ROW &&
+        rec->kind != SR_KIND_FRAME) {
+        sr_event_end(r);
+        r->in_frame = false;
+    }
+    switch ((SRKind)rec->kind) {
+    case SR_KIND_KEY:
+        sr_event_begin(r, rec->t_ns, 'i');
+        sr_put_char(r, (uint32_t)rec->a);
+        sr_event_end(r);
+        break;
+    case SR_KIND_ROW:
+        sr_format_row(r, rec);
+        break;
+    case SR_KIND_FRAME:
+        if (!r->in_frame) {
+            sr_event_begin(r, rec->t_ns, 'o');
+            r->in_frame = true;
+        }
+        sr_putf(r, "\\u001b[0m\\u001b[%d;%dH", rec->a + 1, rec->b + 1);
+        sr_event_end(r);
+        r->in_frame = false;
+        break;
+    case SR_KIND_RESIZE:
+        sr_event_begin(r, rec->t_ns, 'r');
+        sr_putf(r, "%dx%d", rec->a, rec->b);
+        sr_event_end(r);
+        break;
+    default:
+        break;
+    }
+}
+
+// Repaint a whole row, switching style only where it changes
+void sr_format_row(SessionRecorder *r, const SRRecord *rec) {
+    if (!r->in_frame) {
+        sr_event_begin(r, rec->t_ns, 'o');
+        r->in_frame = true;
+    }
+    sr_putf(r, "\\u001b[%d;1H", rec->a + 1);
+
+    bool styled = false;
+    RecCell style = {0};
+    for (uint32_t x = 0; x < rec->width; x++) {
+        const RecCell *c = &rec->cells[x];
+        if (!styled || c->fg != style.fg || c->bg != style.bg ||
+            c->attrs != style.attrs) {
+            sr_put(r, "\\u001b[0", 8);
+            if (c->attrs & REC_ATTR_BOLD) {
+                sr_put(r, ";1", 2);
+            }
+            if (c->attrs & REC_ATTR_DIM) {
+                sr_put(r, ";2", 2);
+            }
+            if (c->attrs & REC_ATTR_UNDERLINE) {
+                sr_put(r, ";4", 2);
+            }
+            if (c->attrs & REC_ATTR_REVERSE) {
+                sr_put(r, ";7", 2);
+            }
+            if (c->fg != REC_COLOR_DEFAULT) {
+                sr_putf(r, c->fg < 8 ? ";%u" : ";38;5;%u",
+                        c->fg < 8 ? 30u + c->fg : (unsigned)c->fg);
+            }
+            if (c->bg != REC_COLOR_DEFAULT) {
+                sr_putf(r, c->bg < 8 ? ";%u" : ";48;5;%u",
+                        c->bg < 8 ? 40u + c->bg : (unsigned)c->bg);
+            }
+            sr_put(r, "m", 1);
+            style = *c;
+            styled = true;
+        }
+        uint32_t cp = c->cp < 0x20 ? ' ' : c->cp;
+        sr_put_char(r, cp);
+        // The terminal fills the next column itself
+        if (utf8_width(cp) == 2) {
+            x++;
+        }
+    }
+}
+
+void sr_event_begin(SessionRecorder *r, uint64_t t_ns, char code) {
+    if (r->event_count == SR_BATCH_EVENTS) {
+        sr_flush(r);
+    }
+    r->event_off[r->event_count] = r->buff_len;
+    uint64_t since = t_ns > r->start_ns ? t_ns - r->start_ns : 0;
+    sr_putf(r, "[%.6f, \"%c\", \"", (double)since / 1e9, code);
+}
+
+void sr_event_end(SessionRecorder *r) {
+    sr_put(r, "\"]\n", 3);
+    r->event_count++;
+}
+
+void sr_put(SessionRecorder *r, const char *s, size_t len) {
+    if (r->buff_len + len > r->buff_cap) {
+        size_t cap = r->buff_cap * 2;
+        while (cap < r->buff_len + len) {
+            cap *= 2;
+        }
+        char *buff = realloc(r->buff, cap);
+        if (!buff) {
+            r->failed = true;
+            return;
+        }
+        r->buff = buff;
+        r->buff_cap = cap;
+    }
+    memcpy(r->buff + r->buff_len, s, len);
+    r->buff_len += len;
+}
+
+void sr_putf(SessionRecorder *r, const char *fmt, ...) {
+    char s[64];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(s, sizeof(s), fmt, args);
+    va_end(args);
+    if (n > 0) {
+        sr_put(r, s, MIN_N((size_t)n, sizeof(s) - 1));
+    }
+}
+
+// A code point inside a JSON string
+void sr_put_char(SessionRecorder *r, uint32_t cp) {
+    if (cp == '"' || cp == '\\') {
+        char s[2] = {'\\', (char)cp};
+        sr_put(r, s, 2);
+        return;
+    }
+    if (cp < 0x20 || cp == 0x7f) {
+        sr_putf(r, "\\u%04x", cp);
+        return;
+    }
+    char s[UTF8_MAX];
+    size_t n = utf8_encode(cp, s);
+    if (!n) {
+        n = utf8_encode(0xfffd, s);
+    }
+    sr_put(r, s, n);
+}
+
+// Write the batched events with one writev. After a write error the rest
+// of the session is drained and discarded.
+void sr_flush(SessionRecorder *r) {
+    if (!r->event_count) {
+        return;
+    }
+    struct iovec iov[SR_BATCH_EVENTS];
+    for (size_t i = 0; i < r->event_count; i++) {
+        size_t end =
+            i + 1 < r->event_count ? r->event_off[i + 1] : r->buff_len;
+        iov[i].iov_base = r->buff + r->event_off[i];
+        iov[i].iov_len = end - r->event_off[i];
+    }
+
+    // A frame still open carries over to the next batch
+    size_t count = r->event_count;
+    size_t open_off = r->buff_len;
+    size_t open_len = 0;
+    if (r->in_frame) {
+        open_off = r->event_off[count];
+        open_len = r->buff_len - open_off;
+        iov[count - 1].iov_len = open_off - r->event_off[count - 1];
+    }
+
+    struct iovec *v = iov;
+    int left = (int)count;
+    while (!r->failed && left > 0) {
+        ssize_t n = writev(r->fd, v, left);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            r->failed = true;
+            break;
+        }
+        size_t done = (size_t)n;
+        while (left > 0 && done >= v->iov_len) {
+            done -= v->iov_len;
+            v++;
+            left--;
+        }
+        if (left > 0) {
+            v->iov_base = (char *)v->iov_base + done;
+            v->iov_len -= done;
+        }
+    }
+
+    memmove(r->buff, r->buff + open_off, open_len);
+    r->buff_len = open_len;
+    r->event_off[0] = 0;
+    r->event_count = 0;
+}
+
+bool sr_write_all(int fd, const char *s, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, s, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        s += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include "err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Columns past this are not recorded
+#define SESSION_RECORDER_MAX_COLS 512
+#define REC_COLOR_DEFAULT 0xff
+
+#define REC_ATTR_BOLD 0x1
+#define REC_ATTR_DIM 0x2
+#define REC_ATTR_UNDERLINE 0x4
+#define REC_ATTR_REVERSE 0x8
+
+// One screen cell as drawn. Colours are terminal palette indices or
+// REC_COLOR_DEFAULT. A wide char's second column is skipped when written.
+typedef struct RecCell {
+    uint32_t cp;
+    uint8_t fg;
+    uint8_t bg;
+    uint8_t attrs;
+    uint8_t pad;
+} RecCell;
+
+typedef struct SessionRecorder SessionRecorder;
+
+void session_recorder_init(Err **err, SessionRecorder **rec,
+                           const char *path, int width, int height);
+void session_recorder_key(SessionRecorder *rec, int key);
+bool session_recorder_row(SessionRecorder *rec, int y, const RecCell *cells,
+                          size_t width);
+void session_recorder_frame(SessionRecorder *rec, int cursor_y, int cursor_x);
+void session_recorder_resize(SessionRecorder *rec, int width, int height);
+void session_recorder_destroy(SessionRecorder **rec);
+
+#endif
@@ -0,0 +1,156 @@
+#include "string_pool.h"
+#include "err.h"
+#include "helpers.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SP_BLOCK_SIZE 65536
+#define SP_MIN_SLOTS 1024
+
+// Interned strings are NUL terminated runs in fixed blocks that are never
+// moved, so pointers stay valid for the life of the pool. An open addressing
+// set over the strings, keeping each hash beside it, finds repeats.
+typedef struct SPBlock {
+    struct SPBlock *next;
+    size_t used;
+    size_t cap;
+    char data[];
+} SPBlock;
+
+struct StringPool {
+    SPBlock *blocks;
+    char **slots;
+    uint32_t *hashes;
+    size_t slot_count;
+    size_t count;
+};
+
+bool sp_grow(StringPool *sp);
+char *sp_store(StringPool *sp, const char *s, size_t len);
+
+void string_pool_init(Err **err, StringPool **pool) {
+    StringPool *sp = ZALLOC(sizeof(*sp));
+    if (!sp) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for string pool");
+        return;
+    }
+    if (!sp_grow(sp)) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate string set");
+        string_pool_destroy(&sp);
+        return;
+    }
+
+    *pool = sp;
+}
+
+// The pooled copy of s, shared with every earlier intern of the same string.
+// Callers must treat the returned string as read-only.
+char *string_pool_intern(Err **err, StringPool *sp, const char *s,
+                         size_t len) {
+    if (*err) {
+        return NULL;
+    }
+    if ((sp->count + 1) * 2 > sp->slot_count && !sp_grow(sp)) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to grow string set");
+        return NULL;
+    }
+
+    uint32_t h = hash_fnv1a(s, len);
+    size_t mask = sp->slot_count - 1;
+    size_t i = h & mask;
+    while (sp->slots[i]) {
+        const char *t = sp->slots[i];
+        if (sp->hashes[i] == h && !strncmp(t, s, len) && t[len] == '\0') {
+            return sp->slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+
+    char *copy = sp_store(sp, s, len);
+    if (!copy) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate string block");
+        return NULL;
+    }
+    sp->slots[i] = copy;
+    sp->hashes[i] = h;
+    sp->count++;
+    return copy;
+}
+
+size_t string_pool_count(const StringPool *sp) { return sp->count; }
+
+void string_pool_destroy(StringPool **pool) {
+    if (!pool || !*pool) {
+        return;
+    }
+
+    StringPool *sp = *pool;
+    SPBlock *b = sp->blocks;
+    while (b) {
+        SPBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    free(sp->slots);
+    free(sp->hashes);
+
+    free(sp);
+    sp = NULL;
+    *pool = NULL;
+}
+
+// Double the set, rehashing from the stored hashes
+bool sp_grow(StringPool *sp) {
+    size_t slot_count = MAX_N(sp->slot_count * 2, (size_t)SP_MIN_SLOTS);
+    char **slots = calloc(slot_count, sizeof(*slots));
+    uint32_t *hashes = calloc(slot_count, sizeof(*hashes));
+    if (!slots || !hashes) {
+        free(slots);
+        free(hashes);
+        return false;
+    }
+
+    size_t mask = slot_count - 1;
+    for (size_t i = 0; i < sp->slot_count; i++) {
+        if (!sp->slots[i]) {
+            continue;
+        }
+        size_t j = sp->hashes[i] & mask;
+        while (slots[j]) {
+            j = (j + 1) & mask;
+        }
+        slots[j] = sp->slots[i];
+        hashes[j] = sp->hashes[i];
+    }
+    free(sp->slots);
+    free(sp->hashes);
+    sp->slots = slots;
+    sp->hashes = hashes;
+    sp->slot_count = slot_count;
+    return true;
+}
+
+// Copy a string into the current block, starting a new one when it is full
+char *sp_store(StringPool *sp, const char *s, size_t len) {
+    SPBlock *b = sp->blocks;
+    if (!b || b->cap - b->used < len + 1) {
+        size_t cap = MAX_N(len + 1, (size_t)SP_BLOCK_SIZE);
+        b = malloc(sizeof(*b) + cap);
+        if (!b) {
+            return NULL;
+        }
+        b->next = sp->blocks;
+        b->used = 0;
+        b->cap = cap;
+        sp->blocks = b;
+    }
+
+    char *copy = &b->data[b->used];
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    b->used += len + 1;
+    return copy;
+}
@@ -0,0 +1,15 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include "err.h"
+#include <stddef.h>
+
+typedef struct StringPool StringPool;
+
+void string_pool_init(Err **err, StringPool **pool);
+char *string_pool_intern(Err **err, StringPool *pool, const char *s,
+                         size_t len);
+size_t string_pool_count(const StringPool *pool);
+void string_pool_destroy(StringPool **pool);
+
+#endif
@@ -0,0 +1,117 @@
+// clock_gettime, getpid
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TR_RING_CAP 65536u
+#define TR_PATH_ENV "JANKEY_TRACE_FILE"
+#define TR_DEFAULT_PATH "jankey_trace.json"
+
+typedef struct TREvent {
+    uint64_t ts_ns;
+    const char *name;
+    TracePhase phase;
+} TREvent;
+
+// Each thread records into its own ring, so an event is a clock read and a
+// store with no lock or read-modify-write. The owner publishes its head with
+// a release store and the exit flush reads up to it. A full ring overwrites
+// its oldest events. Rings are pushed once onto a lock-free list that the
+// flush walks.
+typedef struct TRRing {
+    struct TRRing *next;
+    uint32_t tid;
+    _Atomic uint64_t head;
+    TREvent events[TR_RING_CAP];
+} TRRing;
+
+static _Atomic(TRRing *) tr_rings = NULL;
+static atomic_uint tr_next_tid = 0;
+static thread_local TRRing *tr_ring = NULL;
+static thread_local int tr_ring_failed = 0;
+static once_flag tr_once = ONCE_FLAG_INIT;
+static uint64_t tr_epoch_ns = 0;
+
+TRRing *tr_thread_ring(void);
+void tr_setup(void);
+void tr_flush(void);
+uint64_t tr_now_ns(void);
+
+void trace_event(const char *name, TracePhase phase) {
+    TRRing *r = tr_ring ? tr_ring : tr_thread_ring();
+    if (!r) {
+        return;
+    }
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    r->events[head % TR_RING_CAP] = (TREvent){tr_now_ns(), name, phase};
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+// First event on a thread: allocate its ring and list it for the flush
+TRRing *tr_thread_ring(void) {
+    if (tr_ring_failed) {
+        return NULL;
+    }
+    call_once(&tr_once, tr_setup);
+    TRRing *r = calloc(1, sizeof(*r));
+    if (!r) {
+        tr_ring_failed = 1;
+        return NULL;
+    }
+    r->tid = atomic_fetch_add(&tr_next_tid, 1) + 1;
+    r->next = atomic_load_explicit(&tr_rings, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(
+        &tr_rings, &r->next, r, memory_order_release, memory_order_relaxed)) {
+    }
+    tr_ring = r;
+    return r;
+}
+
+void tr_setup(void) {
+    tr_epoch_ns = tr_now_ns();
+    atexit(tr_flush);
+}
+
+// Write every ring as trace event JSON. Timestamps are microseconds since
+// the first event.
+void tr_flush(void) {
+    const char *path = getenv(TR_PATH_ENV);
+    FILE *f = fopen(path && *path ? path : TR_DEFAULT_PATH, "w");
+    if (!f) {
+        return;
+    }
+
+    long pid = (long)getpid();
+    const char *sep = "";
+    fprintf(f, "{\"traceEvents\":[");
+    TRRing *r = atomic_load_explicit(&tr_rings, memory_order_acquire);
+    for (; r; r = r->next) {
+        uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        uint64_t start = head > TR_RING_CAP ? head - TR_RING_CAP : 0;
+        for (uint64_t i = start; i < head; i++) {
+            const TREvent *e = &r->events[i % TR_RING_CAP];
+            uint64_t ns = e->ts_ns - tr_epoch_ns;
+            fprintf(f,
+                    "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03llu,"
+                    "\"pid\":%ld,\"tid\":%u}",
+                    sep, e->name, (char)e->phase,
+                    (unsigned long long)(ns / 1000),
+                    (unsigned long long)(ns % 1000), pid, r->tid);
+            sep = ",";
+        }
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(f);
+}
+
+uint64_t tr_now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
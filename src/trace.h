@@ -0,0 +1,27 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Trace points for chrome://tracing and Perfetto, compiled in only when
+// built with -DJANKEY_TRACE=ON. Spans are named by string literals and must
+// nest within a thread. Events go to JANKEY_TRACE_FILE, or
+// jankey_trace.json in the working directory, when the process exits.
+#ifdef JANKEY_TRACE
+
+typedef enum TracePhase {
+    TRACE_PHASE_BEGIN = 'B',
+    TRACE_PHASE_END = 'E',
+} TracePhase;
+
+void trace_event(const char *name, TracePhase phase);
+
+#define TRACE_BEGIN(name) trace_event((name), TRACE_PHASE_BEGIN)
+#define TRACE_END(name) trace_event((name), TRACE_PHASE_END)
+
+#else
+
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END(name) ((void)0)
+
+#endif
+
+#endif
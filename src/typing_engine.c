@@ -0,0 +1,303 @@
+#define _POSIX_C_SOURCE 199309L
+#include "typing_engine.h"
+#include "arena.h"
+#include "err.h"
+#include "helpers.h"
+#include "key_heatmap.h"
+#include "key_log.h"
+#include "typing_test_stats.h"
+#include "word_store.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The keystroke core of a round with no terminal attached: it moves the
+// cursor over the text, scores keys and feeds the heatmap and key log. The
+// typing test mirrors each key into its view; the load generator drives
+// engines headless.
+struct TypingEngine {
+    const WordStore *ws;
+    TestText text;
+    size_t len;
+    size_t cursor;
+    size_t reach;
+    KeyHeatmap *heatmap;
+    KeyLog *key_log;
+    TypingTestStats *stats;
+    bool started;
+    double typed_char_count;
+    double correct_char_count;
+    bool has_prev_key;
+    size_t prev_key_index;
+    struct timespec prev_key_time;
+    uint64_t *seen;
+    uint64_t *missed;
+    uint64_t *fixed;
+    size_t bit_count;
+};
+
+#define TE_BIT_WORD(i) ((i) / 64)
+#define TE_BIT_MASK(i) ((uint64_t)1 << ((i) % 64))
+
+void te_record_heat(TypingEngine *e, size_t index, uint32_t typed);
+void te_record_miss(TypingEngine *e, size_t index, bool correct);
+size_t te_word_of(const TypingEngine *e, size_t i);
+
+void typing_engine_init(Err **err, TypingEngine **engine) {
+    TypingEngine *e = ZALLOC(sizeof(*e));
+    if (!e) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for typing engine");
+        return;
+    }
+    *engine = e;
+}
+
+// Start a round over text. The round's heatmap and key log encoding live in
+// arena, which must outlive the round.
+void typing_engine_begin(Err **err, TypingEngine *e, Arena *arena,
+                         const WordStore *ws, const TestText *text,
+                         TypingTestStats *stats, KeyLog *key_log) {
+    if (*err) {
+        return;
+    }
+
+    // Per-round key and bigram counters, merged into history after the round
+    e->heatmap = ARENA_ALLOC(arena, KeyHeatmap, 1);
+    if (!e->heatmap) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate round heatmap");
+        return;
+    }
+    key_heatmap_clear(e->heatmap);
+
+    // One bit per char of the text for whether it has been typed, was wrong
+    // the first time and has since been put right
+    size_t bit_words = (text->len + 63) / 64;
+    e->seen = ARENA_ALLOC(arena, uint64_t, bit_words * 3);
+    if (!e->seen && bit_words) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate round error bits");
+        return;
+    }
+    if (bit_words) {
+        memset(e->seen, 0, bit_words * 3 * sizeof(*e->seen));
+    }
+    e->missed = e->seen + bit_words;
+    e->fixed = e->missed + bit_words;
+    e->bit_count = text->len;
+
+    // Keystrokes are optionally encoded for replay
+    e->key_log = key_log;
+    if (key_log) {
+        key_log_begin(err, key_log, arena, ws->dict_hash, text->ids,
+                      text->word_count, text->len);
+        if (*err) {
+            return;
+        }
+    }
+
+    e->ws = ws;
+    e->text = *text;
+    e->len = text->len;
+    e->cursor = 0;
+    e->reach = 0;
+    e->stats = stats;
+    e->started = false;
+    e->typed_char_count = 0.;
+    e->correct_char_count = 0.;
+    e->has_prev_key = false;
+}
+
+// key is a code point or KEY_LOG_BACKSPACE. An 'X' inserts rather than
+// overtypes. The cursor stops on the last char, so a key that leaves it
+// where it was ends the round.
+void typing_engine_key(TypingEngine *e, int key, EngineKey *out) {
+    *out = (EngineKey){.index = e->cursor, .cursor = e->cursor};
+
+    if (key == KEY_LOG_BACKSPACE) {
+        out->backspace = true;
+        e->has_prev_key = false;
+        if (!e->cursor) {
+            return;
+        }
+        if (e->key_log) {
+            key_log_push(e->key_log, KEY_LOG_BACKSPACE, e->cursor - 1, false);
+        }
+        // Deleting at the end of the typed text pulls the end back
+        e->reach = e->reach == e->cursor ? e->cursor - 1 : e->reach;
+        e->cursor--;
+        out->index = e->cursor;
+        out->cursor = e->cursor;
+        out->expected = typing_engine_charat(e, e->cursor);
+        return;
+    }
+
+    if (!e->started) {
+        if (e->stats) {
+            tt_stats_start(e->stats);
+        }
+        e->started = true;
+    }
+
+    uint32_t c = (uint32_t)key;
+    size_t index = e->cursor;
+    e->typed_char_count++;
+    out->expected = typing_engine_charat(e, index);
+    out->correct = out->expected == c;
+    if (out->correct) {
+        e->correct_char_count++;
+    }
+    if (e->key_log) {
+        key_log_push(e->key_log, key, index, out->correct);
+    }
+    te_record_heat(e, index, c);
+    te_record_miss(e, index, out->correct);
+
+    size_t len = e->len;
+    out->insert = c == 'X';
+    if (out->insert) {
+        e->len++;
+    }
+    if (index + 1 < len) {
+        e->cursor++;
+    }
+    e->reach = MAX_N(e->reach, e->cursor);
+    out->cursor = e->cursor;
+}
+
+// Ctrl+Backspace: delete back to the start of the word the cursor is in, or
+// of the word before when the cursor is at a word start, taking its space.
+// The key log sees a backspace per char, as if each had been deleted.
+void typing_engine_deleteword(TypingEngine *e, EngineKey *out) {
+    *out = (EngineKey){.index = e->cursor, .cursor = e->cursor,
+                       .backspace = true};
+    e->has_prev_key = false;
+    if (!e->cursor) {
+        return;
+    }
+    size_t start = e->text.offs[te_word_of(e, e->cursor - 1)];
+    if (e->key_log) {
+        for (size_t i = e->cursor; i > start; i--) {
+            key_log_push(e->key_log, KEY_LOG_BACKSPACE, i - 1, false);
+        }
+    }
+    out->deleted = e->cursor - start;
+    e->reach = e->reach == e->cursor ? start : e->reach;
+    e->cursor = start;
+    out->index = start;
+    out->cursor = start;
+    out->expected = typing_engine_charat(e, start);
+}
+
+// Ctrl+Left and Ctrl+Right: move to the start of the word, as far back as a
+// word deletion would go, or of the next word but never past what has been
+// typed. Nothing is deleted, the chars passed are typed over.
+void typing_engine_jumpword(TypingEngine *e, bool forward, EngineKey *out) {
+    e->has_prev_key = false;
+    size_t to = e->cursor;
+    if (!forward && e->cursor) {
+        to = e->text.offs[te_word_of(e, e->cursor - 1)];
+    } else if (forward) {
+        size_t w = te_word_of(e, e->cursor);
+        to = MIN_N((size_t)e->text.offs[w + 1], e->reach);
+    }
+    e->cursor = to;
+    *out = (EngineKey){.index = to, .cursor = to};
+}
+
+uint32_t typing_engine_charat(const TypingEngine *e, size_t i) {
+    return word_store_textchar(e->ws, &e->text, i);
+}
+
+bool typing_engine_started(const TypingEngine *e) { return e->started; }
+
+double typing_engine_accuracy(const TypingEngine *e) {
+    return (e->correct_char_count / e->typed_char_count) * 100.;
+}
+
+// Keys typed this round, not counting backspaces, and how many were right
+void typing_engine_counts(const TypingEngine *e, size_t *typed,
+                          size_t *correct) {
+    *typed = (size_t)e->typed_char_count;
+    *correct = (size_t)e->correct_char_count;
+}
+
+// Bit i of missed is set if char i of the text was wrong on its first
+// attempt, and of fixed if it has been retyped right since
+void typing_engine_errorbits(const TypingEngine *e, const uint64_t **missed,
+                             const uint64_t **fixed, size_t *bit_count) {
+    *missed = e->missed;
+    *fixed = e->fixed;
+    *bit_count = e->bit_count;
+}
+
+const WordStore *typing_engine_wordstore(const TypingEngine *e) {
+    return e->ws;
+}
+
+const KeyHeatmap *typing_engine_heatmap(const TypingEngine *e) {
+    return e->heatmap;
+}
+
+void typing_engine_destroy(TypingEngine **engine) {
+    if (!engine || !*engine) {
+        return;
+    }
+    free(*engine);
+    *engine = NULL;
+}
+
+// Chars past the text, typed after an inserting 'X', are not tracked
+void te_record_miss(TypingEngine *e, size_t index, bool correct) {
+    if (index >= e->bit_count) {
+        return;
+    }
+    size_t w = TE_BIT_WORD(index);
+    uint64_t m = TE_BIT_MASK(index);
+    if (!(e->seen[w] & m)) {
+        e->seen[w] |= m;
+        e->missed[w] |= correct ? 0 : m;
+    } else if (e->missed[w] & m) {
+        e->fixed[w] = correct ? e->fixed[w] | m : e->fixed[w] & ~m;
+    }
+}
+
+// The word whose span, chars and the space after, holds char i. offs is
+// the word start index, so this is a binary search.
+size_t te_word_of(const TypingEngine *e, size_t i) {
+    size_t lo = 0;
+    size_t hi = e->text.word_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (e->text.offs[mid] <= i) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void te_record_heat(TypingEngine *e, size_t index, uint32_t typed) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint32_t expected = typing_engine_charat(e, index);
+    key_heatmap_key(e->heatmap, expected, typed);
+
+    // Only consecutive forward keystrokes form a bigram transition
+    if (e->has_prev_key && index == e->prev_key_index + 1) {
+        int64_t ms =
+            (int64_t)(now.tv_sec - e->prev_key_time.tv_sec) * 1000 +
+            (int64_t)(now.tv_nsec - e->prev_key_time.tv_nsec) / 1000000;
+        key_heatmap_bigram(e->heatmap, typing_engine_charat(e, index - 1),
+                           expected, expected != typed,
+                           (uint32_t)MAX_N(ms, 0));
+    }
+
+    e->has_prev_key = true;
+    e->prev_key_index = index;
+    e->prev_key_time = now;
+}
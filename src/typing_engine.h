@@ -0,0 +1,49 @@
+#ifndef TYPING_ENGINE_H
+#define TYPING_ENGINE_H
+
+#include "arena.h"
+#include "err.h"
+#include "key_heatmap.h"
+#include "key_log.h"
+#include "typing_test_stats.h"
+#include "word_store.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct TypingEngine TypingEngine;
+
+// What a keystroke did, for a view to mirror. index is the char it hit and
+// cursor where typing continues. A word deletion removes deleted chars back
+// to index.
+typedef struct EngineKey {
+    size_t index;
+    size_t cursor;
+    size_t deleted;
+    uint32_t expected;
+    bool backspace;
+    bool correct;
+    bool insert;
+} EngineKey;
+
+void typing_engine_init(Err **err, TypingEngine **engine);
+void typing_engine_begin(Err **err, TypingEngine *engine, Arena *arena,
+                         const WordStore *ws, const TestText *text,
+                         TypingTestStats *stats, KeyLog *key_log);
+void typing_engine_key(TypingEngine *engine, int key, EngineKey *out);
+void typing_engine_deleteword(TypingEngine *engine, EngineKey *out);
+void typing_engine_jumpword(TypingEngine *engine, bool forward,
+                            EngineKey *out);
+uint32_t typing_engine_charat(const TypingEngine *engine, size_t i);
+bool typing_engine_started(const TypingEngine *engine);
+double typing_engine_accuracy(const TypingEngine *engine);
+void typing_engine_counts(const TypingEngine *engine, size_t *typed,
+                          size_t *correct);
+void typing_engine_errorbits(const TypingEngine *engine,
+                             const uint64_t **missed, const uint64_t **fixed,
+                             size_t *bit_count);
+const WordStore *typing_engine_wordstore(const TypingEngine *engine);
+const KeyHeatmap *typing_engine_heatmap(const TypingEngine *engine);
+void typing_engine_destroy(TypingEngine **engine);
+
+#endif
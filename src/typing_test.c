@@ -1,10 +1,23 @@
 #define _POSIX_C_SOURCE 199309L
 #include "typing_test.h"
+#include "arena.h"
 #include "constants.h"
 #include "err.h"
+#include "ghost.h"
 #include "helpers.h"
+#include "key_heatmap.h"
+#include "key_log.h"
+#include "live_stats.h"
+#include "race_client.h"
+#include "race_protocol.h"
+#include "rng.h"
+#include "round_review.h"
+#include "session_recorder.h"
+#include "trace.h"
+#include "typing_engine.h"
 #include "typing_test_stats.h"
 #include "typing_test_view.h"
+#include "utf8.h"
 #include "word_store.h"
 #include <limits.h>
 #include <ncurses.h>
@@ -16,62 +29,159 @@
 #include <string.h>
 #include <time.h>
 
+// Colour pairs past this are recorded in the default colours
+#define TT_REC_PAIRS 16
+
+// Word editing keys from tt_readkey, past the last code point
+#define TT_KEY_DELETE_WORD 0x110000
+#define TT_KEY_WORD_LEFT 0x110001
+#define TT_KEY_WORD_RIGHT 0x110002
+#define TT_CTRL_W 0x17
+
 struct TypingTest {
+    Arena *arena;
     TypingTestView *view;
-    char *test_str;
-    uint64_t test_str_len;
-    bool test_started;
-    double typed_char_count;
-    double correct_char_count;
+    TypingEngine *engine;
+    Rng rng;
+    TestText text;
+    char utf8[UTF8_MAX];
+    size_t utf8_len;
+    int key_word_left;
+    int key_word_right;
+    uint32_t *restore;
+    size_t restore_cap;
+    RaceClient *race;
+    struct timespec race_sent;
+    Ghost *ghost;
+    struct timespec started_at;
+    LiveStats *live;
+    LiveSnapshot live_snap;
+    RoundReview review;
+    bool reviewed;
+    SessionRecorder *rec;
+    cchar_t *rec_screen;
+    RecCell *rec_row;
+    int rec_rows;
+    int rec_cols;
+    uint8_t rec_fg[TT_REC_PAIRS];
+    uint8_t rec_bg[TT_REC_PAIRS];
 };
 
-size_t tt_update(TypingTest *tt, TypingTestStats *stats, size_t index,
-                 int input);
+int tt_readkey(TypingTest *tt, int ui);
+size_t tt_update(Err **err, TypingTest *tt, int input);
+size_t tt_update_word(Err **err, TypingTest *tt, int input);
+bool tt_race_sync(Err **err, TypingTest *tt, TypingTestStats *stats,
+                  size_t index);
+void tt_ghost_sync(Err **err, TypingTest *tt);
+void tt_live_key(TypingTest *tt, size_t index);
+void tt_live_done(TypingTest *tt, TypingTestStats *stats);
+void tt_record_frame(TypingTest *tt);
+bool tt_record_resize(TypingTest *tt, int rows, int cols);
 
 void typing_test_init(Err **err, TypingTest **typing_test) {
 
     TypingTest *t = ZALLOC(sizeof(*t));
     if (!t) {
-        *err = ERR_MAKE("Unable to allocate memory for typing test");
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for typing test");
         return;
     }
 
-    t->test_str_len = 0;
-    t->test_str = NULL;
     t->view = NULL;
 
+    // Each test draws its words from its own generator
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    rng_seed(&t->rng, (uint64_t)now.tv_sec * 1000000000u ^
+                          (uint64_t)now.tv_nsec ^ (uintptr_t)t);
+
+    // All per-round memory is carved from the arena and released in one go
+    // when the next round starts
+    arena_init(err, &t->arena, ROUND_ARENA_CAP);
+    if (*err) {
+        typing_test_destroy(&t);
+        return;
+    }
+
+    typing_engine_init(err, &t->engine);
+    if (*err) {
+        typing_test_destroy(&t);
+        return;
+    }
+
+    // Ctrl+arrows have no fixed key codes, terminfo names them
+    t->key_word_left = key_defined("kLFT5");
+    t->key_word_right = key_defined("kRIT5");
+
     *typing_test = t;
     return;
 }
 
 void typing_test_run(Err **err, JankeyState *state, TypingTest *tt,
-                     WordStore *ws, size_t word_count, TypingTestStats *stats) {
+                     WordStore *ws, TestMode mode, size_t word_count,
+                     TypingTestStats *stats, KeyLog *key_log,
+                     RaceClient *race, Ghost *ghost) {
     if (!tt) {
         *err = ERR_MAKE("Typing test is null");
         return;
     }
 
+    // Release previous round's memory
+    arena_reset(tt->arena);
+
     // Initialise new test string
-    tt->test_str_len = word_store_rands(err, ws, word_count, &tt->test_str);
+    WordPick pick = WORD_PICK_UNIFORM;
+    if (mode == TEST_MODE_ADAPTIVE) {
+        pick = WORD_PICK_WEAKNESS;
+    } else if (mode == TEST_MODE_DRILL) {
+        pick = WORD_PICK_DRILL;
+    } else if (mode == TEST_MODE_SENTENCES) {
+        pick = WORD_PICK_MARKOV;
+    }
+
+    // A ghost round retypes the ghost's test
+    size_t ghost_word_count = 0;
+    const uint32_t *ghost_ids =
+        ghost && mode == TEST_MODE_GHOST
+            ? ghost_words(ghost, &ghost_word_count)
+            : NULL;
+    tt->ghost = ghost_ids ? ghost : NULL;
+    if (tt->ghost) {
+        ghost_rewind(tt->ghost);
+        word_store_settext(err, ws, tt->arena, ghost_ids, ghost_word_count,
+                           &tt->text);
+    } else {
+        word_store_rands(err, ws, &tt->rng, tt->arena, pick, word_count,
+                         &tt->text);
+    }
+    if (*err) {
+        return;
+    }
+
+    typing_engine_begin(err, tt->engine, tt->arena, ws, &tt->text, stats,
+                        key_log);
     if (*err) {
         return;
     }
 
     // Initialise/reset test view
     if (!tt->view) {
-        typing_test_view_init(err, &tt->view, tt->test_str, tt->test_str_len);
+        typing_test_view_init(err, &tt->view, tt->arena, ws, &tt->text);
         if (*err) {
             typing_test_destroy(&tt);
             return;
         }
     } else {
-        typing_test_view_reset(err, tt->view, tt->test_str, tt->test_str_len);
+        typing_test_view_reset(err, tt->view, tt->arena, ws, &tt->text);
     }
 
     // Initialise test data
-    tt->test_started = false;
-    tt->typed_char_count = 0.;
-    tt->correct_char_count = 0.;
+    tt->utf8_len = 0;
+    tt->reviewed = false;
+    tt->restore = NULL;
+    tt->restore_cap = 0;
+    tt->race = race;
+    tt->race_sent = (struct timespec){0};
 
     // Ensure window clear
     clear();
@@ -80,8 +190,23 @@ void typing_test_run(Err **err, JankeyState *state, TypingTest *tt,
     // Init stats for new test
     tt_stats_reset(stats);
 
+    if (tt->live) {
+        tt->live_snap = (LiveSnapshot){
+            .round = tt->live_snap.round + 1,
+            .state = LIVE_STATE_READY,
+            .text_len = tt->text.len,
+        };
+        live_stats_publish(tt->live, &tt->live_snap);
+    }
+
     // Render initial view of test string
     typing_test_view_render(err, tt->view);
+    if (tt->ghost) {
+        typing_test_view_setghost(err, tt->view, 0);
+    }
+    if (tt->rec) {
+        tt_record_frame(tt);
+    }
 
     // Set delay to target 60 fps refresh rate
     struct timespec delay = {.tv_sec = 0, .tv_nsec = 16666667};
@@ -93,58 +218,361 @@ void typing_test_run(Err **err, JankeyState *state, TypingTest *tt,
     size_t last_index = 0;
     bool do_continue = true;
     while (do_continue) {
+        TRACE_BEGIN("frame");
         int ui;
         bool input_received = false;
         while ((ui = getch()) >= 0) {
             input_received = true;
-            i = tt_update(tt, stats, i, ui);
-            if (i == last_index) {
+            if (ui == KEY_RESIZE) {
+                // ncurses turns SIGWINCH into a key once it has resized
+                typing_test_view_resize(err, tt->view);
+                if (*err) {
+                    return;
+                }
+                continue;
+            }
+            int key = tt_readkey(tt, ui);
+            if (key < 0) {
+                continue;
+            }
+            TRACE_BEGIN("tt_update");
+            i = tt_update(err, tt, key);
+            TRACE_END("tt_update");
+            if (*err) {
+                return;
+            }
+            if (tt->live) {
+                tt_live_key(tt, i);
+            }
+            if (tt->rec && key != TT_KEY_WORD_LEFT &&
+                key != TT_KEY_WORD_RIGHT) {
+                session_recorder_key(
+                    tt->rec, key == TT_KEY_DELETE_WORD ? TT_CTRL_W : key);
+            }
+            // Word keys may leave the cursor where it was mid-round
+            if (i == last_index && key < TT_KEY_DELETE_WORD) {
                 do_continue = false;
                 tt_stats_stop(stats);
                 break;
             }
             last_index = i;
         }
+        if (tt->race && do_continue) {
+            input_received |= tt_race_sync(err, tt, stats, i);
+            if (*err) {
+                return;
+            }
+        }
         if (input_received) {
+            TRACE_BEGIN("render");
             typing_test_view_render(err, tt->view);
+            TRACE_END("render");
+            if (tt->rec) {
+                tt_record_frame(tt);
+            }
+        }
+        if (tt->ghost && typing_engine_started(tt->engine) && do_continue) {
+            tt_ghost_sync(err, tt);
         }
         if (do_continue) {
+            TRACE_BEGIN("sleep");
             nanosleep(&delay, NULL);
+            TRACE_END("sleep");
+        }
+        TRACE_END("frame");
+    }
+    tt_stats_setwpm(stats, tt->text.len);
+    tt_stats_setAccuracy(stats, typing_engine_accuracy(tt->engine));
+    if (tt->live) {
+        tt_live_done(tt, stats);
+    }
+    if (tt->race) {
+        race_client_progress(err, tt->race, tt->text.len,
+                             tt_stats_getwpm(stats), true);
+        if (*err) {
+            return;
         }
     }
-    tt_stats_setwpm(stats, tt->test_str_len);
-    tt_stats_setAccuracy(
-        stats, (tt->correct_char_count / tt->typed_char_count) * 100.);
 
     *state = JANKEY_STATE_DISPLAYING_POST_TEST_MODAL;
     timeout(-1);
 }
 
-size_t tt_update(TypingTest *tt, TypingTestStats *stats, size_t index,
-                 int input) {
-    if (input == KEY_BACKSPACE || input == 127 || input == 8) {
-        if (index > 0) {
-            char correct_char = tt->test_str[index - 1];
-            index = typing_test_view_deletechar(tt->view, &correct_char);
+// Assemble the bytes getch returns into code points. Backspace keys map to
+// KEY_LOG_BACKSPACE and word keys to TT_KEY_*; -1 while a UTF-8 sequence is
+// incomplete and for other function keys or malformed input.
+int tt_readkey(TypingTest *tt, int ui) {
+    if (ui == KEY_BACKSPACE || ui == 127) {
+        tt->utf8_len = 0;
+        return KEY_LOG_BACKSPACE;
+    }
+    // Terminals send ^H for Ctrl+Backspace. Where Backspace itself sends
+    // ^H, ncurses has already made it KEY_BACKSPACE.
+    if (ui == 8 || ui == TT_CTRL_W) {
+        tt->utf8_len = 0;
+        return TT_KEY_DELETE_WORD;
+    }
+    if (ui > 0 && (ui == tt->key_word_left || ui == tt->key_word_right)) {
+        tt->utf8_len = 0;
+        return ui == tt->key_word_left ? TT_KEY_WORD_LEFT : TT_KEY_WORD_RIGHT;
+    }
+    if (ui < 0 || ui > 0xff) {
+        return -1;
+    }
+    if (ui < 0x80) {
+        tt->utf8_len = 0;
+        return ui;
+    }
+
+    unsigned char b = (unsigned char)ui;
+    if (!tt->utf8_len && !utf8_seqlen(b)) {
+        return -1;
+    }
+    tt->utf8[tt->utf8_len++] = (char)b;
+    size_t need = utf8_seqlen((unsigned char)tt->utf8[0]);
+    if (tt->utf8_len < need) {
+        return -1;
+    }
+
+    uint32_t c = 0;
+    size_t n = utf8_decode(tt->utf8, tt->utf8_len, &c);
+    tt->utf8_len = 0;
+    return n ? (int)c : -1;
+}
+
+// Input is a code point or KEY_LOG_BACKSPACE. The engine scores it and the
+// view mirrors what it did.
+size_t tt_update(Err **err, TypingTest *tt, int input) {
+    if (input >= TT_KEY_DELETE_WORD) {
+        return tt_update_word(err, tt, input);
+    }
+    bool was_started = typing_engine_started(tt->engine);
+    EngineKey k;
+    typing_engine_key(tt->engine, input, &k);
+    if (!was_started && typing_engine_started(tt->engine)) {
+        clock_gettime(CLOCK_MONOTONIC, &tt->started_at);
+    }
+
+    if (k.backspace) {
+        return typing_test_view_deletechar(err, tt->view, &k.expected);
+    }
+    unsigned format = k.correct ? COLOR_PAIR_GREEN : COLOR_PAIR_RED;
+    TTV_TYPEMODE m = k.insert ? TTV_TYPEMODE_INSERT : TTV_TYPEMODE_OVERTYPE;
+    return typing_test_view_typechar(err, tt->view, (uint32_t)input, format,
+                                     m);
+}
+
+// A word deletion finds its boundary in the text's word starts and puts the
+// deleted chars back with one view write; a jump only moves the cursor
+size_t tt_update_word(Err **err, TypingTest *tt, int input) {
+    EngineKey k;
+    if (input != TT_KEY_DELETE_WORD) {
+        typing_engine_jumpword(tt->engine, input == TT_KEY_WORD_RIGHT, &k);
+        typing_test_view_setcursor(tt->view, k.cursor);
+        return k.cursor;
+    }
+
+    typing_engine_deleteword(tt->engine, &k);
+    if (k.deleted > tt->restore_cap) {
+        size_t cap = MAX_N(k.deleted, tt->text.len);
+        tt->restore = ARENA_ALLOC(tt->arena, uint32_t, cap);
+        tt->restore_cap = tt->restore ? cap : 0;
+        if (!tt->restore) {
+            *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate word delete");
+            return k.cursor;
         }
-    } else {
-        if (!tt->test_started) {
-            tt_stats_start(stats);
-            tt->test_started = true;
+    }
+    for (size_t j = 0; j < k.deleted; j++) {
+        tt->restore[j] = typing_engine_charat(tt->engine, k.index + j);
+    }
+    return typing_test_view_deletechars(err, tt->view, tt->restore,
+                                        k.deleted);
+}
+
+// Report progress at most once per race tick and pick up the standings,
+// true if they changed and the view needs drawing
+bool tt_race_sync(Err **err, TypingTest *tt, TypingTestStats *stats,
+                  size_t index) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ms = (int64_t)(now.tv_sec - tt->race_sent.tv_sec) * 1000 +
+                 (int64_t)(now.tv_nsec - tt->race_sent.tv_nsec) / 1000000;
+    if (typing_engine_started(tt->engine) && ms >= RACE_TICK_MS) {
+        race_client_progress(err, tt->race, index,
+                             tt_stats_getlivewpm(stats, index), false);
+        tt->race_sent = now;
+    }
+
+    if (!race_client_poll(err, tt->race)) {
+        return false;
+    }
+    const RaceRacer *shown = NULL;
+    size_t total = 0;
+    size_t count = race_client_racers(tt->race, &shown, &total);
+    typing_test_view_setracers(err, tt->view, shown, count, total,
+                               race_client_self(tt->race));
+    return true;
+}
+
+// Publish where the round is after a key
+void tt_live_key(TypingTest *tt, size_t index) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    LiveSnapshot *snap = &tt->live_snap;
+    snap->state = LIVE_STATE_TYPING;
+    snap->started_ns = (uint64_t)tt->started_at.tv_sec * 1000000000u +
+                       (uint64_t)tt->started_at.tv_nsec;
+    snap->last_key_ns =
+        (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    snap->cursor = index;
+    size_t typed = 0;
+    size_t correct = 0;
+    typing_engine_counts(tt->engine, &typed, &correct);
+    snap->typed = typed;
+    snap->correct = correct;
+    live_stats_publish(tt->live, snap);
+}
+
+void tt_live_done(TypingTest *tt, TypingTestStats *stats) {
+    LiveSnapshot *snap = &tt->live_snap;
+    snap->state = LIVE_STATE_DONE;
+    snap->cursor = tt->text.len;
+    double wpm = tt_stats_getwpm(stats);
+    double accuracy = tt_stats_getAccuracy(stats);
+    snap->wpm_centi = (uint64_t)(MAX_N(wpm, 0.) * 100.);
+    snap->accuracy_centi = (uint64_t)(MAX_N(accuracy, 0.) * 100.);
+    live_stats_publish(tt->live, snap);
+}
+
+// Queue the rows of the screen that changed since the last frame. They are
+// read back from curscr, which holds what ncurses last drew, and compared
+// with what was sent; a dropped row stays stale and goes with the next one.
+void tt_record_frame(TypingTest *tt) {
+    int rows = getmaxy(curscr);
+    int cols = MIN_N(getmaxx(curscr), SESSION_RECORDER_MAX_COLS);
+    if ((rows != tt->rec_rows || cols != tt->rec_cols) &&
+        !tt_record_resize(tt, rows, cols)) {
+        return;
+    }
+
+    // Reading rows moves curscr's cursor, which ncurses takes as the
+    // terminal's, so it is put back after
+    int cursor_y = 0;
+    int cursor_x = 0;
+    getyx(curscr, cursor_y, cursor_x);
+    size_t width = (size_t)cols;
+    cchar_t line[SESSION_RECORDER_MAX_COLS + 1];
+    for (int y = 0; y < rows; y++) {
+        cchar_t *sent = tt->rec_screen + (size_t)y * width;
+        if (mvwin_wchnstr(curscr, y, 0, line, cols) == ERR ||
+            !memcmp(line, sent, width * sizeof(*line))) {
+            continue;
         }
+        for (size_t x = 0; x < width; x++) {
+            wchar_t wch[CCHARW_MAX + 1] = {0};
+            attr_t attrs = 0;
+            short pair = 0;
+            int ext_pair = 0;
+            getcchar(&line[x], wch, &attrs, &pair, &ext_pair);
+            bool known = ext_pair >= 0 && ext_pair < TT_REC_PAIRS;
+            tt->rec_row[x] = (RecCell){
+                .cp = (uint32_t)wch[0],
+                .fg = known ? tt->rec_fg[ext_pair] : REC_COLOR_DEFAULT,
+                .bg = known ? tt->rec_bg[ext_pair] : REC_COLOR_DEFAULT,
+                .attrs = (uint8_t)((attrs & A_BOLD ? REC_ATTR_BOLD : 0) |
+                                   (attrs & A_DIM ? REC_ATTR_DIM : 0) |
+                                   (attrs & A_UNDERLINE ? REC_ATTR_UNDERLINE
+                                                        : 0) |
+                                   (attrs & A_REVERSE ? REC_ATTR_REVERSE : 0)),
+            };
+        }
+        if (session_recorder_row(tt->rec, y, tt->rec_row, width)) {
+            memcpy(sent, line, width * sizeof(*line));
+        }
+    }
+    wmove(curscr, cursor_y, cursor_x);
+    session_recorder_frame(tt->rec, cursor_y, cursor_x);
+}
+
+// Size the copy of the sent screen to the terminal, which is then sent whole
+bool tt_record_resize(TypingTest *tt, int rows, int cols) {
+    size_t cells = (size_t)MAX_N(rows, 0) * (size_t)MAX_N(cols, 0);
+    cchar_t *screen = calloc(MAX_N(cells, (size_t)1), sizeof(*screen));
+    RecCell *row = calloc((size_t)MAX_N(cols, 1), sizeof(*row));
+    if (!screen || !row) {
+        free(screen);
+        free(row);
+        return false;
+    }
+    if (tt->rec_rows) {
+        session_recorder_resize(tt->rec, cols, rows);
+    }
+    free(tt->rec_screen);
+    free(tt->rec_row);
+    tt->rec_screen = screen;
+    tt->rec_row = row;
+    tt->rec_rows = rows;
+    tt->rec_cols = cols;
+    return true;
+}
+
+// Move the ghost to where it was this long into its round
+void tt_ghost_sync(Err **err, TypingTest *tt) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ms = (int64_t)(now.tv_sec - tt->started_at.tv_sec) * 1000 +
+                 (int64_t)(now.tv_nsec - tt->started_at.tv_nsec) / 1000000;
+    size_t i = ghost_cursor(tt->ghost, (uint64_t)MAX_N(ms, 0));
+    typing_test_view_setghost(err, tt->view, i);
+}
+
+// Reseed the word picks, tests seeded alike pick the same words
+void typing_test_seed(TypingTest *tt, uint64_t seed) {
+    rng_seed(&tt->rng, seed);
+}
 
-        char c = (char)input;
-        tt->typed_char_count++;
-        char correct_char = tt->test_str[index];
-        if (correct_char == c) {
-            tt->correct_char_count++;
+// Publish each round's progress to live, which tt does not own
+void typing_test_setlive(TypingTest *tt, LiveStats *live) { tt->live = live; }
+
+// Record keys and frames to rec, which tt does not own. Colour pairs are
+// looked up now, as they stay fixed once the terminal is set up.
+void typing_test_setrecorder(TypingTest *tt, SessionRecorder *rec) {
+    tt->rec = rec;
+    for (int p = 0; p < TT_REC_PAIRS; p++) {
+        int fg = -1;
+        int bg = -1;
+        if (extended_pair_content(p, &fg, &bg) == ERR) {
+            fg = -1;
+            bg = -1;
         }
-        unsigned format = correct_char == c ? COLOR_PAIR_GREEN : COLOR_PAIR_RED;
-        TTV_TYPEMODE m = c == 'X' ? TTV_TYPEMODE_INSERT : TTV_TYPEMODE_OVERTYPE;
+        tt->rec_fg[p] = fg >= 0 && fg < REC_COLOR_DEFAULT ? (uint8_t)fg
+                                                          : REC_COLOR_DEFAULT;
+        tt->rec_bg[p] = bg >= 0 && bg < REC_COLOR_DEFAULT ? (uint8_t)bg
+                                                          : REC_COLOR_DEFAULT;
+    }
+}
 
-        index = typing_test_view_typechar(tt->view, &c, format, m);
+// The last round's mistakes by word, built on first use and kept until the
+// next round starts
+const RoundReview *typing_test_review(Err **err, TypingTest *tt) {
+    if (!tt->reviewed) {
+        const uint64_t *missed = NULL;
+        const uint64_t *fixed = NULL;
+        size_t bit_count = 0;
+        typing_engine_errorbits(tt->engine, &missed, &fixed, &bit_count);
+        round_review_build(err, &tt->review, tt->arena,
+                           typing_engine_wordstore(tt->engine), &tt->text,
+                           missed, fixed, bit_count);
+        if (*err) {
+            return NULL;
+        }
+        tt->reviewed = true;
     }
-    return index;
+    return &tt->review;
+}
+
+const KeyHeatmap *typing_test_getheatmap(TypingTest *tt) {
+    return typing_engine_heatmap(tt->engine);
 }
 
 void typing_test_destroy(TypingTest **typing_test) {
@@ -161,6 +589,14 @@ void typing_test_destroy(TypingTest **typing_test) {
     if (tt->view) {
         typing_test_view_destroy(&tt->view);
     }
+    if (tt->engine) {
+        typing_engine_destroy(&tt->engine);
+    }
+    if (tt->arena) {
+        arena_destroy(&tt->arena);
+    }
+    free(tt->rec_screen);
+    free(tt->rec_row);
 
     free(tt);
     tt = NULL;
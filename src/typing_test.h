@@ -3,16 +3,33 @@
 
 #include "constants.h"
 #include "err.h"
+#include "ghost.h"
+#include "key_heatmap.h"
+#include "key_log.h"
+#include "live_stats.h"
+#include "race_client.h"
+#include "round_review.h"
+#include "session_recorder.h"
 #include "typing_test_stats.h"
 #include "word_store.h"
 #include <ncurses.h>
+#include <stdint.h>
 
 typedef struct TypingTest TypingTest;
 
 void typing_test_init(Err **err, TypingTest **typing_test);
 
 void typing_test_run(Err **err, JankeyState *state, TypingTest *tt,
-                     WordStore *ws, size_t word_count, TypingTestStats *stats);
+                     WordStore *ws, TestMode mode, size_t word_count,
+                     TypingTestStats *stats, KeyLog *key_log,
+                     RaceClient *race, Ghost *ghost);
+
+void typing_test_seed(TypingTest *tt, uint64_t seed);
+void typing_test_setlive(TypingTest *tt, LiveStats *live);
+void typing_test_setrecorder(TypingTest *tt, SessionRecorder *rec);
+
+const RoundReview *typing_test_review(Err **err, TypingTest *tt);
+const KeyHeatmap *typing_test_getheatmap(TypingTest *tt);
 
 void typing_test_destroy(TypingTest **typing_test);
 
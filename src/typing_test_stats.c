@@ -17,7 +17,9 @@ void tt_stats_init(Err **err, TypingTestStats **stats) {
 
     TypingTestStats *s = ZALLOC(sizeof(*s));
     if (!s) {
-        *err = ERR_MAKE("Unable to allocate memory for typing stats");
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for typing stats");
+        return;
     }
     tt_stats_reset(s);
     *stats = s;
@@ -53,6 +55,21 @@ void tt_stats_setwpm(TypingTestStats *s, size_t chars_typed) {
 }
 void tt_stats_setAccuracy(TypingTestStats *s, double a) { s->accuracy = a; }
 
+// WPM so far in a running round, 0 before it starts
+double tt_stats_getlivewpm(TypingTestStats *s, size_t chars_typed) {
+    if (!s->start.tv_sec && !s->start.tv_nsec) {
+        return 0.;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (double)(now.tv_sec - s->start.tv_sec) +
+                     (double)(now.tv_nsec - s->start.tv_nsec) / 1000000000.0;
+    if (seconds <= 0.) {
+        return 0.;
+    }
+    return ((double)chars_typed / 5.) / (seconds / 60.);
+}
+
 double tt_stats_getwpm(TypingTestStats *s) { return s->wpm; }
 double tt_stats_getAccuracy(TypingTestStats *s) { return s->accuracy; }
 double tt_stats_getSecondsElapsed(TypingTestStats *s) { return s->elapsedSec; }
@@ -24,6 +24,7 @@ void tt_stats_setwpm(TypingTestStats *stats, size_t chars_typed);
 void tt_stats_setAccuracy(TypingTestStats *stats, double accuracy);
 
 double tt_stats_getwpm(TypingTestStats *stats);
+double tt_stats_getlivewpm(TypingTestStats *stats, size_t chars_typed);
 double tt_stats_getAccuracy(TypingTestStats *stats);
 double tt_stats_getSecondsElapsed(TypingTestStats *stats);
 
@@ -1,114 +1,196 @@
 #include "typing_test_view.h"
+#include "arena.h"
 #include "constants.h"
 #include "err.h"
 #include "gap_buffer.h"
 #include "helpers.h"
+#include "race_protocol.h"
+#include "trace.h"
+#include "utf8.h"
+#include "word_store.h"
 #include <ctype.h>
 #include <limits.h>
 #include <ncurses.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <threads.h>
 
+// Lines are ranges of chars, with width the display cells they cover
 typedef struct Line {
     size_t start_i;
     size_t end_i;
+    size_t width;
 } Line;
 
+// Lines wrapped to one width. Built lazily, only as far as the window needs,
+// and an edit drops just the lines it could re-wrap. complete is set once
+// the lines reach the end of the text.
+typedef struct Layout {
+    size_t width;
+    Line *lines;
+    size_t lines_len;
+    size_t lines_cap;
+    bool complete;
+    uint64_t last_used;
+} Layout;
+
+#define WIN_HEIGHT MAX_TEST_WIN_ROWS
+
+// Layouts are kept per width for the round, so resizing back to a width
+// already seen reuses its lines
+#define TTV_LAYOUT_CACHE 4
+
+// Race standings sit below the text, a count then a row per leading racer
+#define TTV_TRACK_HEIGHT (RACE_SHOWN + 1)
+#define TTV_TRACK_LABEL 8
+#define TTV_TRACK_WPM 9
+
 struct TypingTestView {
     WINDOW *win;
     size_t width;
     GapBuff *buff;
-    size_t lines_len;
-    size_t lines_cap;
-    size_t lines_init_time_spare_cap;
+    Arena *arena;
     size_t cursor_i;
     size_t cursor_line_i;
-    Line lines[];
+    Layout layouts[TTV_LAYOUT_CACHE];
+    Layout *layout;
+    uint64_t layout_tick;
+    WINDOW *track;
+    bool racing;
+    RaceRacer racers[RACE_SHOWN];
+    size_t racer_count;
+    size_t racer_total;
+    uint32_t self_id;
+    bool ghosting;
+    size_t ghost_i;
+    size_t first_line_i;
+    int cursor_y;
+    int cursor_x;
 };
 
-#define WIN_HEIGHT MAX_TEST_WIN_ROWS
-
-void ttv_calculate_lines(Err **err, TypingTestView *v);
-
-void typing_test_view_init(Err **err, TypingTestView **tgt,
-                           const char *test_str, size_t str_len) {
+void ttv_place(Err **err, TypingTestView *v);
+void ttv_select_layout(Err **err, TypingTestView *v);
+void ttv_layout_extend(Err **err, TypingTestView *v, Layout *l,
+                       size_t line_count);
+size_t ttv_find_line(Err **err, TypingTestView *v, Layout *l, size_t i);
+void ttv_invalidate(TypingTestView *v, size_t i);
+bool ttv_rewraps(uint32_t old_value, uint8_t old_width,
+                 const FormattedChar *now);
+void ttv_alloc_lines(Err **err, TypingTestView *v, Layout *l,
+                     size_t lines_cap);
+void ttv_seed(TypingTestView *v, const WordStore *ws, const TestText *text);
+size_t ttv_span_width(TypingTestView *v, size_t start_i, size_t end_i);
+bool ttv_is_word_char(uint32_t c);
+void ttv_place_track(TypingTestView *v, int x, int y);
+void ttv_render_track(TypingTestView *v);
+attr_t ttv_char_marks(const TypingTestView *v, size_t i);
+void ttv_paint_cell(Err **err, TypingTestView *v, size_t i);
+
+void typing_test_view_init(Err **err, TypingTestView **tgt, Arena *arena,
+                           const WordStore *ws, const TestText *text) {
     if (!err || *err) {
         return;
     }
 
-    // generous line capacity allocated before test with min spare capacity
-    // ensured after init to reduce the chance of realloc during the test
-    size_t lines_init_time_spare_cap = 128;
-    size_t lines_cap = lines_init_time_spare_cap * 2;
-
     // Allocate memory for the view
-    TypingTestView *v = ZALLOC(
-        sizeof(*v) + (lines_cap * sizeof((((TypingTestView *)0)->lines[0]))));
+    TypingTestView *v = ZALLOC(sizeof(*v));
     if (!v) {
-        *err = ERR_MAKE("Unable to allocate memory for typing test view");
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for typing test view");
+        return;
     }
-    v->lines_cap = lines_cap;
-    v->lines_init_time_spare_cap = lines_init_time_spare_cap;
+
+    // Line tables live in the round arena
+    v->arena = arena;
 
     // Initialise cursor and cursor line indices
     v->cursor_i = 0;
     v->cursor_line_i = 0;
 
-    // Initialise ncurses window
-    v->width = (size_t)MIN_N(MAX_CHARS_PER_LINE, COLS);
-    if (v->width < MIN_WIN_WIDTH) {
-        *err = ERR_MAKE("Window width (%d) must be at least %d chars", v->width,
-                        MIN_WIN_WIDTH);
+    // Initialise buffer
+    gap_buff_init(err, &v->buff, text->len, COLOR_PAIR_WHITE);
+    if (*err) {
         typing_test_view_destroy(&v);
         return;
     }
+    ttv_seed(v, ws, text);
+    gap_buff_mvcursor(err, v->buff, (size_t)0);
 
-    int x = (COLS - (int)(v->width)) / 2;
-    int y = (LINES - (int)(WIN_HEIGHT)) / 2;
-    v->win = newwin(WIN_HEIGHT, (int)v->width, y, x);
-    if (!v->win) {
-        *err = ERR_MAKE("Unable to initialise ncurses window");
+    // Initialise ncurses window, later resizes are followed rather than
+    // rejected so a round is never lost to a narrow terminal
+    if (COLS < MIN_WIN_WIDTH) {
+        *err = ERR_MAKE("Window width (%d) must be at least %d chars", COLS,
+                        MIN_WIN_WIDTH);
         typing_test_view_destroy(&v);
         return;
     }
-
-    // Initialise buffer
-    gap_buff_init(err, &v->buff, test_str, str_len, COLOR_PAIR_WHITE);
+    ttv_place(err, v);
     if (*err) {
         typing_test_view_destroy(&v);
         return;
     }
-    gap_buff_mvcursor(err, v->buff, (size_t)0);
 
     *tgt = v;
 }
 
-void typing_test_view_reset(Err **err, TypingTestView *tgt,
-                            const char *test_str, size_t str_len) {
-    gap_buff_reset(err, tgt->buff, test_str, str_len, COLOR_PAIR_WHITE);
+void typing_test_view_reset(Err **err, TypingTestView *tgt, Arena *arena,
+                            const WordStore *ws, const TestText *text) {
+    gap_buff_reset(err, &tgt->buff, text->len, COLOR_PAIR_WHITE);
+    if (*err) {
+        return;
+    }
+    ttv_seed(tgt, ws, text);
+
+    // Previous line tables were released with the arena
+    tgt->arena = arena;
+    memset(tgt->layouts, 0, sizeof(tgt->layouts));
+    tgt->layout = NULL;
     tgt->cursor_i = 0;
     tgt->cursor_line_i = 0;
-    tgt->lines_len = 0;
+    tgt->racer_count = 0;
+    tgt->racer_total = 0;
+    tgt->ghosting = false;
+    tgt->first_line_i = 0;
+    ttv_place(err, tgt);
 }
 
-const char *typing_test_view_charat(TypingTestView *v, size_t i) {
-    return &gap_buff_getchar(v->buff, i)->value;
+// Follow a terminal resize, reported by getch as KEY_RESIZE
+void typing_test_view_resize(Err **err, TypingTestView *v) {
+    ttv_place(err, v);
+    clear();
+    refresh();
 }
 
-size_t typing_test_view_typechar(TypingTestView *v, char *c,
+uint32_t typing_test_view_charat(TypingTestView *v, size_t i) {
+    return gap_buff_getchar(v->buff, i)->value;
+}
+
+size_t typing_test_view_typechar(Err **err, TypingTestView *v, uint32_t c,
                                  unsigned color_pair_id, TTV_TYPEMODE m) {
 
-    gap_buff_mvcursor(NULL, v->buff, v->cursor_i);
+    ErrCode code = gap_buff_trymvcursor(v->buff, v->cursor_i);
+    if (code) {
+        *err = ERR_MAKE_CODE(code, "Unable to type at index %zu", v->cursor_i);
+        return v->cursor_i;
+    }
 
     size_t buff_len = gap_buff_getlen(v->buff);
+    const FormattedChar *prev = gap_buff_getchar(v->buff, v->cursor_i);
+    uint32_t prev_value = prev->value;
+    uint8_t prev_width = prev->width;
 
     if (m == TTV_TYPEMODE_OVERTYPE) {
         gap_buff_replacechar(v->buff, c, color_pair_id);
     } else {
         gap_buff_insertchar(v->buff, c, color_pair_id);
     }
+    if (m == TTV_TYPEMODE_INSERT ||
+        ttv_rewraps(prev_value, prev_width,
+                    gap_buff_getchar(v->buff, v->cursor_i))) {
+        ttv_invalidate(v, v->cursor_i);
+    }
 
     if (v->cursor_i >= buff_len - 1) {
         return v->cursor_i;
@@ -117,37 +199,120 @@ size_t typing_test_view_typechar(TypingTestView *v, char *c,
     return ++v->cursor_i;
 }
 
-size_t typing_test_view_deletechar(TypingTestView *v, char *c) {
+size_t typing_test_view_deletechar(Err **err, TypingTestView *v,
+                                   const uint32_t *c) {
     if (v->cursor_i == 0) {
         return v->cursor_i;
     }
 
-    Err *err;
+    ErrCode code = gap_buff_trymvcursor(v->buff, v->cursor_i - 1);
+    if (code) {
+        *err = ERR_MAKE_CODE(code, "Unable to delete at index %zu",
+                             v->cursor_i - 1);
+        return v->cursor_i;
+    }
     v->cursor_i--;
-    gap_buff_mvcursor(&err, v->buff, v->cursor_i);
 
     if (c) {
-        gap_buff_replacechar(v->buff, c, COLOR_PAIR_WHITE);
+        const FormattedChar *prev = gap_buff_getchar(v->buff, v->cursor_i);
+        uint32_t prev_value = prev->value;
+        uint8_t prev_width = prev->width;
+        gap_buff_replacechar(v->buff, *c, COLOR_PAIR_WHITE);
+        if (ttv_rewraps(prev_value, prev_width,
+                        gap_buff_getchar(v->buff, v->cursor_i))) {
+            ttv_invalidate(v, v->cursor_i);
+        }
+    }
+    return v->cursor_i;
+}
+
+// Delete the n chars before the cursor, putting the text's chars cs back in
+// one gap buffer write. Lines are re-wrapped from the first of them rather
+// than checking each char as a single delete does.
+size_t typing_test_view_deletechars(Err **err, TypingTestView *v,
+                                    const uint32_t *cs, size_t n) {
+    n = MIN_N(n, v->cursor_i);
+    if (!n) {
+        return v->cursor_i;
+    }
+    size_t start = v->cursor_i - n;
+    ErrCode code = gap_buff_replacerange(v->buff, start, cs, n,
+                                         COLOR_PAIR_WHITE);
+    if (code) {
+        *err = ERR_MAKE_CODE(code, "Unable to delete at index %zu", start);
+        return v->cursor_i;
     }
+    ttv_invalidate(v, start);
+    v->cursor_i = start;
     return v->cursor_i;
 }
 
+// Move the cursor without touching the text, as a word jump does
+void typing_test_view_setcursor(TypingTestView *v, size_t i) {
+    v->cursor_i = MIN_N(i, gap_buff_getlen(v->buff) - 1);
+}
+
+// Show opponents' progress, the track window appears with the first call
+void typing_test_view_setracers(Err **err, TypingTestView *v,
+                                const RaceRacer *shown, size_t count,
+                                size_t total, uint32_t self_id) {
+    count = MIN_N(count, (size_t)RACE_SHOWN);
+    memcpy(v->racers, shown, count * sizeof(*shown));
+    v->racer_count = count;
+    v->racer_total = total;
+    v->self_id = self_id;
+    if (!v->racing) {
+        v->racing = true;
+        ttv_place(err, v);
+    }
+}
+
+// Move the ghost cursor. Only the cells it leaves and enters are redrawn,
+// so a ghost moving between keystrokes costs no full repaint.
+void typing_test_view_setghost(Err **err, TypingTestView *v, size_t i) {
+    if (v->ghosting && i == v->ghost_i) {
+        return;
+    }
+    size_t old_i = v->ghost_i;
+    bool had_ghost = v->ghosting;
+    v->ghost_i = i;
+    v->ghosting = true;
+
+    if (had_ghost) {
+        ttv_paint_cell(err, v, old_i);
+    }
+    ttv_paint_cell(err, v, i);
+    wmove(v->win, v->cursor_y, v->cursor_x);
+    TRACE_BEGIN("wrefresh");
+    wrefresh(v->win);
+    TRACE_END("wrefresh");
+}
+
 void typing_test_view_render(Err **err, TypingTestView *v) {
 
     curs_set(1);
-    ttv_calculate_lines(err, v);
+
+    // Lay out up to the cursor and the lines shown below it
+    Layout *l = v->layout;
+    TRACE_BEGIN("layout");
+    v->cursor_line_i = ttv_find_line(err, v, l, v->cursor_i);
+    ttv_layout_extend(err, v, l, v->cursor_line_i + WIN_HEIGHT);
+    TRACE_END("layout");
+    if (*err) {
+        return;
+    }
 
     // Cache values accessed frequently in the loop
     WINDOW *win = v->win;
     GapBuff *buff = v->buff;
-    Line *lines = v->lines;
-    size_t line_count = v->lines_len;
+    Line *lines = l->lines;
+    size_t line_count = l->lines_len;
     size_t width = v->width;
     size_t current_line_number = v->cursor_line_i;
 
     // Determine lines to render based on the index to be centered
     size_t first_line_i;
-    if (line_count > WIN_HEIGHT) {
+    if (line_count > WIN_HEIGHT || !l->complete) {
         if (current_line_number == 0) {
             first_line_i = current_line_number;
         } else if (current_line_number == line_count - 1) {
@@ -169,7 +334,9 @@ void typing_test_view_render(Err **err, TypingTestView *v) {
 
         // Calculate line length and center offset
         size_t line_len = current_line.end_i - current_line.start_i + 1;
-        size_t center_offset = (width > line_len) ? (width - line_len) / 2 : 0;
+        size_t center_offset = (width > current_line.width)
+                                   ? (width - current_line.width) / 2
+                                   : 0;
 
         // Add leading spaces for centering
         for (size_t col_i = 0; col_i < center_offset; col_i++) {
@@ -182,13 +349,21 @@ void typing_test_view_render(Err **err, TypingTestView *v) {
             return;
         }
 
-        // Render line from buffer
-        //
+        // Render line from buffer, multi-byte chars go out as UTF-8
         for (size_t char_count = 0; char_count < line_len; char_count++) {
             const FormattedChar *ch_ptr = gap_buff_nextchar(buff);
             wattron(win, COLOR_PAIR(ch_ptr->colour_pair));
-            waddch(win,
-                   (unsigned char)(ch_ptr->value == ' ' ? '_' : ch_ptr->value));
+            attr_t marks =
+                ttv_char_marks(v, current_line.start_i + char_count);
+            wattr_on(win, marks, NULL);
+            uint32_t c = ch_ptr->value;
+            if (c < 0x80) {
+                waddch(win, (unsigned char)(c == ' ' ? '_' : c));
+            } else {
+                char bytes[UTF8_MAX];
+                waddnstr(win, bytes, (int)utf8_encode(c, bytes));
+            }
+            wattr_off(win, marks, NULL);
         }
         wclrtoeol(win);
     }
@@ -204,15 +379,32 @@ void typing_test_view_render(Err **err, TypingTestView *v) {
     gap_buff_mvcursor(err, buff, v->cursor_i);
 
     // Sync window cursor with view cursor
-    Line focussed_line = v->lines[v->cursor_line_i];
-    size_t line_len = focussed_line.end_i - focussed_line.start_i + 1;
-    size_t center_offset = (width > line_len) ? (width - line_len) / 2 : 0;
-    size_t c_x = center_offset + v->cursor_i - focussed_line.start_i;
+    Line focussed_line = lines[v->cursor_line_i];
+    size_t center_offset = (width > focussed_line.width)
+                               ? (width - focussed_line.width) / 2
+                               : 0;
+    size_t c_x = center_offset;
+    if (v->cursor_i > focussed_line.start_i) {
+        c_x += ttv_span_width(v, focussed_line.start_i, v->cursor_i - 1);
+    }
+
+    // The text window goes out last so the terminal cursor stays in it
+    if (v->track) {
+        ttv_render_track(v);
+        wnoutrefresh(v->track);
+    }
 
     int row_offset = (int)v->cursor_line_i - (int)first_line_i;
     int c_y = row_offset;
     wmove(v->win, c_y, (int)c_x);
+    TRACE_BEGIN("wrefresh");
     wrefresh(win);
+    TRACE_END("wrefresh");
+
+    // Kept for the ghost's in-place cell updates between renders
+    v->first_line_i = first_line_i;
+    v->cursor_y = c_y;
+    v->cursor_x = (int)c_x;
 }
 
 void typing_test_view_destroy(TypingTestView **tgt) {
@@ -225,41 +417,108 @@ void typing_test_view_destroy(TypingTestView **tgt) {
         delwin(v->win);
         v->win = NULL;
     }
+    if (v->track) {
+        delwin(v->track);
+        v->track = NULL;
+    }
+    if (v->buff) {
+        gap_buff_destroy(&v->buff);
+    }
 
     free(v);
     v = NULL;
     *tgt = NULL;
 }
 
-void ttv_calculate_lines(Err **err, TypingTestView *v) {
-    size_t next_char_i = 0;
-    size_t curr_line_i = 0;
+// Size and centre the window for the current terminal, then switch to the
+// layout for its width
+void ttv_place(Err **err, TypingTestView *v) {
+    size_t width = (size_t)MIN_N(MAX_CHARS_PER_LINE, MAX_N(COLS, 1));
+    int x = (COLS - (int)width) / 2;
+    int y = MAX_N((LINES - (int)(WIN_HEIGHT)) / 2, 0);
+    if (!v->win) {
+        v->win = newwin(WIN_HEIGHT, (int)width, y, x);
+        if (!v->win) {
+            *err = ERR_MAKE("Unable to initialise ncurses window");
+            return;
+        }
+    } else if (width != v->width) {
+        wresize(v->win, WIN_HEIGHT, (int)width);
+    }
+    mvwin(v->win, y, x);
+    v->width = width;
+    ttv_place_track(v, x, y);
+
+    ttv_select_layout(err, v);
+}
+
+// Make the layout for the view width current, reusing the least recently
+// used slot when the width has not been laid out this round
+void ttv_select_layout(Err **err, TypingTestView *v) {
+    Layout *l = NULL;
+    for (size_t k = 0; k < TTV_LAYOUT_CACHE && !l; k++) {
+        if (v->layouts[k].width == v->width) {
+            l = &v->layouts[k];
+        }
+    }
+    if (!l) {
+        l = &v->layouts[0];
+        for (size_t k = 1; k < TTV_LAYOUT_CACHE; k++) {
+            if (v->layouts[k].last_used < l->last_used) {
+                l = &v->layouts[k];
+            }
+        }
+        l->width = v->width;
+        l->lines_len = 0;
+        l->complete = false;
+        if (!l->lines) {
+            ttv_alloc_lines(err, v, l, gap_buff_getlen(v->buff));
+            if (*err) {
+                return;
+            }
+        }
+    }
+    l->last_used = ++v->layout_tick;
+    v->layout = l;
+}
 
-    v->cursor_line_i = 0;
-    Line *curr_line;
+// Wrap lines until there are line_count of them or the text runs out
+void ttv_layout_extend(Err **err, TypingTestView *v, Layout *l,
+                       size_t line_count) {
     size_t buff_len = gap_buff_getlen(v->buff);
-    while (next_char_i < buff_len) {
+    size_t next_char_i =
+        l->lines_len ? l->lines[l->lines_len - 1].end_i + 1 : 0;
+    while (!l->complete && l->lines_len < line_count) {
+        if (next_char_i >= buff_len) {
+            l->complete = true;
+            break;
+        }
+
         // Check sufficient space for line
-        if (curr_line_i >= v->lines_cap) {
-            v->lines_cap += v->lines_init_time_spare_cap;
-            TypingTestView *t =
-                realloc(v, sizeof(*t) + (v->lines_cap * sizeof(Line)));
-            if (!t) {
-                *err = ERR_MAKE("Unable to expand lines capacity");
+        if (l->lines_len >= l->lines_cap) {
+            ttv_alloc_lines(err, v, l, l->lines_cap * 2);
+            if (*err) {
                 return;
             }
-            v = t;
         }
 
-        curr_line = &v->lines[curr_line_i];
-
-        // Calculate rough end index
+        // Rough end is the last char that fits the line's cells
         size_t line_start_i = next_char_i;
-        size_t line_end_i =
-            MIN_N(next_char_i + MAX_CHARS_PER_LINE - 1, buff_len - 1);
+        size_t line_end_i = line_start_i;
+        size_t cells = gap_buff_getchar(v->buff, line_start_i)->width;
+        while (line_end_i + 1 < buff_len) {
+            size_t w = gap_buff_getchar(v->buff, line_end_i + 1)->width;
+            if (cells + w > l->width) {
+                break;
+            }
+            cells += w;
+            line_end_i++;
+        }
+        size_t fit_end_i = line_end_i;
 
-        // Exit if no chars to add
-        if (line_end_i == line_start_i) {
+        // Exit if only the trailing char is left
+        if (line_start_i == buff_len - 1) {
+            l->complete = true;
             break;
         }
 
@@ -267,12 +526,11 @@ void ttv_calculate_lines(Err **err, TypingTestView *v) {
         bool non_alpha_char_found = false;
         if (line_end_i != buff_len - 1) {
             while (line_end_i > line_start_i) {
-                const char c = gap_buff_getchar(v->buff, line_end_i)->value;
-                bool is_alpha = isalpha(c);
+                uint32_t c = gap_buff_getchar(v->buff, line_end_i)->value;
+                bool is_alpha = ttv_is_word_char(c);
                 if (is_alpha) {
                     if (non_alpha_char_found) {
                         line_end_i = line_end_i + 1;
-                        next_char_i = line_end_i + 1;
                         break;
                     }
                 } else {
@@ -283,18 +541,181 @@ void ttv_calculate_lines(Err **err, TypingTestView *v) {
         }
 
         if (!non_alpha_char_found) {
-            line_end_i =
-                MIN_N(next_char_i + MAX_CHARS_PER_LINE - 1, buff_len - 1);
+            line_end_i = fit_end_i;
+        }
+
+        Line *line = &l->lines[l->lines_len++];
+        line->start_i = line_start_i;
+        line->end_i = line_end_i;
+        line->width = ttv_span_width(v, line_start_i, line_end_i);
+        next_char_i = line_end_i + 1;
+    }
+}
+
+// Line holding char i, laying out as far as needed. Past the end of the
+// text it is the last line.
+size_t ttv_find_line(Err **err, TypingTestView *v, Layout *l, size_t i) {
+    while (!l->complete &&
+           (!l->lines_len || l->lines[l->lines_len - 1].end_i < i)) {
+        ttv_layout_extend(err, v, l, l->lines_len + WIN_HEIGHT);
+        if (*err) {
+            return 0;
         }
+    }
+    if (!l->lines_len) {
+        return 0;
+    }
 
-        if (line_start_i <= v->cursor_i && line_end_i >= v->cursor_i) {
-            v->cursor_line_i = curr_line_i;
+    size_t lo = 0;
+    size_t hi = l->lines_len;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (l->lines[mid].start_i <= i) {
+            lo = mid;
+        } else {
+            hi = mid;
         }
+    }
+    return lo;
+}
 
-        curr_line->start_i = line_start_i;
-        curr_line->end_i = line_end_i;
-        curr_line_i++;
-        next_char_i = line_end_i + 1;
+// Drop lines an edit at char i could re-wrap, in every cached width. A line
+// only depends on chars up to one past the last that fits, so lines starting
+// more than a width before i are kept.
+void ttv_invalidate(TypingTestView *v, size_t i) {
+    for (size_t k = 0; k < TTV_LAYOUT_CACHE; k++) {
+        Layout *l = &v->layouts[k];
+        while (l->lines_len &&
+               l->lines[l->lines_len - 1].start_i + l->width >= i) {
+            l->lines_len--;
+            l->complete = false;
+        }
+    }
+}
+
+// Whether replacing a char can move line breaks, only its width and whether
+// it joins a word matter
+bool ttv_rewraps(uint32_t old_value, uint8_t old_width,
+                 const FormattedChar *now) {
+    return old_width != now->width ||
+           ttv_is_word_char(old_value) != ttv_is_word_char(now->value);
+}
+
+void ttv_alloc_lines(Err **err, TypingTestView *v, Layout *l,
+                     size_t lines_cap) {
+    // A line holds at least one char so the text length bounds the line
+    // count; spare capacity covers chars inserted during the test
+    lines_cap += 128;
+    Line *lines = ARENA_ALLOC(v->arena, Line, lines_cap);
+    if (!lines) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate memory for lines");
+        return;
+    }
+    if (l->lines) {
+        memcpy(lines, l->lines, l->lines_len * sizeof(*lines));
+    }
+    l->lines = lines;
+    l->lines_cap = lines_cap;
+}
+
+// Decode each word straight from the dictionary pool into the buffer, the
+// separating spaces are already in place
+void ttv_seed(TypingTestView *v, const WordStore *ws, const TestText *text) {
+    for (size_t i = 0; i < text->word_count; i++) {
+        uint32_t id = text->ids[i];
+        gap_buff_seed(v->buff, text->offs[i], ws->words[id],
+                      ws->word_lens[id]);
+    }
+}
+
+// Display cells covered by chars start_i to end_i inclusive
+size_t ttv_span_width(TypingTestView *v, size_t start_i, size_t end_i) {
+    size_t cells = 0;
+    for (size_t i = start_i; i <= end_i; i++) {
+        cells += gap_buff_getchar(v->buff, i)->width;
+    }
+    return cells;
+}
+
+// Letters for word wrapping, any non-ASCII char counts as one
+bool ttv_is_word_char(uint32_t c) { return c >= 0x80 || isalpha((int)c); }
+
+// Recreate the track below the text, or leave it out if the terminal is too
+// short to fit it
+void ttv_place_track(TypingTestView *v, int x, int y) {
+    if (v->track) {
+        delwin(v->track);
+        v->track = NULL;
+    }
+    int track_y = y + WIN_HEIGHT + 1;
+    if (!v->racing || track_y + TTV_TRACK_HEIGHT > LINES ||
+        v->width < TTV_TRACK_LABEL + TTV_TRACK_WPM + 2) {
+        return;
+    }
+    v->track = newwin(TTV_TRACK_HEIGHT, (int)v->width, track_y, x);
+}
+
+// A bar per leading racer for the share of the text they have typed
+void ttv_render_track(TypingTestView *v) {
+    WINDOW *t = v->track;
+    werase(t);
+    mvwprintw(t, 0, 0, "%zu racing", v->racer_total);
+
+    size_t len = MAX_N(gap_buff_getlen(v->buff), (size_t)1);
+    size_t bar = v->width - TTV_TRACK_LABEL - TTV_TRACK_WPM;
+    for (size_t r = 0; r < v->racer_count; r++) {
+        const RaceRacer *racer = &v->racers[r];
+        char name[TTV_TRACK_LABEL];
+        if (racer->id == v->self_id) {
+            snprintf(name, sizeof(name), "you");
+        } else {
+            snprintf(name, sizeof(name), "#%u", (unsigned)racer->id);
+        }
+        unsigned colour = racer->flags & RACE_FINISHED ? COLOR_PAIR_GREEN
+                          : racer->id == v->self_id    ? COLOR_PAIR_YELLOW
+                                                       : COLOR_PAIR_WHITE;
+        size_t filled = MIN_N((size_t)racer->cursor, len) * bar / len;
+
+        wattron(t, COLOR_PAIR(colour));
+        mvwprintw(t, (int)r + 1, 0, "%-6.6s [", name);
+        for (size_t i = 0; i < bar; i++) {
+            waddch(t, i < filled ? '=' : ' ');
+        }
+        wprintw(t, "] %3u wpm", (unsigned)racer->wpm);
+        wattroff(t, COLOR_PAIR(colour));
+    }
+}
+
+// Marks drawn over char i, the ghost reversed and opponents underlined
+attr_t ttv_char_marks(const TypingTestView *v, size_t i) {
+    attr_t marks = v->ghosting && v->ghost_i == i ? A_REVERSE : A_NORMAL;
+    for (size_t r = 0; r < v->racer_count; r++) {
+        if (v->racers[r].cursor == i && v->racers[r].id != v->self_id) {
+            marks |= A_UNDERLINE;
+        }
+    }
+    return marks;
+}
+
+// Reapply the attributes of char i in place, if it is on screen
+void ttv_paint_cell(Err **err, TypingTestView *v, size_t i) {
+    Layout *l = v->layout;
+    if (i >= gap_buff_getlen(v->buff)) {
+        return;
+    }
+    size_t line_i = ttv_find_line(err, v, l, i);
+    if (*err || line_i < v->first_line_i ||
+        line_i >= v->first_line_i + WIN_HEIGHT) {
+        return;
+    }
+
+    Line line = l->lines[line_i];
+    size_t x = v->width > line.width ? (v->width - line.width) / 2 : 0;
+    if (i > line.start_i) {
+        x += ttv_span_width(v, line.start_i, i - 1);
     }
-    v->lines_len = curr_line_i;
+    const FormattedChar *fc = gap_buff_getchar(v->buff, i);
+    mvwchgat(v->win, (int)(line_i - v->first_line_i), (int)x,
+             MAX_N((int)fc->width, 1), ttv_char_marks(v, i),
+             (short)fc->colour_pair, NULL);
 }
@@ -1,7 +1,10 @@
 #ifndef TYPING_TEST_VIEW_H
 #define TYPING_TEST_VIEW_H
 
+#include "arena.h"
 #include "err.h"
+#include "race_protocol.h"
+#include "word_store.h"
 #include <stdint.h>
 
 typedef struct TypingTestView TypingTestView;
@@ -11,18 +14,32 @@ typedef enum TTV_TYPEMODE {
     TTV_TYPEMODE_OVERTYPE
 } TTV_TYPEMODE;
 
-void typing_test_view_init(Err **err, TypingTestView **view_ptr,
-                           const char *test_str, size_t test_str_len);
+void typing_test_view_init(Err **err, TypingTestView **view_ptr, Arena *arena,
+                           const WordStore *ws, const TestText *text);
 
-void typing_test_view_reset(Err **err, TypingTestView *view,
-                            const char *test_str, size_t str_len);
+void typing_test_view_reset(Err **err, TypingTestView *view, Arena *arena,
+                            const WordStore *ws, const TestText *text);
 
-size_t typing_test_view_typechar(TypingTestView *v, char *c,
+size_t typing_test_view_typechar(Err **err, TypingTestView *v, uint32_t c,
                                  unsigned color_pair_id, TTV_TYPEMODE m);
 
-size_t typing_test_view_deletechar(TypingTestView *view, char *c);
+size_t typing_test_view_deletechar(Err **err, TypingTestView *view,
+                                   const uint32_t *c);
 
-const char *typing_test_view_charat(TypingTestView *view, size_t i);
+size_t typing_test_view_deletechars(Err **err, TypingTestView *view,
+                                    const uint32_t *cs, size_t n);
+
+void typing_test_view_setcursor(TypingTestView *view, size_t i);
+
+uint32_t typing_test_view_charat(TypingTestView *view, size_t i);
+
+void typing_test_view_resize(Err **err, TypingTestView *view);
+
+void typing_test_view_setracers(Err **err, TypingTestView *view,
+                                const RaceRacer *shown, size_t count,
+                                size_t total, uint32_t self_id);
+
+void typing_test_view_setghost(Err **err, TypingTestView *view, size_t i);
 
 void typing_test_view_render(Err **err, TypingTestView *view);
 
@@ -0,0 +1,174 @@
+// wcwidth; wide ncurses may already ask for it on the command line
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+#include "utf8.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define U8_HIGH_BITS 0x8080808080808080ull
+
+// Display widths of BMP code points, filled on first use. 0 is unknown,
+// otherwise the width plus one. Threads filling the same entry store the
+// same value, so relaxed access is enough.
+static _Atomic uint8_t u8_widths[0x10000];
+
+size_t u8_ascii_run(const unsigned char *p, size_t len);
+
+// Strict validation: no overlong forms, surrogates or code points past
+// U+10FFFF. ASCII runs, most of any dictionary, are skipped a block at a
+// time and only multi-byte sequences are decoded one by one.
+bool utf8_valid(const char *s, size_t len) {
+    const unsigned char *p = (const unsigned char *)s;
+    size_t i = 0;
+    while (i < len) {
+        i += u8_ascii_run(p + i, len - i);
+        if (i == len) {
+            break;
+        }
+        uint32_t cp = 0;
+        size_t n = utf8_decode(s + i, len - i, &cp);
+        if (!n) {
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+// Sequence length from its lead byte, 0 for continuation or invalid bytes
+size_t utf8_seqlen(unsigned char lead) {
+    if (lead < 0x80) {
+        return 1;
+    }
+    if (lead >= 0xc2 && lead < 0xe0) {
+        return 2;
+    }
+    if (lead >= 0xe0 && lead < 0xf0) {
+        return 3;
+    }
+    if (lead >= 0xf0 && lead < 0xf5) {
+        return 4;
+    }
+    return 0;
+}
+
+// Decode one code point, returning the bytes used or 0 if the sequence is
+// invalid or cut short
+size_t utf8_decode(const char *s, size_t len, uint32_t *cp) {
+    const unsigned char *p = (const unsigned char *)s;
+    if (!len) {
+        return 0;
+    }
+    size_t n = utf8_seqlen(p[0]);
+    if (n == 1) {
+        *cp = p[0];
+        return 1;
+    }
+    if (!n || len < n) {
+        return 0;
+    }
+
+    static const uint32_t lead_mask[UTF8_MAX + 1] = {0, 0, 0x1f, 0x0f, 0x07};
+    static const uint32_t min_cp[UTF8_MAX + 1] = {0, 0, 0x80, 0x800, 0x10000};
+    uint32_t v = p[0] & lead_mask[n];
+    for (size_t k = 1; k < n; k++) {
+        if ((p[k] & 0xc0) != 0x80) {
+            return 0;
+        }
+        v = v << 6 | (p[k] & 0x3f);
+    }
+    if (v < min_cp[n] || v > 0x10ffff || (v >= 0xd800 && v <= 0xdfff)) {
+        return 0;
+    }
+    *cp = v;
+    return n;
+}
+
+// Encode a code point, returning the bytes written
+size_t utf8_encode(uint32_t cp, char out[UTF8_MAX]) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xc0 | cp >> 6);
+        out[1] = (char)(0x80 | (cp & 0x3f));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xe0 | cp >> 12);
+        out[1] = (char)(0x80 | (cp >> 6 & 0x3f));
+        out[2] = (char)(0x80 | (cp & 0x3f));
+        return 3;
+    }
+    out[0] = (char)(0xf0 | cp >> 18);
+    out[1] = (char)(0x80 | (cp >> 12 & 0x3f));
+    out[2] = (char)(0x80 | (cp >> 6 & 0x3f));
+    out[3] = (char)(0x80 | (cp & 0x3f));
+    return 4;
+}
+
+// Code points in valid UTF-8, every byte but continuations starts one
+size_t utf8_count(const char *s, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        n += ((unsigned char)s[i] & 0xc0) != 0x80;
+    }
+    return n;
+}
+
+// Terminal cells for a code point, 1 or 2, or 0 if it is not printable
+uint8_t utf8_width(uint32_t cp) {
+    if (cp >= 0x20 && cp < 0x7f) {
+        return 1;
+    }
+    if (cp < 0x10000) {
+        uint8_t known =
+            atomic_load_explicit(&u8_widths[cp], memory_order_relaxed);
+        if (known) {
+            return (uint8_t)(known - 1);
+        }
+    }
+
+    int w = wcwidth((wchar_t)cp);
+    uint8_t width = w < 1 ? 0 : w > 1 ? 2 : 1;
+    if (cp < 0x10000) {
+        atomic_store_explicit(&u8_widths[cp], (uint8_t)(width + 1),
+                              memory_order_relaxed);
+    }
+    return width;
+}
+
+// Length of the leading ASCII run
+size_t u8_ascii_run(const unsigned char *p, size_t len) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= len; i += 16) {
+        __m128i v;
+        memcpy(&v, p + i, sizeof(v));
+        int mask = _mm_movemask_epi8(v);
+        if (mask) {
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+        }
+    }
+#endif
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, p + i, sizeof(v));
+        if (v & U8_HIGH_BITS) {
+            break;
+        }
+    }
+    while (i < len && p[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
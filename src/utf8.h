@@ -0,0 +1,17 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define UTF8_MAX 4
+
+bool utf8_valid(const char *s, size_t len);
+size_t utf8_seqlen(unsigned char lead);
+size_t utf8_decode(const char *s, size_t len, uint32_t *cp);
+size_t utf8_encode(uint32_t cp, char out[UTF8_MAX]);
+size_t utf8_count(const char *s, size_t len);
+uint8_t utf8_width(uint32_t cp);
+
+#endif
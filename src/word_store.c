@@ -1,140 +1,432 @@
+// fileno, st_mtim
+#define _POSIX_C_SOURCE 200809L
 #include "word_store.h"
+#include "arena.h"
+#include "dict_image.h"
 #include "err.h"
 #include "helpers.h"
+#include "key_heatmap.h"
+#include "markov.h"
+#include "ngram_index.h"
+#include "rng.h"
+#include "string_pool.h"
+#include "utf8.h"
+#include "word_weights.h"
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <threads.h>
 
-void words_free(char **words, size_t count);
-bool word_store_read_line(Err **err, FILE *s, char **lp);
+// Number of weakest bigrams drilled in WORD_PICK_DRILL
+#define WS_DRILL_NGRAMS 3
+
+// Weakness weights and the n-gram index are built on a background thread so
+// the first round can start straight away. Only picks that need them wait.
+// Until the build is done, weakness updates just keep the latest history,
+// which the build applies in full before marking itself ready. A store that
+// parsed its file publishes the image from there too, once indexes exist.
+struct WSIndexer {
+    thrd_t thread;
+    bool started;
+    bool has_sync;
+    mtx_t lock;
+    cnd_t ready_cnd;
+    bool ready;
+    Err *err;
+    KeyHeatmap *pending;
+    bool publish;
+    struct stat source;
+};
+
+void ws_read_all(Err **err, FILE *s, size_t size_hint, char **text,
+                 size_t *len);
+size_t ws_bad_line(const char *text, size_t len);
+size_t ws_text_offsets(Err **err, const WordStore *ws, Arena *arena,
+                       uint32_t *ids, size_t word_count, TestText *tgt);
+bool ws_init_image(Err **err, WordStore **ws, DictImage *image);
+void ws_indexer_start(Err **err, WordStore *ws, const struct stat *source);
+void ws_index_build(Err **err, WordStore *ws);
+int ws_index_main(void *arg);
+void ws_applyweakness(Err **err, WordStore *ws, const KeyHeatmap *history,
+                      const KeyHeatmap *changed);
+void ws_applydrill(Err **err, WordStore *ws, const char *const *ngrams,
+                   size_t ngram_count, NgramOp op);
+
+void word_store_init(Err **err, WordStore **ws, const char *dict_path,
+                     StringPool *strings) {
+    // Another process may have parsed this dictionary already, its image is
+    // found from the file's identity without reading the file
+    struct stat source;
+    bool shareable = !stat(dict_path, &source) && S_ISREG(source.st_mode);
+    DictImage image;
+    if (shareable && dict_image_open(&source, &image) &&
+        (ws_init_image(err, ws, &image) || *err)) {
+        return;
+    }
 
-void word_store_init(Err **err, WordStore **ws, const char *dict_path) {
     FILE *s = fopen(dict_path, "r");
     if (!s) {
-        *err = ERR_MAKE("Failed to open dict path: %s", dict_path);
+        *err = ERR_MAKE_CODE(ERR_IO, "Failed to open dict path: %s", dict_path);
         return;
     }
+    // Not shared if the file changed since, the image would carry the old
+    // identity with the new words
+    struct stat opened;
+    shareable = shareable && !fstat(fileno(s), &opened) &&
+                opened.st_dev == source.st_dev &&
+                opened.st_ino == source.st_ino &&
+                opened.st_size == source.st_size &&
+                opened.st_mtim.tv_sec == source.st_mtim.tv_sec &&
+                opened.st_mtim.tv_nsec == source.st_mtim.tv_nsec;
 
-    size_t buff_len = 256;
-    char **words = calloc(buff_len, sizeof(*words));
-    if (!words) {
-        fclose(s);
-        *err = ERR_MAKE("Unable to allocate memory for words list");
+    // One pass over the whole file lets utf8_valid skip ASCII a vector at a
+    // time, lines cannot hide a bad sequence as '\n' never continues one
+    char *text = NULL;
+    size_t text_len = 0;
+    ws_read_all(err, s, shareable ? (size_t)source.st_size : 0, &text,
+                &text_len);
+    fclose(s);
+    s = NULL;
+    if (*err) {
+        return;
+    }
+    if (!utf8_valid(text, text_len)) {
+        *err = ERR_MAKE("Invalid UTF-8 on line %zu of %s",
+                        ws_bad_line(text, text_len), dict_path);
+        free(text);
         return;
     }
 
+    // Split into lines in place, a final newline does not start a word
     size_t count = 0;
-    Err *f_err = NULL;
-    while (word_store_read_line(&f_err, s, &words[count])) {
-        count++;
-        if (count >= buff_len) {
-            buff_len += 256;
-            char **t = realloc(words, buff_len * sizeof(*words));
-            if (!t) {
-                f_err = ERR_MAKE("Error resizing buffer");
-                break;
-            } else {
-                words = t;
-            }
-        }
+    for (size_t i = 0; i < text_len; i++) {
+        count += text[i] == '\n';
     }
+    count += text_len && text[text_len - 1] != '\n';
 
-    if (f_err || ferror(s)) {
-        words_free(words, count);
-        words = NULL;
-        if (ferror(s)) {
-            *err = ERR_MAKE("File error");
-            err_destroy(&f_err);
-        } else {
-            *err = f_err;
-        }
-        fclose(s);
-        s = NULL;
+    char **words = calloc(MAX_N(count, 1), sizeof(*words));
+    if (!words) {
+        free(text);
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for words list");
         return;
     }
-
-    fclose(s);
-    s = NULL;
+    size_t w = 0;
+    char *line = text;
+    for (size_t i = 0; i < text_len; i++) {
+        if (text[i] == '\n') {
+            text[i] = '\0';
+            words[w++] = line;
+            line = &text[i + 1];
+        }
+    }
+    if (w < count) {
+        words[w] = line;
+    }
 
     // Allocate memory for word store
     size_t word_store_size = sizeof(WordStore) + (count * sizeof(*words));
     WordStore *ts = calloc((size_t)1, word_store_size);
     if (!ts) {
-        words_free(words, count);
-        words = NULL;
-        *err = ERR_MAKE("Unable to allocate memory for word store");
+        free(words);
+        free(text);
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for word store");
         return;
     }
 
-    // Copy words to word store;
+    // Intern words into the shared pool, dropping the file buffer
     ts->word_count = count;
-    for (size_t i = 0; i < count; i++) {
-        ts->words[i] = words[i];
+    ts->word_lens = calloc(MAX_N(count, 1), sizeof(uint32_t));
+    ts->word_chars = calloc(MAX_N(count, 1), sizeof(uint32_t));
+    if (!ts->word_lens || !ts->word_chars) {
+        free(words);
+        free(text);
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for word lengths");
+        word_store_destroy(&ts);
+        return;
+    }
+
+    // The dictionary hash runs over the words as NUL terminated runs
+    uint32_t h = FNV1A_BASIS;
+    for (size_t i = 0; i < count && !*err; i++) {
+        size_t len = strlen(words[i]);
+        ts->words[i] = string_pool_intern(err, strings, words[i], len);
+        ts->word_lens[i] = (uint32_t)len;
+        ts->word_chars[i] = (uint32_t)utf8_count(words[i], len);
+        h = hash_fnv1a_extend(h, words[i], len + 1);
     }
+    ts->dict_hash = h;
     free(words);
     words = NULL;
+    free(text);
+    text = NULL;
+    if (*err) {
+        word_store_destroy(&ts);
+        return;
+    }
+
+    // Built up front as lookups are cheap and the corpus load needs them
+    perfect_hash_init(err, &ts->lookup, ts->words, count);
+    if (*err) {
+        word_store_destroy(&ts);
+        return;
+    }
+
+    ws_indexer_start(err, ts, shareable ? &source : NULL);
+    if (*err) {
+        word_store_destroy(&ts);
+        return;
+    }
 
     *ws = ts;
     return;
 }
 
-void word_store_randn(Err **err, WordStore *ws, size_t buff_size,
-                      const char *buff[buff_size]) {
+// A store over a mapped image, which it takes over. False with the image
+// closed if its lookup does not check out.
+bool ws_init_image(Err **err, WordStore **ws, DictImage *image) {
+    size_t count = image->word_count;
+    WordStore *ts =
+        calloc((size_t)1, sizeof(WordStore) + count * sizeof(char *));
+    if (!ts) {
+        dict_image_close(image);
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for word store");
+        return false;
+    }
+    ts->image = *image;
+    ts->word_count = count;
+    ts->word_lens = image->word_lens;
+    ts->word_chars = image->word_chars;
+    ts->dict_hash = image->dict_hash;
+    for (size_t i = 0; i < count; i++) {
+        ts->words[i] = image->text + image->word_offs[i];
+    }
+
+    if (!perfect_hash_mapimage(err, &ts->lookup, ts->words, count,
+                               image->lookup, image->lookup_len)) {
+        word_store_destroy(&ts);
+        return false;
+    }
+    ws_indexer_start(err, ts, NULL);
     if (*err) {
+        word_store_destroy(&ts);
+        return false;
+    }
+
+    *ws = ts;
+    return true;
+}
+
+// Load the sentence model for WORD_PICK_MARKOV, built from the corpus on
+// first use and whenever the corpus or dictionary changes. A NULL model path
+// uses the default file in the data dir.
+void word_store_loadcorpus(Err **err, WordStore *ws, const char *corpus_path,
+                           const char *model_path) {
+    if (*err) {
+        return;
+    }
+
+    MarkovModel *m = NULL;
+    markov_init(err, &m, ws->lookup, ws->word_count, ws->dict_hash,
+                corpus_path, model_path);
+    if (*err) {
+        return;
+    }
+    markov_destroy(&ws->markov);
+    ws->markov = m;
+}
+
+void word_store_randn(Err **err, WordStore *ws, Rng *rng, WordPick pick,
+                      size_t buff_size, uint32_t buff[buff_size]) {
+    if (*err) {
+        return;
+    }
+
+    if (pick == WORD_PICK_MARKOV && ws->markov) {
+        markov_generate(ws->markov, rng, buff_size, buff);
         return;
     }
+    if (pick == WORD_PICK_WEAKNESS || pick == WORD_PICK_DRILL) {
+        word_store_waitindex(err, ws);
+        if (*err) {
+            return;
+        }
+    }
+
+    uint64_t total = 0;
+    if (pick == WORD_PICK_WEAKNESS && ws->weights) {
+        total = word_weights_total(ws->weights);
+    }
+
     size_t rand_i = 0;
     for (size_t i = 0; i < buff_size; i++) {
-        rand_i = (size_t)rand() % (ws->word_count + 1);
-        buff[i] = ws->words[rand_i];
+        if (pick == WORD_PICK_DRILL && ws->drill_count) {
+            rand_i = ws->drill_ids[rng_next(rng) % ws->drill_count];
+        } else if (total) {
+            rand_i = word_weights_find(ws->weights, rng_next(rng) % total);
+        } else {
+            rand_i = (size_t)(rng_next(rng) % ws->word_count);
+        }
+        buff[i] = (uint32_t)rand_i;
     }
 }
 
-size_t word_store_rands(Err **err, WordStore *ws, size_t word_count,
-                        char **tgt) {
+// Pick a test as word ids. No characters are copied, views read them from the
+// pool through the offsets.
+size_t word_store_rands(Err **err, WordStore *ws, Rng *rng, Arena *arena,
+                        WordPick pick, size_t word_count, TestText *tgt) {
     if (*err) {
         return 0;
     }
 
-    size_t buff_cap = (size_t)8 * word_count;
-    size_t buff_len = 0;
-    char *buff = calloc(buff_cap, sizeof(*buff));
-    if (!buff) {
-        *err = ERR_MAKE("Unable to allocate memory for buffer");
+    uint32_t *ids = ARENA_ALLOC(arena, uint32_t, word_count);
+    if (!ids) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for word picks");
         return 0;
     }
+    word_store_randn(err, ws, rng, pick, word_count, ids);
+    return ws_text_offsets(err, ws, arena, ids, word_count, tgt);
+}
 
-    size_t rand_i = 0;
+// Use a given test, such as a recorded round's, ids must index ws
+size_t word_store_settext(Err **err, const WordStore *ws, Arena *arena,
+                          const uint32_t *ids, size_t word_count,
+                          TestText *tgt) {
+    if (*err) {
+        return 0;
+    }
+
+    uint32_t *copy = ARENA_ALLOC(arena, uint32_t, word_count);
+    if (!copy) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for word picks");
+        return 0;
+    }
+    memcpy(copy, ids, word_count * sizeof(*ids));
+    return ws_text_offsets(err, ws, arena, copy, word_count, tgt);
+}
+
+size_t ws_text_offsets(Err **err, const WordStore *ws, Arena *arena,
+                       uint32_t *ids, size_t word_count, TestText *tgt) {
+    if (*err) {
+        return 0;
+    }
+    uint32_t *offs = ARENA_ALLOC(arena, uint32_t, word_count + 1);
+    if (!offs) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for word picks");
+        return 0;
+    }
+
+    size_t n = 0;
     for (size_t i = 0; i < word_count; i++) {
-        rand_i = (size_t)rand() % (ws->word_count + 1);
-        const char *w = ws->words[rand_i];
-
-        size_t word_len = strlen(w);
-        size_t space_needed = i ? word_len + 1 : word_len;
-
-        if (buff_len + space_needed >= buff_cap) {
-            buff_cap += 256;
-            char *t = realloc(buff, buff_cap * sizeof(*t));
-            if (!t) {
-                free(buff);
-                buff = NULL;
-                *err = ERR_MAKE("Unable to expand buffer");
-                return 0;
-            }
-            buff = t;
-        }
+        offs[i] = (uint32_t)n;
+        n += ws->word_chars[ids[i]] + 1;
+    }
+    offs[word_count] = (uint32_t)n;
 
-        if (i) {
-            buff[buff_len++] = ' ';
+    tgt->word_count = word_count;
+    tgt->len = n ? n - 1 : 0;
+    tgt->ids = ids;
+    tgt->offs = offs;
+    return tgt->len;
+}
+
+// Id of a dictionary word, false if the word is not in the dictionary
+bool word_store_find(const WordStore *ws, const char *word, size_t len,
+                     uint32_t *id) {
+    return perfect_hash_find(ws->lookup, word, len, id);
+}
+
+// Code point at index i of the text
+uint32_t word_store_textchar(const WordStore *ws, const TestText *text,
+                             size_t i) {
+    size_t lo = 0;
+    size_t hi = text->word_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (text->offs[mid] <= i) {
+            lo = mid;
+        } else {
+            hi = mid;
         }
+    }
+
+    uint32_t id = text->ids[lo];
+    size_t pos = i - text->offs[lo];
+    if (pos >= ws->word_chars[id]) {
+        return ' ';
+    }
+    const char *w = ws->words[id];
+    if (ws->word_chars[id] == ws->word_lens[id]) {
+        return (unsigned char)w[pos];
+    }
+
+    // Words with multi-byte chars are walked to the code point
+    uint32_t c = 0;
+    size_t b = 0;
+    for (size_t k = 0; k <= pos; k++) {
+        b += utf8_decode(w + b, ws->word_lens[id] - b, &c);
+    }
+    return c;
+}
 
-        string_copy(&buff[buff_len], word_len, w, word_len);
-        buff_len += word_len;
+// Block until the background indexes are built. A failed build is reported
+// to the first caller, after which weighted picks fall back to uniform.
+void word_store_waitindex(Err **err, WordStore *ws) {
+    if (*err) {
+        return;
+    }
+
+    WSIndexer *ix = ws->indexer;
+    mtx_lock(&ix->lock);
+    while (!ix->ready) {
+        cnd_wait(&ix->ready_cnd, &ix->lock);
+    }
+    *err = ix->err;
+    ix->err = NULL;
+    mtx_unlock(&ix->lock);
+}
+
+// Reweight words from the heatmap history and point drills at the words
+// containing any of the current weakest bigrams
+void word_store_setweakness(Err **err, WordStore *ws,
+                            const KeyHeatmap *history,
+                            const KeyHeatmap *changed) {
+    if (*err) {
+        return;
+    }
+
+    WSIndexer *ix = ws->indexer;
+    mtx_lock(&ix->lock);
+    if (!ix->ready) {
+        // Superseded by a full rebuild from this history once built
+        if (!ix->pending) {
+            ix->pending = malloc(sizeof(*ix->pending));
+        }
+        if (ix->pending) {
+            memcpy(ix->pending, history, sizeof(*history));
+        }
+        mtx_unlock(&ix->lock);
+        return;
     }
+    mtx_unlock(&ix->lock);
+
+    ws_applyweakness(err, ws, history, changed);
+}
 
-    *tgt = buff;
-    return buff_len;
+// Restrict WORD_PICK_DRILL to words matching the n-grams, no n-grams or no
+// matching words falls back to uniform picks
+void word_store_setdrill(Err **err, WordStore *ws, const char *const *ngrams,
+                         size_t ngram_count, NgramOp op) {
+    word_store_waitindex(err, ws);
+    ws_applydrill(err, ws, ngrams, ngram_count, op);
 }
 
 void word_store_destroy(WordStore **word_store) {
@@ -146,64 +438,215 @@ void word_store_destroy(WordStore **word_store) {
         return;
     }
 
-    for (size_t i = 0; i < ws->word_count; i++) {
-        free((ws)->words[i]);
+    WSIndexer *ix = ws->indexer;
+    if (ix) {
+        if (ix->started) {
+            thrd_join(ix->thread, NULL);
+        }
+        if (ix->has_sync) {
+            mtx_destroy(&ix->lock);
+            cnd_destroy(&ix->ready_cnd);
+        }
+        err_destroy(&ix->err);
+        free(ix->pending);
+        free(ix);
+        ws->indexer = NULL;
+    }
+
+    if (!ws->image.map) {
+        free(ws->word_lens);
+        free(ws->word_chars);
+    }
+    if (ws->lookup) {
+        perfect_hash_destroy(&ws->lookup);
+    }
+    dict_image_close(&ws->image);
+    if (ws->weights) {
+        word_weights_destroy(&ws->weights);
+    }
+    if (ws->ngrams) {
+        ngram_index_destroy(&ws->ngrams);
+    }
+    free(ws->drill_ids);
+    if (ws->markov) {
+        markov_destroy(&ws->markov);
     }
     free(ws);
     ws = NULL;
     *word_store = NULL;
 }
 
-bool word_store_read_line(Err **err, FILE *s, char **lp) {
-    if (feof(s)) {
-        return false;
-    }
-    if (ferror(s)) {
-        *err = ERR_MAKE("Error reading file");
-        return false;
+// Whole contents of s with a NUL after them, size_hint is the expected
+// length if known
+void ws_read_all(Err **err, FILE *s, size_t size_hint, char **text,
+                 size_t *len) {
+    size_t cap = size_hint ? size_hint + 2 : 65536;
+    size_t n = 0;
+    char *buff = malloc(cap);
+    while (buff) {
+        n += fread(&buff[n], 1, cap - n - 1, s);
+        if (n < cap - 1) {
+            break;
+        }
+        cap *= 2;
+        char *t = realloc(buff, cap);
+        if (!t) {
+            free(buff);
+        }
+        buff = t;
     }
 
-    size_t buff_len = 64;
-    char *buff = calloc(buff_len, sizeof(*buff));
     if (!buff) {
-        *err = ERR_MAKE("Unable to allocate memory for buffer");
-        return false;
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate memory for buffer");
+        return;
     }
+    if (ferror(s)) {
+        free(buff);
+        *err = ERR_MAKE_CODE(ERR_IO, "File error");
+        return;
+    }
+    buff[n] = '\0';
+    *text = buff;
+    *len = n;
+}
 
-    int c = 0;
-    size_t n = 0;
-    while ((c = fgetc(s)) != EOF && c != '\n') {
-
-        // expand buffer if needed
-        if (n >= buff_len - 1) {
-            buff_len += 64;
-            char *t = realloc(buff, buff_len * sizeof(*buff));
-            if (!t) {
-                free(buff);
-                buff = NULL;
-                *err = ERR_MAKE("Unable to allocate memory for buffer");
-                return false;
-            } else {
-                buff = t;
+// Line of the first invalid sequence, only looked for once one is known
+size_t ws_bad_line(const char *text, size_t len) {
+    size_t line = 1;
+    size_t start = 0;
+    for (size_t i = 0; i <= len; i++) {
+        if (i == len || text[i] == '\n') {
+            if (!utf8_valid(&text[start], i - start)) {
+                break;
             }
+            line++;
+            start = i + 1;
         }
+    }
+    return line;
+}
 
-        buff[n++] = (char)c;
+// With a source, the image for it is published once the indexes are built
+void ws_indexer_start(Err **err, WordStore *ws, const struct stat *source) {
+    WSIndexer *ix = ZALLOC(sizeof(*ix));
+    if (!ix) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate word indexer");
+        return;
+    }
+    ws->indexer = ix;
+    if (source) {
+        ix->publish = true;
+        ix->source = *source;
     }
 
-    if (n == 0 && c == EOF) {
-        free(buff);
-        return false;
+    if (mtx_init(&ix->lock, mtx_plain) != thrd_success) {
+        *err = ERR_MAKE("Unable to initialise word indexer lock");
+        return;
+    }
+    if (cnd_init(&ix->ready_cnd) != thrd_success) {
+        mtx_destroy(&ix->lock);
+        *err = ERR_MAKE("Unable to initialise word indexer condition");
+        return;
     }
 
-    buff[n] = '\0';
-    *lp = buff;
-    return true;
+    ix->has_sync = true;
+
+    // Without a thread the build runs inline, the store works either way
+    ix->started = thrd_create(&ix->thread, ws_index_main, ws) == thrd_success;
+    if (!ix->started) {
+        ws_index_main(ws);
+    }
 }
 
-void words_free(char **words, size_t count) {
-    for (size_t i = 0; i < count; i++) {
-        free(words[i]);
+int ws_index_main(void *arg) {
+    WordStore *ws = arg;
+    WSIndexer *ix = ws->indexer;
+    Err *e = NULL;
+
+    ws_index_build(&e, ws);
+
+    mtx_lock(&ix->lock);
+    if (!e && ix->pending) {
+        ws_applyweakness(&e, ws, ix->pending, NULL);
     }
-    free(words);
+    free(ix->pending);
+    ix->pending = NULL;
+    bool publish = !e && ix->publish;
+    ix->err = e;
+    ix->ready = true;
+    cnd_broadcast(&ix->ready_cnd);
+    mtx_unlock(&ix->lock);
+
+    // Later processes map what this one parsed, or parse it too if that
+    // fails. Only the parts of the indexes that never change are written, so
+    // picks may go on meanwhile.
+    if (publish) {
+        Err *share_err = NULL;
+        dict_image_publish(&share_err, &ix->source, ws->words, ws->word_lens,
+                           ws->word_chars, ws->word_count, ws->dict_hash,
+                           ws->lookup, ws->weights, ws->ngrams);
+        err_destroy(&share_err);
+    }
+    return 0;
+}
+
+// Per-word bigram profiles for weakness weighted picks, and word lists by
+// contained n-gram for drills. Both are used in place from a mapped image
+// that holds them, otherwise each build is itself sharded.
+void ws_index_build(Err **err, WordStore *ws) {
+    DictImage *image = &ws->image;
+    if (!image->map ||
+        (!word_weights_mapimage(err, &ws->weights, ws->word_count,
+                                image->weights, image->weights_len) &&
+         !*err)) {
+        word_weights_init(err, &ws->weights, ws->words, ws->word_count);
+    }
+    if (*err) {
+        return;
+    }
+    if (!image->map ||
+        (!ngram_index_mapimage(err, &ws->ngrams, ws->word_count,
+                               image->ngrams, image->ngrams_len) &&
+         !*err)) {
+        ngram_index_init(err, &ws->ngrams, ws->words, ws->word_count);
+    }
+}
+
+void ws_applyweakness(Err **err, WordStore *ws, const KeyHeatmap *history,
+                      const KeyHeatmap *changed) {
+    if (!ws->weights || !ws->ngrams) {
+        return;
+    }
+    word_weights_update(ws->weights, history, changed);
+
+    uint16_t weakest[WS_DRILL_NGRAMS];
+    size_t n = word_weights_weakest(ws->weights, WS_DRILL_NGRAMS, weakest);
+
+    char ngram_buffs[WS_DRILL_NGRAMS][3];
+    const char *ngrams[WS_DRILL_NGRAMS];
+    for (size_t i = 0; i < n; i++) {
+        ngram_buffs[i][0] = (char)(weakest[i] / HEATMAP_KEYS);
+        ngram_buffs[i][1] = (char)(weakest[i] % HEATMAP_KEYS);
+        ngram_buffs[i][2] = '\0';
+        ngrams[i] = ngram_buffs[i];
+    }
+    ws_applydrill(err, ws, ngrams, n, NGRAM_OP_UNION);
+}
+
+void ws_applydrill(Err **err, WordStore *ws, const char *const *ngrams,
+                   size_t ngram_count, NgramOp op) {
+    if (*err || !ws->ngrams) {
+        return;
+    }
+
+    uint32_t *ids = NULL;
+    size_t count =
+        ngram_index_match(err, ws->ngrams, ngrams, ngram_count, op, &ids);
+    if (*err) {
+        return;
+    }
+
+    free(ws->drill_ids);
+    ws->drill_ids = ids;
+    ws->drill_count = count;
 }
@@ -1,21 +1,83 @@
 #ifndef WORD_STORE_H
 #define WORD_STORE_H
 
+#include "arena.h"
+#include "dict_image.h"
 #include "err.h"
+#include "key_heatmap.h"
+#include "markov.h"
+#include "ngram_index.h"
+#include "perfect_hash.h"
+#include "rng.h"
+#include "string_pool.h"
+#include "word_weights.h"
 #include <err.h>
 #include <stdbool.h>
 #include <stdint.h>
 
+typedef struct WSIndexer WSIndexer;
+
+typedef enum WordPick {
+    WORD_PICK_UNIFORM,
+    WORD_PICK_WEAKNESS,
+    WORD_PICK_DRILL,
+    WORD_PICK_MARKOV,
+} WordPick;
+
+// Words are UTF-8, interned in a pool that may be shared with other
+// dictionaries. word_lens are in bytes and word_chars in code points. The
+// hash over the words ties stored word ids to the dictionary they index.
+// Picks draw from the caller's generator and only read the store, so one
+// store can serve sessions on many threads; loadcorpus, setweakness and
+// setdrill rewrite it and must not overlap picks. When image is mapped the
+// words, lengths and lookup live in it, shared with other processes.
 typedef struct WordStore {
     uint64_t word_count;
+    uint32_t *word_lens;
+    uint32_t *word_chars;
+    uint32_t dict_hash;
+    PerfectHash *lookup;
+    WSIndexer *indexer;
+    WordWeights *weights;
+    NgramIndex *ngrams;
+    uint32_t *drill_ids;
+    size_t drill_count;
+    MarkovModel *markov;
+    DictImage image;
     char *words[];
 } WordStore;
 
-void word_store_init(Err **err, WordStore **ws, const char *dict_path);
-void word_store_randn(Err **err, WordStore *ws, size_t buff_size,
-                      const char *buff[buff_size]);
-size_t word_store_rands(Err **err, WordStore *ws, size_t word_count,
-                        char **tgt);
+// A generated test as word ids. offs[i] is the code point index of word i
+// within the text, with offs[word_count] one past the end as if followed by
+// a space.
+typedef struct TestText {
+    size_t word_count;
+    size_t len;
+    uint32_t *ids;
+    uint32_t *offs;
+} TestText;
+
+void word_store_init(Err **err, WordStore **ws, const char *dict_path,
+                     StringPool *strings);
+void word_store_loadcorpus(Err **err, WordStore *ws, const char *corpus_path,
+                           const char *model_path);
+void word_store_randn(Err **err, WordStore *ws, Rng *rng, WordPick pick,
+                      size_t buff_size, uint32_t buff[buff_size]);
+size_t word_store_rands(Err **err, WordStore *ws, Rng *rng, Arena *arena,
+                        WordPick pick, size_t word_count, TestText *tgt);
+size_t word_store_settext(Err **err, const WordStore *ws, Arena *arena,
+                          const uint32_t *ids, size_t word_count,
+                          TestText *tgt);
+bool word_store_find(const WordStore *ws, const char *word, size_t len,
+                     uint32_t *id);
+uint32_t word_store_textchar(const WordStore *ws, const TestText *text,
+                             size_t i);
+void word_store_waitindex(Err **err, WordStore *ws);
+void word_store_setweakness(Err **err, WordStore *ws,
+                            const KeyHeatmap *history,
+                            const KeyHeatmap *changed);
+void word_store_setdrill(Err **err, WordStore *ws, const char *const *ngrams,
+                         size_t ngram_count, NgramOp op);
 void word_store_destroy(WordStore **ws);
 
 #endif
@@ -0,0 +1,462 @@
+#include "word_weights.h"
+#include "err.h"
+#include "helpers.h"
+#include "key_heatmap.h"
+#include "parallel.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WW_BIGRAMS (HEATMAP_KEYS * HEATMAP_KEYS)
+#define WW_MAX_WORD_BIGRAMS 64
+#define WW_SHARD_MIN_WORDS 2048
+
+// Weights are fixed point, one unit is WW_SCALE. Every word has a base weight
+// so that words without weak bigrams still turn up.
+#define WW_SCALE 1024
+#define WW_BASE WW_SCALE
+#define WW_MAX_BIGRAM (WW_SCALE * 8)
+
+// Weight of a bigram that has never been typed, see ww_bigram_weight
+#define WW_UNSEEN ((uint32_t)(8. * 0.5 / 20. * WW_SCALE))
+
+// Each word's weight is the base plus the weakness of the distinct bigrams it
+// contains, including the transitions from and to the surrounding spaces.
+// Weights live in a Fenwick tree so a single word is reweighted, and a word
+// drawn in proportion to its weight, in O(log n). Both directions of the
+// word/bigram relation are kept as CSR arrays built at load, or used in place
+// from an image as they never change; only the weights are per process.
+struct WordWeights {
+    size_t word_count;
+    size_t profile_len;
+    uint32_t *word_bigram_offs;
+    uint16_t *word_bigrams;
+    uint32_t *bigram_word_offs;
+    uint32_t *bigram_words;
+    uint32_t bigram_weight[WW_BIGRAMS];
+    uint64_t latency_sum;
+    uint64_t timed;
+    uint64_t *tree;
+    size_t tree_top;
+    bool mapped;
+};
+
+// The CSR arrays saved for use in place: this header, then word_bigram_offs,
+// word_bigrams, bigram_word_offs and bigram_words, each 8 byte aligned
+typedef struct WWImage {
+    uint64_t word_count;
+    uint64_t profile_len;
+} WWImage;
+
+typedef struct WWBuild {
+    WordWeights *ww;
+    char *const *words;
+    uint32_t *shard_counts;
+} WWBuild;
+
+size_t ww_word_bigrams(const char *w, uint16_t *out);
+void ww_build_counts(void *ctx, size_t shard, size_t shard_count);
+void ww_build_profiles(void *ctx, size_t shard, size_t shard_count);
+void ww_build_postings(void *ctx, size_t shard, size_t shard_count);
+uint32_t ww_bigram_weight(const KeyHeatmap *hm, size_t b, double mean_latency);
+void ww_rebuild(WordWeights *ww, const KeyHeatmap *history,
+                double mean_latency);
+void ww_tree_add(WordWeights *ww, size_t i, uint64_t delta);
+void ww_tree_init(Err **err, WordWeights *ww);
+size_t ww_align8(size_t n);
+
+void word_weights_init(Err **err, WordWeights **weights, char *const *words,
+                       size_t word_count) {
+    WordWeights *ww = ZALLOC(sizeof(*ww));
+    if (!ww) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for word weights");
+        return;
+    }
+    ww->word_count = word_count;
+
+    // Word to bigram profile
+    size_t shard_count = parallel_shards(word_count, WW_SHARD_MIN_WORDS);
+    WWBuild build = {.ww = ww, .words = words};
+    build.shard_counts = calloc(shard_count * WW_BIGRAMS, sizeof(uint32_t));
+    ww->word_bigram_offs = calloc(word_count + 1, sizeof(uint32_t));
+    ww->bigram_word_offs = calloc(WW_BIGRAMS + 1, sizeof(uint32_t));
+    if (!build.shard_counts || !ww->word_bigram_offs ||
+        !ww->bigram_word_offs) {
+        free(build.shard_counts);
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate word profiles");
+        word_weights_destroy(&ww);
+        return;
+    }
+
+    parallel_run(shard_count, ww_build_counts, &build);
+    for (size_t i = 0; i < word_count; i++) {
+        ww->word_bigram_offs[i + 1] += ww->word_bigram_offs[i];
+    }
+    size_t total = ww->word_bigram_offs[word_count];
+    ww->profile_len = total;
+
+    ww->word_bigrams = calloc(MAX_N(total, 1), sizeof(uint16_t));
+    ww->bigram_words = calloc(MAX_N(total, 1), sizeof(uint32_t));
+    if (!ww->word_bigrams || !ww->bigram_words) {
+        free(build.shard_counts);
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate word profiles");
+        word_weights_destroy(&ww);
+        return;
+    }
+    parallel_run(shard_count, ww_build_profiles, &build);
+
+    // Invert into bigram to word postings by a counting sort. Each shard's
+    // slice of a posting list follows the previous shard's, so word ids stay
+    // ascending and shards fill their slices independently.
+    uint32_t running = 0;
+    for (size_t b = 0; b < WW_BIGRAMS; b++) {
+        for (size_t shard = 0; shard < shard_count; shard++) {
+            uint32_t *count = &build.shard_counts[shard * WW_BIGRAMS + b];
+            uint32_t n = *count;
+            *count = running;
+            running += n;
+        }
+        ww->bigram_word_offs[b + 1] = running;
+    }
+    parallel_run(shard_count, ww_build_postings, &build);
+    free(build.shard_counts);
+
+    ww_tree_init(err, ww);
+    if (*err) {
+        word_weights_destroy(&ww);
+        return;
+    }
+    *weights = ww;
+}
+
+// Recompute the weakness of bigrams seen in changed (all bigrams if NULL)
+// from the history and push the differences to each containing word. Every
+// weight is relative to the mean latency, so once that moves nothing short of
+// a full rebuild keeps the weights in step. A round touching more postings
+// than there are words is also cheaper to rebuild than to update.
+void word_weights_update(WordWeights *ww, const KeyHeatmap *history,
+                         const KeyHeatmap *changed) {
+    uint64_t latency_sum = 0;
+    uint64_t timed = 0;
+    if (history) {
+        for (size_t a = 0; a < HEATMAP_KEYS; a++) {
+            for (size_t b = 0; b < HEATMAP_KEYS; b++) {
+                latency_sum += history->bigram_latency_ms[a][b];
+                timed += history->bigram_timed[a][b];
+            }
+        }
+    }
+    double mean_latency = timed ? (double)latency_sum / (double)timed : 0.;
+
+    bool full = !changed || latency_sum != ww->latency_sum ||
+                timed != ww->timed;
+    size_t touched = 0;
+    for (size_t b = 0; b < WW_BIGRAMS && !full; b++) {
+        if (changed->bigram_count[b / HEATMAP_KEYS][b % HEATMAP_KEYS] &&
+            ww_bigram_weight(history, b, mean_latency) !=
+                ww->bigram_weight[b]) {
+            touched += ww->bigram_word_offs[b + 1] - ww->bigram_word_offs[b];
+            full = touched > ww->word_count;
+        }
+    }
+    ww->latency_sum = latency_sum;
+    ww->timed = timed;
+    if (full) {
+        ww_rebuild(ww, history, mean_latency);
+        return;
+    }
+
+    for (size_t b = 0; b < WW_BIGRAMS; b++) {
+        if (!changed->bigram_count[b / HEATMAP_KEYS][b % HEATMAP_KEYS]) {
+            continue;
+        }
+        uint32_t w = ww_bigram_weight(history, b, mean_latency);
+        if (w == ww->bigram_weight[b]) {
+            continue;
+        }
+
+        // Unsigned wrap-around carries negative deltas through the tree
+        uint64_t delta = (uint64_t)w - (uint64_t)ww->bigram_weight[b];
+        ww->bigram_weight[b] = w;
+        for (uint32_t k = ww->bigram_word_offs[b];
+             k < ww->bigram_word_offs[b + 1]; k++) {
+            ww_tree_add(ww, ww->bigram_words[k], delta);
+        }
+    }
+}
+
+uint64_t word_weights_total(WordWeights *ww) {
+    uint64_t total = 0;
+    for (size_t i = ww->word_count; i > 0; i -= i & -i) {
+        total += ww->tree[i];
+    }
+    return total;
+}
+
+// Index of the word whose cumulative weight range holds r
+size_t word_weights_find(WordWeights *ww, uint64_t r) {
+    size_t pos = 0;
+    for (size_t step = ww->tree_top; step; step >>= 1) {
+        if (pos + step <= ww->word_count && ww->tree[pos + step] <= r) {
+            pos += step;
+            r -= ww->tree[pos];
+        }
+    }
+    return MIN_N(pos, ww->word_count - 1);
+}
+
+// Up to n in-word bigrams, weakest first, that have been typed and fare worse
+// than an unseen bigram would. Returns the count written to out.
+size_t word_weights_weakest(WordWeights *ww, size_t n, uint16_t *out) {
+    size_t found = 0;
+    for (size_t b = 0; b < WW_BIGRAMS; b++) {
+        uint32_t w = ww->bigram_weight[b];
+        if (w <= WW_UNSEEN || b / HEATMAP_KEYS == ' ' ||
+            b % HEATMAP_KEYS == ' ' ||
+            ww->bigram_word_offs[b] == ww->bigram_word_offs[b + 1]) {
+            continue;
+        }
+
+        // Insertion into the short sorted list
+        size_t k = MIN_N(found, n);
+        while (k > 0 && ww->bigram_weight[out[k - 1]] < w) {
+            if (k < n) {
+                out[k] = out[k - 1];
+            }
+            k--;
+        }
+        if (k < n) {
+            out[k] = (uint16_t)b;
+            found = MIN_N(found + 1, n);
+        }
+    }
+    return found;
+}
+
+// Bytes word_weights_writeimage needs
+size_t word_weights_imagelen(const WordWeights *ww) {
+    return sizeof(WWImage) +
+           ww_align8((ww->word_count + 1) * sizeof(uint32_t)) +
+           ww_align8(ww->profile_len * sizeof(uint16_t)) +
+           ww_align8((WW_BIGRAMS + 1) * sizeof(uint32_t)) +
+           ww_align8(ww->profile_len * sizeof(uint32_t));
+}
+
+void word_weights_writeimage(const WordWeights *ww, void *image) {
+    WWImage hdr = {
+        .word_count = ww->word_count,
+        .profile_len = ww->profile_len,
+    };
+    char *p = image;
+    memset(p, 0, word_weights_imagelen(ww));
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    memcpy(p, ww->word_bigram_offs, (ww->word_count + 1) * sizeof(uint32_t));
+    p += ww_align8((ww->word_count + 1) * sizeof(uint32_t));
+    memcpy(p, ww->word_bigrams, ww->profile_len * sizeof(uint16_t));
+    p += ww_align8(ww->profile_len * sizeof(uint16_t));
+    memcpy(p, ww->bigram_word_offs, (WW_BIGRAMS + 1) * sizeof(uint32_t));
+    p += ww_align8((WW_BIGRAMS + 1) * sizeof(uint32_t));
+    memcpy(p, ww->bigram_words, ww->profile_len * sizeof(uint32_t));
+}
+
+// Use a written image in place for the same words, with weights of its own.
+// False if its sections do not add up to len; the arrays are trusted as the
+// image's owner wrote them.
+bool word_weights_mapimage(Err **err, WordWeights **weights,
+                           size_t word_count, void *image, size_t len) {
+    WWImage hdr;
+    if (len < sizeof(hdr)) {
+        return false;
+    }
+    memcpy(&hdr, image, sizeof(hdr));
+    if (hdr.word_count != word_count || hdr.profile_len > len) {
+        return false;
+    }
+
+    WordWeights *ww = ZALLOC(sizeof(*ww));
+    if (!ww) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM,
+                             "Unable to allocate memory for word weights");
+        return false;
+    }
+    ww->mapped = true;
+    ww->word_count = word_count;
+    ww->profile_len = (size_t)hdr.profile_len;
+    if (word_weights_imagelen(ww) != len) {
+        word_weights_destroy(&ww);
+        return false;
+    }
+
+    char *p = (char *)image + sizeof(hdr);
+    ww->word_bigram_offs = (void *)p;
+    p += ww_align8((word_count + 1) * sizeof(uint32_t));
+    ww->word_bigrams = (void *)p;
+    p += ww_align8(ww->profile_len * sizeof(uint16_t));
+    ww->bigram_word_offs = (void *)p;
+    p += ww_align8((WW_BIGRAMS + 1) * sizeof(uint32_t));
+    ww->bigram_words = (void *)p;
+
+    ww_tree_init(err, ww);
+    if (*err) {
+        word_weights_destroy(&ww);
+        return false;
+    }
+    *weights = ww;
+    return true;
+}
+
+void word_weights_destroy(WordWeights **weights) {
+    if (!weights || !*weights) {
+        return;
+    }
+
+    WordWeights *ww = *weights;
+    if (!ww->mapped) {
+        free(ww->word_bigram_offs);
+        free(ww->word_bigrams);
+        free(ww->bigram_word_offs);
+        free(ww->bigram_words);
+    }
+    free(ww->tree);
+
+    free(ww);
+    ww = NULL;
+    *weights = NULL;
+}
+
+// Profile length of each word in the shard
+void ww_build_counts(void *ctx, size_t shard, size_t shard_count) {
+    WWBuild *build = ctx;
+    WordWeights *ww = build->ww;
+    uint16_t profile[WW_MAX_WORD_BIGRAMS];
+    size_t start = 0;
+    size_t end = 0;
+    parallel_range(ww->word_count, shard, shard_count, &start, &end);
+    for (size_t i = start; i < end; i++) {
+        ww->word_bigram_offs[i + 1] =
+            (uint32_t)ww_word_bigrams(build->words[i], profile);
+    }
+}
+
+// Fill the shard's profiles and count its words per bigram
+void ww_build_profiles(void *ctx, size_t shard, size_t shard_count) {
+    WWBuild *build = ctx;
+    WordWeights *ww = build->ww;
+    uint32_t *counts = &build->shard_counts[shard * WW_BIGRAMS];
+    size_t start = 0;
+    size_t end = 0;
+    parallel_range(ww->word_count, shard, shard_count, &start, &end);
+    for (size_t i = start; i < end; i++) {
+        uint16_t *profile = &ww->word_bigrams[ww->word_bigram_offs[i]];
+        size_t n = ww_word_bigrams(build->words[i], profile);
+        for (size_t k = 0; k < n; k++) {
+            counts[profile[k]]++;
+        }
+    }
+}
+
+// Scatter the shard's words into its slices of the postings
+void ww_build_postings(void *ctx, size_t shard, size_t shard_count) {
+    WWBuild *build = ctx;
+    WordWeights *ww = build->ww;
+    uint32_t *fill = &build->shard_counts[shard * WW_BIGRAMS];
+    size_t start = 0;
+    size_t end = 0;
+    parallel_range(ww->word_count, shard, shard_count, &start, &end);
+    for (size_t i = start; i < end; i++) {
+        for (uint32_t k = ww->word_bigram_offs[i];
+             k < ww->word_bigram_offs[i + 1]; k++) {
+            ww->bigram_words[fill[ww->word_bigrams[k]]++] = (uint32_t)i;
+        }
+    }
+}
+
+// Distinct bigrams of " word ", returns the count written to out
+size_t ww_word_bigrams(const char *w, uint16_t *out) {
+    size_t n = 0;
+    unsigned char prev = ' ';
+    size_t len = strlen(w);
+    for (size_t i = 0; i <= len && n < WW_MAX_WORD_BIGRAMS; i++) {
+        unsigned char c = i < len ? (unsigned char)w[i] : ' ';
+        if (prev < HEATMAP_KEYS && c < HEATMAP_KEYS) {
+            uint16_t b = (uint16_t)(prev * HEATMAP_KEYS + c);
+            bool seen = false;
+            for (size_t k = 0; k < n && !seen; k++) {
+                seen = out[k] == b;
+            }
+            if (!seen) {
+                out[n++] = b;
+            }
+        }
+        prev = c;
+    }
+    return n;
+}
+
+// Weakness from a smoothed error rate plus how much slower than the mean
+// latency the transition is
+uint32_t ww_bigram_weight(const KeyHeatmap *hm, size_t b, double mean_latency) {
+    size_t x = b / HEATMAP_KEYS;
+    size_t y = b % HEATMAP_KEYS;
+
+    double n = (double)hm->bigram_count[x][y];
+    double e = (double)hm->bigram_errors[x][y];
+    double weakness = 8. * (e + 0.5) / (n + 20.);
+
+    double t = (double)hm->bigram_timed[x][y];
+    if (t >= 3. && mean_latency > 0.) {
+        double ratio = (double)hm->bigram_latency_ms[x][y] / t / mean_latency;
+        weakness += 2. * MAX_N(ratio - 1., 0.);
+    }
+
+    double w = weakness * WW_SCALE;
+    return (uint32_t)MIN_N(w, (double)WW_MAX_BIGRAM);
+}
+
+// Every bigram weight from history (all zero if NULL), then the word weights
+// and their Fenwick tree in linear time
+void ww_rebuild(WordWeights *ww, const KeyHeatmap *history,
+                double mean_latency) {
+    for (size_t b = 0; b < WW_BIGRAMS; b++) {
+        ww->bigram_weight[b] =
+            history ? ww_bigram_weight(history, b, mean_latency) : 0;
+    }
+    for (size_t i = 0; i < ww->word_count; i++) {
+        uint64_t w = WW_BASE;
+        for (uint32_t k = ww->word_bigram_offs[i];
+             k < ww->word_bigram_offs[i + 1]; k++) {
+            w += ww->bigram_weight[ww->word_bigrams[k]];
+        }
+        ww->tree[i + 1] = w;
+    }
+    for (size_t i = 1; i <= ww->word_count; i++) {
+        size_t parent = i + (i & -i);
+        if (parent <= ww->word_count) {
+            ww->tree[parent] += ww->tree[i];
+        }
+    }
+}
+
+// The weights start out from no history
+void ww_tree_init(Err **err, WordWeights *ww) {
+    ww->tree = calloc(ww->word_count + 1, sizeof(uint64_t));
+    if (!ww->tree) {
+        *err = ERR_MAKE_CODE(ERR_NOMEM, "Unable to allocate word weights");
+        return;
+    }
+    ww->tree_top = 1;
+    while (ww->tree_top * 2 <= ww->word_count) {
+        ww->tree_top *= 2;
+    }
+    word_weights_update(ww, NULL, NULL);
+}
+
+void ww_tree_add(WordWeights *ww, size_t i, uint64_t delta) {
+    for (size_t k = i + 1; k <= ww->word_count; k += k & -k) {
+        ww->tree[k] += delta;
+    }
+}
+
+size_t ww_align8(size_t n) { return (n + 7) & ~(size_t)7; }
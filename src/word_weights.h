@@ -0,0 +1,25 @@
+#ifndef WORD_WEIGHTS_H
+#define WORD_WEIGHTS_H
+
+#include "err.h"
+#include "key_heatmap.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct WordWeights WordWeights;
+
+void word_weights_init(Err **err, WordWeights **weights,
+                       char *const *words, size_t word_count);
+void word_weights_update(WordWeights *weights, const KeyHeatmap *history,
+                         const KeyHeatmap *changed);
+uint64_t word_weights_total(WordWeights *weights);
+size_t word_weights_find(WordWeights *weights, uint64_t r);
+size_t word_weights_weakest(WordWeights *weights, size_t n, uint16_t *out);
+size_t word_weights_imagelen(const WordWeights *weights);
+void word_weights_writeimage(const WordWeights *weights, void *image);
+bool word_weights_mapimage(Err **err, WordWeights **weights,
+                           size_t word_count, void *image, size_t len);
+void word_weights_destroy(WordWeights **weights);
+
+#endif